@@ -41,6 +41,17 @@ typedef enum
     OP_LOOP,
     OP_CALL,
     OP_CLOSURE,
+    OP_MAP,
+    OP_MAP_INSERT,
+    OP_ARRAY,
+    OP_ARRAY_PUSH,
+    OP_INDEX_GET,
+    OP_INDEX_SET,
+    OP_ITER_NEXT,
+    OP_RECORD,
+    OP_RECORD_FIELD,
+    OP_GET_FIELD,
+    OP_SET_FIELD,
     OP_RETURN
 } OpCode;
 
@@ -50,6 +61,17 @@ typedef struct
     int line;
 } LineStart;
 
+struct ObjectShape;
+
+// one per field access site. a hit is a single shape compare, then the
+// slot is read directly. when transition is set the site adds the field.
+typedef struct
+{
+    struct ObjectShape *shape;
+    struct ObjectShape *transition;
+    int slot;
+} InlineCache;
+
 typedef struct
 {
     int size;
@@ -60,6 +82,10 @@ typedef struct
     int lineSize;
     int lineMaxSize;
     LineStart *lines;
+
+    int cacheSize;
+    int cacheMaxSize;
+    InlineCache *caches;
 } Chunk;
 
 void initChunk(Chunk *chunk);
@@ -67,6 +93,7 @@ void writeChunk(Chunk *chunk, uint8_t b, int line);
 void freeChunk(Chunk *chunk);
 
 int addConstant(Chunk *chunk, Value value);
+int addInlineCache(Chunk *chunk);
 int getLine(Chunk *chunk, int instruction);
 
 #endif
\ No newline at end of file
@@ -9,6 +9,10 @@
 //#define DEBUG_TRACE_EXECUTION
 //#define DEBUG_STRESS_GC
 //#define DEBUG_LOG_GC
+//#define SORT_NO_THREADS
+//#define HEAP_NO_THREADS
+//#define MARK_NO_THREADS
+//#define COMPRESSED_REFS
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
@@ -4,7 +4,9 @@
 #include "vm.h"
 #include "object.h"
 
-ObjectFunction* compile(const char *source, const char *filename, int debugLeevl);
+ObjectFunction* compile(const char *source, ObjectSource *owner, const char *filename, int debugLeevl);
 void markCompilerRoots();
+// drops whatever a compile that was cut short left behind.
+void resetCompiler();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef meon_gcstats_h
+#define meon_gcstats_h
+
+#include <math.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+
+#define OBJECT_TYPES (OBJECT_SEQ_ITER + 1)
+
+// pauses are counted by length in buckets a quarter of a power of two
+// wide, the first one holds everything under a microsecond. percentiles
+// come out as the top of their bucket, at most 19% over.
+#define GC_PAUSE_BUCKETS 96
+
+// times are in seconds, rates in bytes per second.
+typedef struct
+{
+    size_t cycles;
+    size_t minorCycles;
+    size_t compactions;
+    size_t pauses;
+    double totalPause;
+    double p50Pause;
+    double p99Pause;
+    double maxPause;
+    size_t heap;
+    // the collector's own arrays, on top of heap.
+    size_t metadata;
+    size_t mapped;
+    size_t allocated;
+    size_t freed;
+    double allocationRate;
+    // what live objects of each type take up, with what they own outside
+    // the heap. young ones count if a minor collection would keep them.
+    size_t live[OBJECT_TYPES];
+} GCStats;
+
+static inline int pauseBucket(double pause)
+{
+    double micros = pause * 1e6;
+    if (micros < 1)
+        return 0;
+    int bucket = (int)(log2(micros) * 4) + 1;
+    return bucket < GC_PAUSE_BUCKETS ? bucket : GC_PAUSE_BUCKETS - 1;
+}
+
+void gcStats(GCStats *stats);
+const char *objectTypeName(object_t t);
+void printGCStats(FILE *file);
+void writeGCStatsJson(FILE *file);
+
+#endif
\ No newline at end of file
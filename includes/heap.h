@@ -0,0 +1,165 @@
+#ifndef meon_heap_h
+#define meon_heap_h
+
+#include "common.h"
+#include "object.h"
+
+// old objects live in pages of one size class each. a page is aligned to
+// its size, so the page of an object is its address with the low bits
+// cleared. anything bigger than the largest class gets a page to itself.
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_CELL_MIN 16
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_SIZE / HEAP_CELL_MIN / 64)
+#define HEAP_SMALL_MAX 2048
+#define HEAP_CLASSES 27
+#define HEAP_LARGE (-1)
+// sweeping everything at once is split across threads past this many pages.
+#define HEAP_PARALLEL_MIN 256
+#define HEAP_THREADS_MAX 8
+// compaction empties small pages that are at most this full.
+#define HEAP_SPARSE_PERCENT 50
+// pages are carved out of regions mapped from the system, aligned so that
+// they can be backed by huge pages. a page bigger than that, or the
+// nursery, gets a region of its own.
+#define HEAP_REGION_SIZE (4 * 1024 * 1024)
+#define HEAP_REGION_PAGES (HEAP_REGION_SIZE / HEAP_PAGE_SIZE)
+
+// per cell bits the collector sets and the sweep clears. claimed and
+// scanned say who traces an object during concurrent marking.
+enum
+{
+    PAGE_MARKED,
+    PAGE_CLAIMED,
+    PAGE_SCANNED,
+    PAGE_BITMAPS
+};
+
+typedef struct Region
+{
+    struct Region *prev;
+    struct Region *next;
+    uint8_t *base;
+    size_t size;
+    bool isShared;
+    // shared regions only, a bit per page. pages that were used since the
+    // memory was last given back may still be holding some, idle ones were
+    // free and untouched since the last release.
+    uint64_t used;
+    uint64_t committed;
+    uint64_t idle;
+} Region;
+
+typedef struct Page
+{
+    struct Page *next;
+    Region *region;
+    // pages of a class with a free cell, allocation takes the first one.
+    struct Page *prevAvailable;
+    struct Page *nextAvailable;
+    bool isAvailable;
+    int sizeClass;
+    uint32_t cellSize;
+    uint32_t cellCount;
+    // cells past fresh were never used, freed ones are on freeList.
+    uint32_t fresh;
+    // ( offset * reciprocal ) >> 32 is offset / cellSize for any offset
+    // inside the page.
+    uint32_t reciprocal;
+    void *freeList;
+    uint8_t *cells;
+    uint64_t live[HEAP_BITMAP_WORDS];
+    uint64_t bitmaps[PAGE_BITMAPS][HEAP_BITMAP_WORDS];
+} Page;
+
+typedef struct
+{
+    Page *pages;
+    // once marking is done every page waits here by class, large ones
+    // last, until the allocator needs room in that class or the collector
+    // gets to it. nothing is allocated on a page before it's swept.
+    Page *unswept[HEAP_CLASSES + 1];
+    int unsweptCount;
+    Page *available[HEAP_CLASSES];
+    // frees what a dead object owns, it runs on sweeper threads too while
+    // parallel is set.
+    void (*release)(Object *);
+    // sweeper threads call enter(owner) before they release anything.
+    void (*enter)(void *owner);
+    void *owner;
+    bool parallel;
+    Region *regions;
+    size_t mapped;
+    bool hugePages;
+} Heap;
+
+// a region of its own, aligned to HEAP_PAGE_SIZE and inside the cage when
+// references are compressed.
+void *mapRegion(Heap *heap, size_t size);
+void unmapRegion(Heap *heap, void *memory);
+// tells the system about pages that stayed free since the last call and
+// unmaps regions that did. with huge pages only whole regions go.
+void releaseMemory(Heap *heap);
+
+void initPages(Heap *heap, void (*release)(Object *));
+Object *heapAllocate(Heap *heap, size_t size);
+void startSweep(Heap *heap);
+bool sweepNext(Heap *heap);
+void sweepRest(Heap *heap);
+// releases every object that's left and unmaps everything.
+void freePages(Heap *heap);
+
+// the share of small page space that's free, once there's at least
+// minimum bytes of it.
+double heapFragmentation(Heap *heap, size_t minimum);
+// sparse pages come off the heap so nothing is allocated on them. once
+// their objects have moved they're given back without releasing them.
+Page *takeSparsePages(Heap *heap);
+void visitLive(Page *page, void (*visit)(Object *));
+// every object on the heap, or with marked only the marked ones. pages
+// that weren't swept yet only ever have their marked ones visited.
+void visitHeap(Heap *heap, bool marked, void (*visit)(Object *));
+void dropPages(Heap *heap, Page *pages);
+
+static inline Page *pageOf(Object *object)
+{
+    return (Page *)((uintptr_t)object & ~(uintptr_t)(HEAP_PAGE_SIZE - 1));
+}
+
+static inline uint32_t cellIndex(Page *page, Object *object)
+{
+    return (uint32_t)(((uint64_t)((uint8_t *)object - page->cells) * page->reciprocal) >> 32);
+}
+
+// these bits may be set by the concurrent marker and an allocating mutator
+// at once, so they're only ever set atomically.
+static inline bool heapTest(Object *object, int bitmap)
+{
+    Page *page = pageOf(object);
+    uint32_t index = cellIndex(page, object);
+    return __atomic_load_n(&page->bitmaps[bitmap][index / 64], __ATOMIC_ACQUIRE) &
+           ((uint64_t)1 << (index % 64));
+}
+
+// true if this call set it.
+static inline bool heapSet(Object *object, int bitmap)
+{
+    Page *page = pageOf(object);
+    uint32_t index = cellIndex(page, object);
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    uint64_t *word = &page->bitmaps[bitmap][index / 64];
+    if (__atomic_load_n(word, __ATOMIC_ACQUIRE) & bit)
+        return false;
+    return !(__atomic_fetch_or(word, bit, __ATOMIC_ACQ_REL) & bit);
+}
+
+static inline bool heapIsMarked(Object *object)
+{
+    return heapTest(object, PAGE_MARKED);
+}
+
+static inline bool heapMark(Object *object)
+{
+    return heapSet(object, PAGE_MARKED);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef meon_map_h
+#define meon_map_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+#define MAP_SLOT_EMPTY (-1)
+#define MAP_SLOT_DELETED (-2)
+
+bool isMapKey(Value key);
+uint32_t hashMapKey(Value key);
+bool mapGet(ObjectMap *map, Value key, Value *value);
+bool mapSet(ObjectMap *map, Value key, Value value);
+bool mapDelete(ObjectMap *map, Value key);
+bool mapNext(ObjectMap *map, int *cursor, Value *key);
+void markMap(ObjectMap *map);
+void freeMap(ObjectMap *map);
+void printMap(ObjectMap *map);
+
+#endif
\ No newline at end of file
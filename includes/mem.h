@@ -4,6 +4,7 @@
 #include "common.h"
 #include "object.h"
 #include "compiler.h"
+#include "vm.h"
 
 #define GROW_ARRAY_SIZE(maxSize) ((maxSize) < 8 ? 8 : (maxSize)*2)
 #define GROW_ARRAY(t, pointer, oldSize, newSize) \
@@ -14,10 +15,71 @@
     (t *)reallocate(NULL, 0, sizeof(t) * (count))
 #define FREE(t, pointer) reallocate(pointer, sizeof(t), 0)
 
+#define GC_NURSERY_SIZE (1024 * 1024)
+#define GC_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+#define IN_NURSERY(object)                                        \
+    ((uintptr_t)((uint8_t *)(object)-vm->nurseryStart) <          \
+     (uintptr_t)(vm->nurseryEnd - vm->nurseryStart))
+
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
+Object *allocateObject(size_t size, object_t t);
+size_t objectSize(Object *object);
+void rememberObject(Object *object);
+void scanBeforeWrite(Object *object);
+void keepAlive(Object *object);
 void markValue(Value value);
 void markObject(Object* object);
+void collectYoung();
 void collectGarbage();
+void initHeap();
 void freeObjects();
+// a collector option by name, as in --gc-min-heap=64M or MEON_GC_MIN_HEAP.
+// false if there's no such option or the value makes no sense for it.
+bool setGCOption(const char *name, const char *value);
+double gcClock();
+// bytes by object type, with what each object owns, for objects that may
+// still be in use.
+void liveBytes(size_t bytes[]);
+
+// every store of a reference into an object that may already be old goes
+// through a barrier. young values get the owner remembered for minor
+// collections, old ones are shaded while marking incrementally so that a
+// black object never points at a white one.
+static inline void writeBarrierObject(Object *owner, Object *value)
+{
+    if (value == NULL || IN_NURSERY(owner))
+        return;
+    if (IN_NURSERY(value))
+    {
+        if (!owner->isRemembered)
+            rememberObject(owner);
+    }
+    else if (vm->gcPhase == GC_MARKING && !vm->markerRunning && !heapIsMarked(value))
+    {
+        markObject(value);
+    }
+}
+
+// the concurrent marker traces the heap as it was when marking began, so
+// an old object it hasn't scanned yet gets scanned here before it changes.
+static inline void preWriteBarrier(Object *owner)
+{
+    if (vm->markerRunning && !IN_NURSERY(owner) &&
+        !heapTest(owner, PAGE_SCANNED))
+        scanBeforeWrite(owner);
+}
+
+static inline void writeBarrier(Object *owner, Value value)
+{
+    if (IS_OBJ(value))
+        writeBarrierObject(owner, AS_OBJ(value));
+}
+
+static inline void writeBarrierGlobal(ObjectString *name, Value value)
+{
+    if (IN_NURSERY(name) || (IS_OBJ(value) && IN_NURSERY(AS_OBJ(value))))
+        vm->globalsRemembered = true;
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,148 @@
+#ifndef meon_h
+#define meon_h
+
+// the embedding api, the only header a host needs. a MeonVM is an isolate
+// with a heap and globals of its own. different ones can run on different
+// threads at the same time, one is only ever used by one thread at a time.
+// errors are printed to stderr like the cli does.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define MEON_API __attribute__((visibility("default")))
+#else
+#define MEON_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct VM MeonVM;
+typedef struct MeonScript MeonScript;
+
+typedef enum
+{
+    MEON_OK,
+    MEON_COMPILE_ERROR,
+    MEON_RUNTIME_ERROR
+} MeonResult;
+
+typedef enum
+{
+    MEON_NULL,
+    MEON_BOOL,
+    MEON_NUMBER,
+    MEON_STRING,
+    // anything else, a map or an array say, only its type comes across.
+    MEON_OBJECT
+} MeonType;
+
+// strings that come out of the vm point into it. they stay put until the
+// next call into that vm, or until a native returns.
+typedef struct
+{
+    MeonType type;
+    union
+    {
+        bool boolean;
+        double number;
+        struct
+        {
+            const char *chars;
+            int length;
+        } string;
+    } as;
+} MeonValue;
+
+static inline MeonValue meonNull(void)
+{
+    MeonValue value;
+    value.type = MEON_NULL;
+    value.as.number = 0;
+    return value;
+}
+
+static inline MeonValue meonBool(bool boolean)
+{
+    MeonValue value;
+    value.type = MEON_BOOL;
+    value.as.boolean = boolean;
+    return value;
+}
+
+static inline MeonValue meonNumber(double number)
+{
+    MeonValue value;
+    value.type = MEON_NUMBER;
+    value.as.number = number;
+    return value;
+}
+
+// chars needn't outlive the call it's passed to, the vm copies them.
+static inline MeonValue meonString(const char *chars, int length)
+{
+    MeonValue value;
+    value.type = MEON_STRING;
+    value.as.string.chars = chars;
+    value.as.string.length = length;
+    return value;
+}
+
+// times are in seconds, sizes in bytes.
+typedef struct
+{
+    size_t cycles;
+    size_t minorCycles;
+    size_t compactions;
+    size_t pauses;
+    double totalPause;
+    double p50Pause;
+    double p99Pause;
+    double maxPause;
+    size_t heap;
+    size_t metadata;
+    size_t mapped;
+    size_t allocated;
+    size_t freed;
+    double allocationRate;
+} MeonStats;
+
+// NULL if a MEON_GC_ variable in the environment has a bad value, or if
+// there's no memory for it.
+MEON_API MeonVM *meonNewVM(void);
+MEON_API void meonFreeVM(MeonVM *vm);
+// a collector option by its command line name without --gc-, like
+// "max-heap" with "64M". false if it's not one or the value is bad.
+MEON_API bool meonSetOption(MeonVM *vm, const char *name, const char *value);
+// limits on every run and call from the host, 0 for none. fuel is roughly
+// a count of instructions. going past one is a runtime error.
+MEON_API void meonSetLimits(MeonVM *vm, int64_t fuel, double seconds);
+
+// NULL if it doesn't compile or there's no memory for it. running it runs its top level, which is
+// where its functions and globals get defined.
+MEON_API MeonScript *meonCompile(MeonVM *vm, const char *source, const char *name);
+MEON_API MeonResult meonRun(MeonScript *script);
+MEON_API void meonFreeScript(MeonScript *script);
+
+// calls the global function name. result may be NULL.
+MEON_API MeonResult meonCall(MeonVM *vm, const char *name, int argCount, const MeonValue *args,
+                             MeonValue *result);
+
+// a native fails by returning false, with a string in result to say why.
+typedef bool (*MeonNative)(MeonVM *vm, int argCount, const MeonValue *args, MeonValue *result,
+                           void *data);
+// arity -1 takes any number of arguments, data is handed back to each call.
+// false if there's no memory for it.
+MEON_API bool meonDefineNative(MeonVM *vm, const char *name, int arity, MeonNative function,
+                               void *data);
+
+MEON_API void meonStats(MeonVM *vm, MeonStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
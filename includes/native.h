@@ -7,6 +7,8 @@
 #include "object.h"
 #include "vm.h"
 
+// a global of that name, on top of whatever it was.
+ObjectNative *defineNative(VM *vm, const char *name, NativeFn function, int arity);
 void loadNativeFunction(VM *vm);
 
 #endif
\ No newline at end of file
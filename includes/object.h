@@ -3,6 +3,9 @@
 
 #include "common.h"
 #include "chunk.h"
+#include "meon.h"
+#include "ref.h"
+#include "table.h"
 #include "value.h"
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->t)
@@ -11,12 +14,30 @@
 #define IS_CLOSURE(value) check_object_t(value, OBJECT_CLOSURE)
 #define IS_FUNCTION(value) check_object_t(value, OBJECT_FUNCTION)
 #define IS_NATIVE(value) check_object_t(value, OBJECT_NATIVE)
+#define IS_SOURCE(value) check_object_t(value, OBJECT_SOURCE)
+#define IS_MAP(value) check_object_t(value, OBJECT_MAP)
+#define IS_ARRAY(value) check_object_t(value, OBJECT_ARRAY)
+#define IS_TYPED_ARRAY(value) check_object_t(value, OBJECT_TYPED_ARRAY)
+#define IS_RECORD(value) check_object_t(value, OBJECT_RECORD)
+#define IS_PVECTOR(value) check_object_t(value, OBJECT_PVECTOR)
+#define IS_PMAP(value) check_object_t(value, OBJECT_PMAP)
+#define IS_SEQ(value) check_object_t(value, OBJECT_SEQ)
+#define IS_SEQ_ITER(value) check_object_t(value, OBJECT_SEQ_ITER)
 
 #define AS_CLOSURE(value) ((ObjectClosure *)AS_OBJ(value))
 #define AS_FUNCTION(value) ((ObjectFunction *)AS_OBJ(value))
-#define AS_NATIVE(value) (((ObjectNative *)AS_OBJ(value))->function)
+#define AS_NATIVE(value) ((ObjectNative *)AS_OBJ(value))
 #define AS_STRING(value) ((ObjectString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjectString *)AS_OBJ(value))->chars)
+#define AS_SOURCE(value) ((ObjectSource *)AS_OBJ(value))
+#define AS_MAP(value) ((ObjectMap *)AS_OBJ(value))
+#define AS_ARRAY(value) ((ObjectArray *)AS_OBJ(value))
+#define AS_TYPED_ARRAY(value) ((ObjectTypedArray *)AS_OBJ(value))
+#define AS_RECORD(value) ((ObjectRecord *)AS_OBJ(value))
+#define AS_PVECTOR(value) ((ObjectPVector *)AS_OBJ(value))
+#define AS_PMAP(value) ((ObjectPMap *)AS_OBJ(value))
+#define AS_SEQ(value) ((ObjectSeq *)AS_OBJ(value))
+#define AS_SEQ_ITER(value) ((ObjectSeqIter *)AS_OBJ(value))
 
 typedef enum
 {
@@ -25,13 +46,29 @@ typedef enum
     OBJECT_NATIVE,
     OBJECT_CLOSURE,
     OBJECT_UPVALUE,
+    OBJECT_SOURCE,
+    OBJECT_MAP,
+    OBJECT_ARRAY,
+    OBJECT_TYPED_ARRAY,
+    OBJECT_SHAPE,
+    OBJECT_RECORD,
+    OBJECT_VECTOR_NODE,
+    OBJECT_PVECTOR,
+    OBJECT_HAMT_NODE,
+    OBJECT_PMAP,
+    OBJECT_SEQ,
+    OBJECT_SEQ_ITER,
 } object_t;
 
+// the header is half a word, the first field of an object can share its
+// word. the collector keeps what it needs elsewhere: old objects are found
+// through their page, their mark bits are in it, and a moved object keeps
+// its new address past the header of the copy left behind.
 struct Object
 {
-    object_t t;
-    struct Object *next;
-    bool isMarked;
+    object_t t : 8;
+    bool isMarked; // young or moved objects, old ones are marked in their page
+    bool isRemembered;
 };
 
 typedef struct
@@ -39,24 +76,43 @@ typedef struct
     Object object;
     int argsCount;
     int upvalueCount;
+    OBJ_REF(ObjectString) name;
     Chunk chunk;
-    ObjectString *name;
 } ObjectFunction;
 
-typedef Value (*NativeFn)(int argCount, Value *args);
+// natives write their return value into result. returning false means
+// they already reported a runtime error.
+typedef bool (*NativeFn)(int argCount, Value *args, Value *result);
 
 typedef struct
 {
     Object object;
     NativeFn function;
+    int arity; // -1 for variadic
+    // set when the host defined it, see meonDefineNative().
+    MeonNative host;
+    void *data;
 } ObjectNative;
 
+// long-lived source text ( usually a read-only file mapping ) that
+// borrowed strings point into. it's freed only when no string uses it.
+typedef struct
+{
+    Object object;
+    const char *bytes;
+    size_t length;
+    bool isMapped;
+} ObjectSource;
+
+// chars is NOT always null-terminated: borrowed strings slice into an
+// ObjectSource, so always use length when printing or copying.
 struct ObjectString
 {
     Object object;
     int length;
-    char *chars;
     uint32_t hash;
+    const char *chars;
+    ObjectSource *owner;
 };
 
 typedef struct ObjectUpvalue
@@ -70,23 +126,196 @@ typedef struct ObjectUpvalue
 typedef struct
 {
     Object obj;
-    ObjectFunction *function;
-    ObjectUpvalue **upvalues;
     int upvalueCount;
+    OBJ_REF(ObjectFunction) function;
+    OBJ_REF(ObjectUpvalue) *upvalues;
 } ObjectClosure;
 
+// one insertion-ordered entry, key is NULL_VAL once it's deleted.
+typedef struct
+{
+    Value key;
+    Value value;
+    uint32_t hash;
+} MapEntry;
+
+// open-addressing index into entries. slots are 8 bytes so a probe
+// sequence touches few cache lines before looking at any entry.
+typedef struct
+{
+    uint32_t hash;
+    int32_t entry;
+} MapSlot;
+
+typedef struct
+{
+    Object obj;
+    int count;
+    int entryCount;
+    int entryCapacity;
+    MapEntry *entries;
+    int slotCapacity;
+    MapSlot *slots;
+} ObjectMap;
+
+// items grow through writeValueArr, so reallocate sees every resize.
+typedef struct
+{
+    Object obj;
+    ValueArr items;
+} ObjectArray;
+
+typedef enum
+{
+    TYPED_FLOAT64,
+    TYPED_INT64,
+} typed_t;
+
+// fixed-length raw numbers, no tags, so the simd kernels can stream it.
+typedef struct
+{
+    Object obj;
+    typed_t kind;
+    int length;
+    union
+    {
+        double *f64;
+        int64_t *i64;
+    } as;
+} ObjectTypedArray;
+
+// hidden class. a shape is its parent plus one field, which lives in
+// slot slotCount - 1. records that gain the same fields in the same
+// order share shapes through the transitions table.
+typedef struct ObjectShape
+{
+    Object obj;
+    struct ObjectShape *parent;
+    ObjectString *name;
+    int slotCount;
+    Table transitions;
+} ObjectShape;
+
+typedef struct
+{
+    Object obj;
+    int capacity;
+    OBJ_REF(ObjectShape) shape;
+    Value *fields;
+} ObjectRecord;
+
+// persistent collections never change after they're built, updates copy
+// the path to the changed leaf and share everything else.
+#define PERSISTENT_BITS 5
+#define PERSISTENT_WIDTH (1 << PERSISTENT_BITS)
+#define PERSISTENT_MASK (PERSISTENT_WIDTH - 1)
+
+// a 32-way trie node. branches hold OBJ_VALs of their children.
+typedef struct
+{
+    Object obj;
+    Value slots[PERSISTENT_WIDTH];
+} ObjectVectorNode;
+
+// the last, partly filled leaf is kept out of the trie as tail, so conj
+// only copies the trie once every 32 elements.
+typedef struct
+{
+    Object obj;
+    int count;
+    int shift;
+    ObjectVectorNode *root;
+    ObjectVectorNode *tail;
+} ObjectPVector;
+
+// hash array mapped trie node, entries are key/value pairs. a pair with a
+// null key points to a child node instead. collision nodes hold keys that
+// share all 32 hash bits and are searched linearly.
+typedef struct
+{
+    Object obj;
+    bool isCollision;
+    uint32_t bitmap;
+    uint32_t hash;
+    int size;
+    Value entries[];
+} ObjectHamtNode;
+
+typedef struct
+{
+    Object obj;
+    int count;
+    ObjectHamtNode *root;
+} ObjectPMap;
+
+typedef enum
+{
+    SEQ_RANGE,
+    SEQ_SOURCE,
+    SEQ_MAP,
+    SEQ_FILTER,
+    SEQ_TAKE,
+} seq_t;
+
+// a lazy pipeline is a chain of stages back to its source. nothing runs
+// until an iterator pulls values through all of the stages at once.
+typedef struct ObjectSeq
+{
+    Object obj;
+    seq_t kind;
+    struct ObjectSeq *parent;
+    Value value;  // source collection or stage function
+    double start; // range only
+    double end;   // range end, or the take limit
+    double step;  // range only
+    int depth;    // stages between this one and the source
+} ObjectSeq;
+
+typedef struct
+{
+    Object obj;
+    ObjectSeq *seq;
+    double cursor;
+    bool done;
+    int stageCount;
+    ObjectSeq **stages; // source first
+    int *taken;
+} ObjectSeqIter;
+
 ObjectFunction *newFunction();
-ObjectNative *newNative(NativeFn function);
+ObjectNative *newNative(NativeFn function, int arity);
+ObjectMap *newMap();
+ObjectArray *newArray();
+ObjectTypedArray *newTypedArray(typed_t kind, int length);
+ObjectShape *newShape(ObjectShape *parent, ObjectString *name);
+ObjectRecord *newRecord();
+ObjectVectorNode *newVectorNode(ObjectVectorNode *from);
+ObjectPVector *newPVector(int count, int shift, ObjectVectorNode *root, ObjectVectorNode *tail);
+ObjectHamtNode *newHamtNode(int size);
+ObjectPMap *newPMap(int count, ObjectHamtNode *root);
+ObjectSeq *newSeq(seq_t kind, ObjectSeq *parent, Value value);
+ObjectSeqIter *newSeqIter(ObjectSeq *seq);
 ObjectClosure *newClosure(ObjectFunction *function);
 ObjectUpvalue *newUpvalue(Value *slot);
 ObjectString *takeString(char *chars, int length);
 ObjectString *cpString(const char *chars, int length);
+ObjectString *borrowString(ObjectSource *owner, const char *chars, int length);
+ObjectSource *newSource(const char *bytes, size_t length, bool isMapped);
 
 static inline bool check_object_t(Value value, object_t t)
 {
     return IS_OBJ(value) && AS_OBJ(value)->t == t;
 }
 
+// only integral doubles inside the int64 range convert.
+static inline bool numberToInt64(double number, int64_t *result)
+{
+    if (!(number >= -9223372036854775808.0 && number < 9223372036854775808.0))
+        return false;
+    *result = (int64_t)number;
+    return (double)*result == number;
+}
+
 void printObject(Value value);
 char *object2string(Value value);
 
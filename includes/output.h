@@ -0,0 +1,24 @@
+#ifndef meon_output_h
+#define meon_output_h
+
+#include "common.h"
+#include "value.h"
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t capacity;
+    bool lineBuffered;
+} OutputBuffer;
+
+void initOutput(OutputBuffer *output);
+void freeOutput(OutputBuffer *output);
+void flushOutput(OutputBuffer *output);
+void writeOutput(OutputBuffer *output, const char *chars, size_t length);
+void writeOutputValue(OutputBuffer *output, Value value);
+void writeOutputLine(OutputBuffer *output, Value value);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef meon_persistent_h
+#define meon_persistent_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// updates return a new collection and leave the old one as it was. the
+// arguments must be reachable, building the new path may collect.
+Value pvectorGet(ObjectPVector *vector, int index);
+ObjectPVector *pvectorConj(ObjectPVector *vector, Value value);
+ObjectPVector *pvectorAssoc(ObjectPVector *vector, int index, Value value);
+bool pmapGet(ObjectPMap *map, Value key, Value *value);
+ObjectPMap *pmapAssoc(ObjectPMap *map, Value key, Value value);
+ObjectPMap *pmapDissoc(ObjectPMap *map, Value key);
+void pmapKeys(ObjectPMap *map, ObjectArray *keys);
+void printPVector(ObjectPVector *vector);
+void printPMap(ObjectPMap *map);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,13 @@
+#ifndef meon_record_h
+#define meon_record_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+int shapeSlot(ObjectShape *shape, ObjectString *name);
+ObjectShape *shapeTransition(ObjectShape *shape, ObjectString *name);
+void recordAddField(ObjectRecord *record, ObjectShape *shape, Value value);
+void printRecord(ObjectRecord *record);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef meon_ref_h
+#define meon_ref_h
+
+#include "common.h"
+
+// with COMPRESSED_REFS every object lives inside one reserved range, the
+// cage, and the hottest references between objects are kept as 32 bit
+// offsets into it. offset 0 is never handed out, it stands for NULL.
+// otherwise they're plain pointers and these are no-ops.
+#ifdef COMPRESSED_REFS
+#define HEAP_CAGE_SIZE ((size_t)4 << 30)
+
+extern uint8_t *heapCage;
+
+#define OBJ_REF(type) uint32_t
+#define REF(object) compressRef(object)
+#define DEREF(type, ref) ((type *)expandRef(ref))
+
+static inline uint32_t compressRef(const void *object)
+{
+    return object == NULL ? 0 : (uint32_t)((const uint8_t *)object - heapCage);
+}
+
+static inline void *expandRef(uint32_t ref)
+{
+    return ref == 0 ? NULL : heapCage + ref;
+}
+#else
+#define OBJ_REF(type) type *
+#define REF(object) (object)
+#define DEREF(type, ref) (ref)
+#endif
+
+#endif
\ No newline at end of file
@@ -11,6 +11,10 @@ typedef enum
   TOKEN_CARET,
   TOKEN_LPAREN,
   TOKEN_RPAREN,
+  TOKEN_LBRACE,
+  TOKEN_RBRACE,
+  TOKEN_LBRACKET,
+  TOKEN_RBRACKET,
   
   TOKEN_NOT,
   TOKEN_NOT_EQUAL,
@@ -22,7 +26,9 @@ typedef enum
   TOKEN_LESS_EQUAL,
 
   TOKEN_DOT,
+  TOKEN_ARROW,
   TOKEN_COMMA,
+  TOKEN_COLON,
   TOKEN_SEMICOLON,
 
   TOKEN_NUMBER_LITERAL,
@@ -51,11 +57,13 @@ typedef enum
   TOKEN_ENDWHILE,
   TOKEN_FOR,
   TOKEN_ENDFOR,
+  TOKEN_IN,
   TOKEN_CONTINUE,
   TOKEN_BREAK,
   TOKEN_RETURN,
   TOKEN_FUNC,
   TOKEN_ENDFUNC,
+  TOKEN_RECORD,
 
   TOKEN_EOF,
   TOKEN_ERR,
@@ -0,0 +1,14 @@
+#ifndef meon_seq_h
+#define meon_seq_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// pulls the next value through every stage of the pipeline. returns false
+// on a runtime error, hasNext is false once the pipeline is exhausted. the
+// iterator is in a slot on the vm stack, the stages may move it.
+bool seqNext(Value *iterator, Value *value, bool *hasNext);
+bool isSeqSource(Value value);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef meon_simd_h
+#define meon_simd_h
+
+#include "common.h"
+
+// numeric kernels over raw buffers, picked once by initSimd() from what
+// the cpu supports. vector reductions add in lanes, so float sums can
+// differ from a left-to-right loop in the last bits.
+typedef struct
+{
+    const char *level;
+
+    double (*sumF64)(const double *data, int length);
+    double (*minF64)(const double *data, int length);
+    double (*maxF64)(const double *data, int length);
+    double (*dotF64)(const double *a, const double *b, int length);
+    void (*scaleF64)(double *data, int length, double factor);
+    void (*addF64)(double *dst, const double *src, int length);
+    void (*prefixSumF64)(double *data, int length);
+
+    int64_t (*sumI64)(const int64_t *data, int length);
+    int64_t (*minI64)(const int64_t *data, int length);
+    int64_t (*maxI64)(const int64_t *data, int length);
+    int64_t (*dotI64)(const int64_t *a, const int64_t *b, int length);
+    void (*scaleI64)(int64_t *data, int length, int64_t factor);
+    void (*addI64)(int64_t *dst, const int64_t *src, int length);
+    void (*prefixSumI64)(int64_t *data, int length);
+} SimdKernels;
+
+extern SimdKernels simd;
+
+void initSimd();
+
+#endif
\ No newline at end of file
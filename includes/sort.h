@@ -0,0 +1,23 @@
+#ifndef meon_sort_h
+#define meon_sort_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// arrays below this length are never split across threads.
+#define SORT_PARALLEL_MIN (1 << 17)
+#define SORT_THREADS_MAX 8
+
+// all sorts are in place. comparators and key functions run meon code, if
+// one of them fails the array is left as it was and false is returned.
+// without a comparator arrays must hold only numbers or only strings.
+bool sortArray(ObjectArray *array, Value comparator);
+bool sortArrayBy(ObjectArray *array, Value key);
+void sortTypedArray(ObjectTypedArray *array);
+
+// index of target, or -(insertion point) - 1 when it is not there.
+bool searchArray(ObjectArray *array, Value target, Value comparator, int *index);
+int searchTypedArray(ObjectTypedArray *array, double target);
+
+#endif
\ No newline at end of file
@@ -2,18 +2,32 @@
 #define meon_table_h
 
 #include "common.h"
+#include "ref.h"
 #include "value.h"
 
+// control bytes live apart from the items so a probe scans 16 of them
+// at once. a full slot stores the low 7 bits of its key's hash.
+#define TABLE_GROUP_SIZE 16
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+
+// the value is kept apart so its tag can share a word with the key, an
+// item is 16 bytes when keys are compressed.
 typedef struct
 {
-    ObjectString *k;
-    Value v;
+    OBJ_REF(ObjectString) k;
+    value_t t;
+    ValueAs as;
 } TableItem;
 
 typedef struct
 {
     int size;
+    int tombstones;
     int maxSize;
+    // where an unfinished tableRemoveWhite() resumes, any rehash resets it.
+    int whiteCursor;
+    uint8_t *ctrl;
     TableItem *items;
 } Table;
 
@@ -22,9 +36,10 @@ void freeTable(Table *table);
 bool tableGet(Table* table, ObjectString* k, Value* v);
 bool tableSet(Table *table, ObjectString *k, Value v);
 void tableAddAll(Table* from, Table* to);
-void tableRemoveWhite(Table* table);
+bool tableRemoveWhite(Table *table, int slots);
 void markTable(Table* table);
-TableItem *findTableItem(TableItem *entries, int maxSize, ObjectString *k);
+void tableVisit(Table *table, ObjectVisitor visit);
+void tableReplaceKey(Table *table, ObjectString *from, ObjectString *to);
 ObjectString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
 bool tableDelete(Table* table, ObjectString* k);
 
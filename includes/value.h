@@ -8,6 +8,9 @@
 typedef struct Object Object;
 typedef struct ObjectString ObjectString;
 
+// called on every reference a collector walks, returns where it lives now.
+typedef Object *(*ObjectVisitor)(Object *object);
+
 typedef enum
 {
     VALUE_BOOLEAN,
@@ -16,15 +19,17 @@ typedef enum
     VALUE_NULL,
 } value_t;
 
+typedef union
+{
+    bool boolean;
+    double number;
+    Object *object;
+} ValueAs;
+
 typedef struct
 {
     value_t t;
-    union
-    {
-        bool boolean;
-        double number;
-        Object *object;
-    } as;
+    ValueAs as;
 } Value;
 
 #define IS_BOOL(value) ((value).t == VALUE_BOOLEAN)
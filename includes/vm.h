@@ -1,7 +1,13 @@
 #ifndef meon_vm_h
 #define meon_vm_h
 
+#include <pthread.h>
+#include <setjmp.h>
+
+#include "gcstats.h"
+#include "heap.h"
 #include "object.h"
+#include "output.h"
 #include "table.h"
 #include "value.h"
 
@@ -15,7 +21,26 @@ typedef struct
     Value *slots;
 } CallFrame;
 
+// a callee checked once and then called many times from C. a movable
+// call comes from C that keeps nothing but the call itself across it, so
+// a minor collection can run inside.
 typedef struct
+{
+    Value callee;
+    int argCount;
+    bool movable;
+} PreparedCall;
+
+typedef enum
+{
+    GC_IDLE,
+    GC_MARKING,
+    GC_REMARK,
+    GC_CLEARING,
+    GC_SWEEPING
+} gc_phase_t;
+
+typedef struct VM
 {
     CallFrame frames[FRAMES_MAX];
     int frameCount;
@@ -23,30 +48,158 @@ typedef struct
     Value *stackTop;
     Table globals;
     Table strings;
+    // values the host holds on to, they're roots until it lets go. a
+    // null slot is free.
+    ValueArr handles;
     ObjectUpvalue *openUpvalues;
+    ObjectShape *rootShape;
+    OutputBuffer output;
+    int debugLevel;
+    // an error that can't be returned, like running out of memory, jumps
+    // back to where the script was started.
+    jmp_buf *errorJump;
+    // fuel runs down at loop back-edges, by the length of the loop, and at
+    // calls. each time it runs out the limits are checked and another
+    // slice is handed out. with no limits there's enough for ever.
+    int64_t fuel;
+    int64_t fuelSlice;
+    int64_t fuelUsed;
+    int64_t fuelLimit;
+    double timeLimit;
+    double deadline;
+    bool suspendOnLimit;
+    bool suspended;
 
     size_t bytesAllocated;
     size_t nextGC;
 
-    Object *objects;
+    // young objects are bump allocated in the nursery, old ones live in
+    // the heap's pages. old objects pointing into the nursery are kept in
+    // the remembered set, globals are one flag since they're a root.
+    // promoted holds copies a minor collection hasn't scanned yet.
+    uint8_t *nurseryStart;
+    uint8_t *nurseryTop;
+    uint8_t *nurseryEnd;
+    bool youngRequested;
+    // natives under the running code that hold pointers in C across a
+    // call back into it. minor collections wait until there are none.
+    int pinned;
+    bool globalsRemembered;
+    int rememberedCount;
+    int rememberedCapacity;
+    Object **remembered;
+    int promotedCount;
+    int promotedCapacity;
+    Object **promoted;
+    // set when one of these couldn't grow, the collector then finds what's
+    // missing some slower way.
+    bool rememberedOverflow;
+    bool promotedOverflow;
+    // bytes that went through the nursery since the last major cycle.
+    size_t youngAllocated;
+    // the heap right after the last minor collection. most of what it
+    // grew by since belongs to young objects and only a minor frees it.
+    size_t youngBase;
+
+    // a major collection either runs to completion or, with a pause
+    // budget ( in microseconds ), in slices spread over allocations.
+    gc_phase_t gcPhase;
+    long gcPauseBudget;
+    size_t gcHardLimit;
+    // the heap may grow to gcGrowth times what survived the last cycle,
+    // no less than gcMinHeap and, if it's set, no more than gcMaxHeap.
+    // that one is a hard limit, an allocation that would cross it even
+    // after a full collection is a runtime error.
+    double gcGrowth;
+    size_t gcMinHeap;
+    size_t gcMaxHeap;
+    // the first MEON_GC_ variable whose value was bad, empty if none was.
+    char gcBadEnv[32];
+    size_t gcCycles;
+    size_t gcMinorCycles;
+    size_t gcPauses;
+    double gcMaxPause;
+    double gcPauseTotal;
+    uint32_t gcPauseCounts[GC_PAUSE_BUCKETS];
+    // every byte counted in since the start, what was freed is this less
+    // bytesAllocated.
+    size_t gcAllocatedTotal;
+    // the collector's own arrays, they're not part of bytesAllocated but
+    // gcMaxHeap covers them too.
+    size_t gcMetadata;
+    double gcStartTime;
+    // with compaction on, a cycle that leaves the heap fragmented has
+    // sparse pages emptied at the next safepoint.
+    bool gcCompact;
+    bool compactRequested;
+    size_t gcCompactions;
+
+    // a concurrent marker owns the gray stack while it runs. the mutator
+    // collects snapshot objects in satb and hands them over in batches
+    // through satbQueue, both sides take gcMutex for that.
+    bool gcConcurrent;
+    bool markerRunning;
+    bool markerStop;
+    bool markerIdle;
+    pthread_t marker;
+    pthread_mutex_t gcMutex;
+    pthread_cond_t gcCond;
+    int satbCount;
+    int satbCapacity;
+    Object **satb;
+    int satbQueueCount;
+    int satbQueueCapacity;
+    Object **satbQueue;
+
+    Heap heap;
     int grayCount;
     int grayCapacity;
     Object **grayStack;
+    bool grayOverflow;
 } VM;
 
 typedef enum
 {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_SUSPENDED
 } InterpretResult;
 
-extern VM vm;
+// the isolate this thread runs, everything below that doesn't take one
+// works on it. each isolate has a heap, strings, globals and a collector
+// of its own, so threads can run one each side by side, but an isolate
+// only runs on one thread at a time.
+extern __thread VM *vm;
 
-void initVM();
-void freeVM();
-InterpretResult interpret(const char *source, const char *filename, int debugLevel);
+// the thread keeps running the isolate it did before.
+VM *newVM();
+void freeVM(VM *isolate);
+// makes isolate the one this thread runs, returns the one it ran before.
+VM *enterVM(VM *isolate);
+InterpretResult interpret(VM *isolate, const char *source, const char *filename, int debugLevel);
+InterpretResult interpretSource(VM *isolate, ObjectSource *source, const char *filename, int debugLevel);
+// limits on each run of a script, 0 for none. fuel is roughly a count of
+// instructions, seconds is wall clock time. past either one the script
+// fails, or with suspend it stops at the loop or call it's at and
+// resumeInterpret() runs it on with as much again. starting another
+// script drops a suspended one.
+void setRunLimits(VM *isolate, int64_t fuel, double seconds, bool suspend);
+InterpretResult resumeInterpret(VM *isolate);
+int newHandle(Value value);
+void freeHandle(int handle);
+// runs body on isolate with errors that jump, like running out of memory,
+// caught. they leave nothing running.
+InterpretResult protectedCall(VM *isolate, InterpretResult (*body)(void *), void *data);
+// calls what's under argCount arguments on top of the stack the way a
+// script would, the result takes their place. a call from the top has the
+// run limits to itself.
+InterpretResult callOnStack(int argCount);
 void push(Value value);
 Value pop();
+void runtimeError(const char *format, ...);
+bool isFalse(Value value);
+bool prepareCall(PreparedCall *call, Value callee, int argCount);
+bool callPrepared(PreparedCall *call, Value *args, Value *result);
 
 #endif
\ No newline at end of file
@@ -10,6 +10,9 @@ void initChunk(Chunk *chunk)
     chunk->lineSize = 0;
     chunk->lineMaxSize = 0;
     chunk->lines = NULL;
+    chunk->cacheSize = 0;
+    chunk->cacheMaxSize = 0;
+    chunk->caches = NULL;
     initValueArr(&chunk->constants);
 }
 
@@ -17,9 +20,9 @@ void writeChunk(Chunk *chunk, uint8_t b, int line)
 {
     if (chunk->maxSize < chunk->size + 1)
     {
-        int old = chunk->size;
-        chunk->maxSize = GROW_ARRAY_SIZE(old);
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code, old, chunk->maxSize);
+        int maxSize = GROW_ARRAY_SIZE(chunk->maxSize);
+        chunk->code = GROW_ARRAY(uint8_t, chunk->code, chunk->maxSize, maxSize);
+        chunk->maxSize = maxSize;
     }
     chunk->code[chunk->size] = b;
     chunk->size++;
@@ -32,9 +35,9 @@ void writeChunk(Chunk *chunk, uint8_t b, int line)
 
     if (chunk->lineMaxSize < chunk->lineSize + 1)
     {
-        int oldCapacity = chunk->lineMaxSize;
-        chunk->lineMaxSize = GROW_ARRAY_SIZE(oldCapacity);
-        chunk->lines = GROW_ARRAY(LineStart, chunk->lines, oldCapacity, chunk->lineMaxSize);
+        int capacity = GROW_ARRAY_SIZE(chunk->lineMaxSize);
+        chunk->lines = GROW_ARRAY(LineStart, chunk->lines, chunk->lineMaxSize, capacity);
+        chunk->lineMaxSize = capacity;
     }
 
     LineStart *lineStart = &chunk->lines[chunk->lineSize++];
@@ -46,6 +49,7 @@ void freeChunk(Chunk *chunk)
 {
     FREE_ARRAY(uint8_t, chunk->code, chunk->maxSize);
     FREE_ARRAY(LineStart, chunk->lines, chunk->lineMaxSize);
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheMaxSize);
     freeValueArr(&chunk->constants);
     initChunk(chunk);
 }
@@ -58,6 +62,22 @@ int addConstant(Chunk *chunk, Value value)
     return chunk->constants.size - 1;
 }
 
+int addInlineCache(Chunk *chunk)
+{
+    if (chunk->cacheMaxSize < chunk->cacheSize + 1)
+    {
+        int capacity = GROW_ARRAY_SIZE(chunk->cacheMaxSize);
+        chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, chunk->cacheMaxSize, capacity);
+        chunk->cacheMaxSize = capacity;
+    }
+
+    InlineCache *cache = &chunk->caches[chunk->cacheSize];
+    cache->shape = NULL;
+    cache->transition = NULL;
+    cache->slot = 0;
+    return chunk->cacheSize++;
+}
+
 int getLine(Chunk *chunk, int instruction)
 {
     int start = 0;
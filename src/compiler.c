@@ -15,6 +15,7 @@
 typedef struct
 {
     const char *source;
+    ObjectSource *owner;
     const char *filename;
     Token current;
     Token previous;
@@ -77,8 +78,10 @@ typedef struct Compiler
     int scopeDepth;
 } Compiler;
 
-Parser parser;
-Compiler *current = NULL;
+// a compile runs start to end on the thread that asked for it, so each
+// thread has its own.
+static __thread Parser parser;
+static __thread Compiler *current = NULL;
 
 static Chunk *currentChunk()
 {
@@ -225,6 +228,13 @@ static void emitConstant(Value value)
     emit_bs(OP_CONSTANT, makeConstant(value));
 }
 
+static ObjectString *sourceString(const char *start, int length)
+{
+    if (parser.owner != NULL)
+        return borrowString(parser.owner, start, length);
+    return cpString(start, length);
+}
+
 static void initCompiler(Compiler *compiler, function_t t)
 {
     compiler->enclosing = current;
@@ -237,7 +247,7 @@ static void initCompiler(Compiler *compiler, function_t t)
 
     if (t != TYPE_SCRIPT)
     {
-        current->function->name = cpString(parser.previous.start, parser.previous.length);
+        current->function->name = REF(sourceString(parser.previous.start, parser.previous.length));
     }
 
     Local *local = &current->locals[current->localCount++];
@@ -254,9 +264,11 @@ static ObjectFunction *endCompiler(int debugLevel)
     //#ifdef DEBUG_PRINT_CODE
     if (!parser.hadError && debugLevel > 0)
     {
-        disassembleChunk(currentChunk(), function->name != NULL
-                                             ? function->name->chars
-                                             : "[ script ]");
+        ObjectString *name = DEREF(ObjectString, function->name);
+        if (name != NULL)
+            disassembleChunk(currentChunk(), name->chars, name->length);
+        else
+            disassembleChunk(currentChunk(), "[ script ]", 10);
     }
     //#endif
     current = current->enclosing;
@@ -293,7 +305,7 @@ static void parsePrecedence(Precedence precedence);
 
 static uint8_t identifierConstant(Token *name)
 {
-    return makeConstant(OBJ_VAL(cpString(name->start, name->length)));
+    return makeConstant(OBJ_VAL(sourceString(name->start, name->length)));
 }
 
 static bool identifiersEqual(Token *a, Token *b)
@@ -603,11 +615,8 @@ static void funcDeclaration()
     defineVariable(global);
 }
 
-static void varDeclaration()
+static void varInitializer(uint8_t global)
 {
-    //token_t variable_t = parse_variable_t("Expect variable data type.");
-    uint8_t global = parseVariable("Expect variable name.");
-
     if (match(TOKEN_ASSIGN))
     {
         expression();
@@ -621,6 +630,13 @@ static void varDeclaration()
     defineVariable(global);
 }
 
+static void varDeclaration()
+{
+    //token_t variable_t = parse_variable_t("Expect variable data type.");
+    uint8_t global = parseVariable("Expect variable name.");
+    varInitializer(global);
+}
+
 static void expressionStatement()
 {
     expression();
@@ -628,9 +644,76 @@ static void expressionStatement()
     emit_b(OP_POP);
 }
 
-int innermostLoopStart = -1;
-int breakJump = -1;
-int innermostLoopScopeDepth = 0;
+static __thread int innermostLoopStart = -1;
+static __thread int breakJump = -1;
+static __thread int innermostLoopScopeDepth = 0;
+
+static Token syntheticToken(const char *text)
+{
+    Token token = parser.previous;
+    token.start = text;
+    token.length = (int)strlen(text);
+    return token;
+}
+
+// for (let k in collection). the collection and a cursor sit in hidden
+// locals below k, their names can't clash with a real identifier.
+static void forInStatement(Token name)
+{
+    expression();
+    expect(TOKEN_RPAREN, "Expect ')' after for-in collection.");
+    addLocal(syntheticToken("(for collection)"));
+    markInitialized();
+
+    emitConstant(NUMBER_VAL(0));
+    addLocal(syntheticToken("(for cursor)"));
+    markInitialized();
+
+    emit_b(OP_NULL);
+    addLocal(name);
+    markInitialized();
+
+    int surroundingLoopStart = innermostLoopStart;
+    int surroundingLoopScopeDepth = innermostLoopScopeDepth;
+    int surroundingBreakJump = breakJump;
+
+    innermostLoopStart = currentChunk()->size;
+    innermostLoopScopeDepth = current->scopeDepth;
+
+    emit_bs(OP_ITER_NEXT, (uint8_t)(current->localCount - 3));
+    emit_b(0xff);
+    emit_b(0xff);
+    int exitJump = currentChunk()->size - 2;
+
+    // the body gets its own scope so its locals are popped every pass.
+    beginScope();
+    if (match(TOKEN_THEN))
+    {
+        statement();
+    }
+    else
+    {
+        while (!check(TOKEN_ENDFOR) && !check(TOKEN_EOF))
+        {
+            declaration();
+        }
+        expect(TOKEN_ENDFOR, "Expect 'endfor' after 'for' statement.");
+    }
+    endScope();
+
+    emitLoop(innermostLoopStart);
+    patchJump(exitJump);
+    if (breakJump != -1)
+    {
+        patchJump(breakJump);
+    }
+
+    innermostLoopStart = surroundingLoopStart;
+    innermostLoopScopeDepth = surroundingLoopScopeDepth;
+    breakJump = surroundingBreakJump;
+
+    endScope();
+}
 
 static void forStatement()
 {
@@ -639,7 +722,15 @@ static void forStatement()
     expect(TOKEN_LPAREN, "Expect '(' after 'for'.");
     if (match(TOKEN_LET))
     {
-        varDeclaration();
+        expect(TOKEN_IDENTIFIER, "Expect variable name.");
+        Token name = parser.previous;
+        if (match(TOKEN_IN))
+        {
+            forInStatement(name);
+            return;
+        }
+        declareVariable();
+        varInitializer(0);
     }
     else if (match(TOKEN_SEMICOLON))
     {
@@ -979,6 +1070,95 @@ static void statement()
     }
 }
 
+static void mapLiteral(bool canAssign)
+{
+    emit_b(OP_MAP);
+    while (!check(TOKEN_RBRACE) && !check(TOKEN_EOF))
+    {
+        expression();
+        expect(TOKEN_COLON, "Expect ':' after map key.");
+        expression();
+        emit_b(OP_MAP_INSERT);
+        if (!match(TOKEN_COMMA))
+            break;
+    }
+    expect(TOKEN_RBRACE, "Expect '}' after map entries.");
+}
+
+static void arrayLiteral(bool canAssign)
+{
+    emit_b(OP_ARRAY);
+    while (!check(TOKEN_RBRACKET) && !check(TOKEN_EOF))
+    {
+        expression();
+        emit_b(OP_ARRAY_PUSH);
+        if (!match(TOKEN_COMMA))
+            break;
+    }
+    expect(TOKEN_RBRACKET, "Expect ']' after array elements.");
+}
+
+static void emitField(uint8_t instruction, uint8_t name)
+{
+    int cache = addInlineCache(currentChunk());
+    if (cache > UINT16_MAX)
+        error("Too many field accesses in one function.");
+
+    emit_bs(instruction, name);
+    emit_bs((cache >> 8) & 0xff, cache & 0xff);
+}
+
+// record { x: 1, y: 2 }, fields are added in source order so literals
+// written the same way share a shape.
+static void recordLiteral(bool canAssign)
+{
+    emit_b(OP_RECORD);
+    expect(TOKEN_LBRACE, "Expect '{' after 'record'.");
+    while (!check(TOKEN_RBRACE) && !check(TOKEN_EOF))
+    {
+        expect(TOKEN_IDENTIFIER, "Expect field name.");
+        uint8_t name = identifierConstant(&parser.previous);
+        expect(TOKEN_COLON, "Expect ':' after field name.");
+        expression();
+        emitField(OP_RECORD_FIELD, name);
+        if (!match(TOKEN_COMMA))
+            break;
+    }
+    expect(TOKEN_RBRACE, "Expect '}' after record fields.");
+}
+
+static void field(bool canAssign)
+{
+    expect(TOKEN_IDENTIFIER, "Expect field name after '->'.");
+    uint8_t name = identifierConstant(&parser.previous);
+
+    if (canAssign && match(TOKEN_ASSIGN))
+    {
+        expression();
+        emitField(OP_SET_FIELD, name);
+    }
+    else
+    {
+        emitField(OP_GET_FIELD, name);
+    }
+}
+
+static void subscript(bool canAssign)
+{
+    expression();
+    expect(TOKEN_RBRACKET, "Expect ']' after index.");
+
+    if (canAssign && match(TOKEN_ASSIGN))
+    {
+        expression();
+        emit_b(OP_INDEX_SET);
+    }
+    else
+    {
+        emit_b(OP_INDEX_GET);
+    }
+}
+
 static void grouping(bool canAssign)
 {
     expression();
@@ -1005,7 +1185,42 @@ static void logicOr(bool canAssign)
 
 static void string(bool canAssign)
 {
-    emitConstant(OBJ_VAL(cpString(parser.previous.start + 1, parser.previous.length - 2)));
+    const char *start = parser.previous.start + 1;
+    int length = parser.previous.length - 2;
+
+    if (memchr(start, '\\', length) == NULL)
+    {
+        emitConstant(OBJ_VAL(sourceString(start, length)));
+        return;
+    }
+
+    // only \n and \t are escapes, anything else keeps its backslash.
+    char *chars = ALLOCATE(char, length + 1);
+    int size = 0;
+    for (int i = 0; i < length; i++)
+    {
+        if (start[i] == '\\' && i + 1 < length)
+        {
+            char c = start[++i];
+            if (c == 'n')
+            {
+                chars[size++] = '\n';
+                continue;
+            }
+            if (c == 't')
+            {
+                chars[size++] = '\t';
+                continue;
+            }
+            chars[size++] = '\\';
+            chars[size++] = c;
+            continue;
+        }
+        chars[size++] = start[i];
+    }
+    chars = GROW_ARRAY(char, chars, length + 1, size + 1);
+    chars[size] = '\0';
+    emitConstant(OBJ_VAL(takeString(chars, size)));
 }
 
 static void namedVariable(Token name, bool canAssign)
@@ -1075,8 +1290,14 @@ static void unary(bool canAssign)
 ParseRule rules[] = {
     [TOKEN_LPAREN] = {grouping, call, PREC_CALL},
     [TOKEN_RPAREN] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LBRACE] = {mapLiteral, NULL, PREC_NONE},
+    [TOKEN_RBRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LBRACKET] = {arrayLiteral, subscript, PREC_CALL},
+    [TOKEN_RBRACKET] = {NULL, NULL, PREC_NONE},
+    [TOKEN_COLON] = {NULL, NULL, PREC_NONE},
     [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
     [TOKEN_DOT] = {NULL, binary, PREC_TERM},
+    [TOKEN_ARROW] = {NULL, field, PREC_CALL},
     [TOKEN_MINUS] = {unary, binary, PREC_TERM},
     [TOKEN_PLUS] = {NULL, binary, PREC_TERM},
     [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},
@@ -1097,6 +1318,7 @@ ParseRule rules[] = {
     [TOKEN_NUMBER_LITERAL] = {number, NULL, PREC_NONE},
     [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
     [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
+    [TOKEN_NULL] = {literal, NULL, PREC_NONE},
     [TOKEN_AND] = {NULL, logicAnd, PREC_AND},
     [TOKEN_OR] = {NULL, logicOr, PREC_OR},
     [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
@@ -1111,12 +1333,14 @@ ParseRule rules[] = {
     [TOKEN_ENDBLOCK] = {NULL, NULL, PREC_NONE},
     [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
     [TOKEN_ENDFOR] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IN] = {NULL, NULL, PREC_NONE},
     [TOKEN_WHILE] = {NULL, NULL, PREC_NONE},
     [TOKEN_ENDWHILE] = {NULL, NULL, PREC_NONE},
     [TOKEN_CONTINUE] = {NULL, NULL, PREC_NONE},
     [TOKEN_BREAK] = {NULL, NULL, PREC_NONE},
     [TOKEN_FUNC] = {NULL, NULL, PREC_NONE},
     [TOKEN_ENDFUNC] = {NULL, NULL, PREC_NONE},
+    [TOKEN_RECORD] = {recordLiteral, NULL, PREC_NONE},
 };
 
 static void parsePrecedence(Precedence precedence)
@@ -1150,8 +1374,9 @@ static ParseRule *getRule(token_t t)
     return &rules[t];
 }
 
-ObjectFunction *compile(const char *source, const char *filename, int debugLevel)
+ObjectFunction *compile(const char *source, ObjectSource *owner, const char *filename, int debugLevel)
 {
+    parser.owner = owner;
     initScanner(source);
     Compiler compiler;
     initCompiler(&compiler, TYPE_SCRIPT);
@@ -1186,11 +1411,22 @@ ObjectFunction *compile(const char *source, const char *filename, int debugLevel
     }
 
     ObjectFunction *function = endCompiler(debugLevel);
+    parser.owner = NULL;
     return parser.hadError ? NULL : function;
 }
 
+void resetCompiler()
+{
+    current = NULL;
+    parser.owner = NULL;
+    innermostLoopStart = -1;
+    breakJump = -1;
+    innermostLoopScopeDepth = 0;
+}
+
 void markCompilerRoots()
 {
+    markObject((Object *)parser.owner);
     Compiler *compiler = current;
     while (compiler != NULL)
     {
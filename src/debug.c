@@ -4,9 +4,9 @@
 #include "object.h"
 #include "value.h"
 
-void disassembleChunk(Chunk *chunk, const char *name)
+void disassembleChunk(Chunk *chunk, const char *name, int length)
 {
-    printf("\n== %s ==\n\n", name);
+    printf("\n== %.*s ==\n\n", length, name);
     for (int offset = 0; offset < chunk->size;)
     {
         offset = disassembleInstruction(chunk, offset);
@@ -45,6 +45,26 @@ static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset)
     return offset + 3;
 }
 
+static int iterInstruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t slot = chunk->code[offset + 1];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+    jump |= chunk->code[offset + 3];
+    printf("%-16s %4d %04d -> %04d\n", name, slot, offset, offset + 4 + jump);
+    return offset + 4;
+}
+
+static int fieldInstruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t constant = chunk->code[offset + 1];
+    uint16_t cache = (uint16_t)(chunk->code[offset + 2] << 8);
+    cache |= chunk->code[offset + 3];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' ic %d\n", cache);
+    return offset + 4;
+}
+
 int disassembleInstruction(Chunk *chunk, int offset)
 {
     printf("%04d ", offset);
@@ -148,6 +168,28 @@ int disassembleInstruction(Chunk *chunk, int offset)
 
         return offset;
     }
+    case OP_MAP:
+        return simpleInstruction("map", offset);
+    case OP_MAP_INSERT:
+        return simpleInstruction("mapins", offset);
+    case OP_ARRAY:
+        return simpleInstruction("arr", offset);
+    case OP_ARRAY_PUSH:
+        return simpleInstruction("arrpush", offset);
+    case OP_INDEX_GET:
+        return simpleInstruction("iget", offset);
+    case OP_INDEX_SET:
+        return simpleInstruction("iset", offset);
+    case OP_ITER_NEXT:
+        return iterInstruction("inext", chunk, offset);
+    case OP_RECORD:
+        return simpleInstruction("rec", offset);
+    case OP_RECORD_FIELD:
+        return fieldInstruction("recfield", chunk, offset);
+    case OP_GET_FIELD:
+        return fieldInstruction("fget", chunk, offset);
+    case OP_SET_FIELD:
+        return fieldInstruction("fset", chunk, offset);
     case OP_RETURN:
         return simpleInstruction("ret", offset);
     default:
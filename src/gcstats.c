@@ -0,0 +1,134 @@
+#include "gcstats.h"
+#include "mem.h"
+#include "vm.h"
+
+static const char *const typeNames[OBJECT_TYPES] = {
+    [OBJECT_STRING] = "string",
+    [OBJECT_FUNCTION] = "function",
+    [OBJECT_NATIVE] = "native",
+    [OBJECT_CLOSURE] = "closure",
+    [OBJECT_UPVALUE] = "upvalue",
+    [OBJECT_SOURCE] = "source",
+    [OBJECT_MAP] = "map",
+    [OBJECT_ARRAY] = "array",
+    [OBJECT_TYPED_ARRAY] = "typedArray",
+    [OBJECT_SHAPE] = "shape",
+    [OBJECT_RECORD] = "record",
+    [OBJECT_VECTOR_NODE] = "vectorNode",
+    [OBJECT_PVECTOR] = "pvector",
+    [OBJECT_HAMT_NODE] = "hamtNode",
+    [OBJECT_PMAP] = "pmap",
+    [OBJECT_SEQ] = "seq",
+    [OBJECT_SEQ_ITER] = "seqIter",
+};
+
+const char *objectTypeName(object_t t)
+{
+    return typeNames[t];
+}
+
+// the pause that share of all pauses were no longer than.
+static double pausePercentile(double share)
+{
+    size_t rank = (size_t)ceil(share * (double)vm->gcPauses);
+    if (rank == 0)
+        return 0;
+    size_t seen = 0;
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    {
+        seen += vm->gcPauseCounts[i];
+        if (seen >= rank)
+        {
+            double top = exp2(i / 4.0) * 1e-6;
+            return top < vm->gcMaxPause ? top : vm->gcMaxPause;
+        }
+    }
+    return vm->gcMaxPause;
+}
+
+void gcStats(GCStats *stats)
+{
+    stats->cycles = vm->gcCycles;
+    stats->minorCycles = vm->gcMinorCycles;
+    stats->compactions = vm->gcCompactions;
+    stats->pauses = vm->gcPauses;
+    stats->totalPause = vm->gcPauseTotal;
+    stats->p50Pause = pausePercentile(0.5);
+    stats->p99Pause = pausePercentile(0.99);
+    stats->maxPause = vm->gcMaxPause;
+    stats->heap = vm->bytesAllocated;
+    stats->metadata = __atomic_load_n(&vm->gcMetadata, __ATOMIC_RELAXED);
+    stats->mapped = vm->heap.mapped;
+    stats->allocated = vm->gcAllocatedTotal;
+    stats->freed = vm->gcAllocatedTotal > vm->bytesAllocated ? vm->gcAllocatedTotal - vm->bytesAllocated : 0;
+    double elapsed = gcClock() - vm->gcStartTime;
+    stats->allocationRate = elapsed > 0 ? (double)vm->gcAllocatedTotal / elapsed : 0;
+    liveBytes(stats->live);
+}
+
+static void printSize(FILE *file, double bytes)
+{
+    static const char *const units[] = {"B", "KB", "MB", "GB", "TB"};
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4)
+    {
+        bytes /= 1024;
+        unit++;
+    }
+    fprintf(file, unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+}
+
+void printGCStats(FILE *file)
+{
+    GCStats stats;
+    gcStats(&stats);
+    fprintf(file, "gc: %zu major and %zu minor collections, %zu compactions\n",
+            stats.cycles, stats.minorCycles, stats.compactions);
+    fprintf(file, "gc: %zu pauses, %.3f ms in total, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            stats.pauses, stats.totalPause * 1e3, stats.p50Pause * 1e3,
+            stats.p99Pause * 1e3, stats.maxPause * 1e3);
+    fprintf(file, "gc: allocated ");
+    printSize(file, (double)stats.allocated);
+    fprintf(file, " at ");
+    printSize(file, stats.allocationRate);
+    fprintf(file, "/s, freed ");
+    printSize(file, (double)stats.freed);
+    fprintf(file, ", heap ");
+    printSize(file, (double)stats.heap);
+    fprintf(file, " and ");
+    printSize(file, (double)stats.metadata);
+    fprintf(file, " for the collector");
+    fprintf(file, ", mapped ");
+    printSize(file, (double)stats.mapped);
+    fprintf(file, "\ngc: live");
+    for (int i = 0; i < OBJECT_TYPES; i++)
+    {
+        if (stats.live[i] == 0)
+            continue;
+        fprintf(file, " %s ", typeNames[i]);
+        printSize(file, (double)stats.live[i]);
+    }
+    fprintf(file, "\n");
+}
+
+// pauses are in milliseconds, the same as gcStats() hands out.
+void writeGCStatsJson(FILE *file)
+{
+    GCStats stats;
+    gcStats(&stats);
+    fprintf(file, "{\"cycles\": %zu, \"minorCycles\": %zu, \"compactions\": %zu, ",
+            stats.cycles, stats.minorCycles, stats.compactions);
+    fprintf(file, "\"pauses\": %zu, \"totalPause\": %.6f, \"p50Pause\": %.6f, "
+                  "\"p99Pause\": %.6f, \"maxPause\": %.6f, ",
+            stats.pauses, stats.totalPause * 1e3, stats.p50Pause * 1e3,
+            stats.p99Pause * 1e3, stats.maxPause * 1e3);
+    fprintf(file, "\"heap\": %zu, \"metadata\": %zu, \"mapped\": %zu, \"allocated\": %zu, "
+                  "\"freed\": %zu, \"allocationRate\": %.0f, \"live\": {",
+            stats.heap, stats.metadata, stats.mapped, stats.allocated, stats.freed,
+            stats.allocationRate);
+    for (int i = 0; i < OBJECT_TYPES; i++)
+    {
+        fprintf(file, "%s\"%s\": %zu", i == 0 ? "" : ", ", typeNames[i], stats.live[i]);
+    }
+    fprintf(file, "}}\n");
+}
\ No newline at end of file
@@ -0,0 +1,746 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// without sweeper threads the heap is still shared by isolates on
+// different threads.
+#include <pthread.h>
+
+#include "heap.h"
+
+#define HEAP_HEADER_SIZE ((sizeof(Page) + 15) & ~(size_t)15)
+
+static const uint32_t classSizes[HEAP_CLASSES] = {
+    16, 24, 32, 40, 48, 56, 64,
+    80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048};
+
+// size / 8 to the smallest class that fits it.
+static int8_t classOf[HEAP_SMALL_MAX / 8 + 1];
+static pthread_once_t classesBuilt = PTHREAD_ONCE_INIT;
+
+static void buildClasses()
+{
+    int sizeClass = 0;
+    for (int i = 0; i <= HEAP_SMALL_MAX / 8; i++)
+    {
+        while (classSizes[sizeClass] < (uint32_t)i * 8)
+            sizeClass++;
+        classOf[i] = (int8_t)sizeClass;
+    }
+}
+
+#ifdef COMPRESSED_REFS
+#define CAGE_PAGES (HEAP_CAGE_SIZE / HEAP_PAGE_SIZE)
+
+uint8_t *heapCage;
+// a bit per page of the cage, set while it's mapped. no page below
+// cageHint is free.
+static uint64_t cageUsed[CAGE_PAGES / 64];
+static size_t cageHint;
+// every isolate's heap is in the one cage.
+static pthread_mutex_t cageLock = PTHREAD_MUTEX_INITIALIZER;
+
+// reserved once for the whole process, the kernel only commits what gets
+// touched.
+static void reserveCage()
+{
+    uint8_t *memory = mmap(NULL, HEAP_CAGE_SIZE + HEAP_REGION_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+        exit(1);
+    heapCage = (uint8_t *)(((uintptr_t)memory + HEAP_REGION_SIZE - 1) & ~(uintptr_t)(HEAP_REGION_SIZE - 1));
+    // the first page is never used, so no object is at offset 0.
+    cageUsed[0] = 1;
+    cageHint = 1;
+}
+
+static inline bool cagePageUsed(size_t page)
+{
+    return cageUsed[page / 64] & ((uint64_t)1 << (page % 64));
+}
+
+// the first run of count free pages that starts on a multiple of align.
+static size_t findCagePages(size_t count, size_t align)
+{
+    size_t run = 0;
+    for (size_t page = cageHint; page < CAGE_PAGES; page++)
+    {
+        if (page % 64 == 0 && cageUsed[page / 64] == ~(uint64_t)0)
+        {
+            page += 63;
+            run = 0;
+            continue;
+        }
+        if (cagePageUsed(page) || (run == 0 && page % align != 0))
+        {
+            run = 0;
+            continue;
+        }
+        if (++run == count)
+            return page + 1 - count;
+    }
+    // the cage is full.
+    exit(1);
+}
+#endif
+
+// size and align are multiples of HEAP_PAGE_SIZE.
+static uint8_t *mapSpace(size_t size, size_t align)
+{
+#ifdef COMPRESSED_REFS
+    pthread_mutex_lock(&cageLock);
+    if (heapCage == NULL)
+        reserveCage();
+    size_t count = size / HEAP_PAGE_SIZE;
+    size_t first = findCagePages(count, align / HEAP_PAGE_SIZE);
+    for (size_t page = first; page < first + count; page++)
+    {
+        cageUsed[page / 64] |= (uint64_t)1 << (page % 64);
+    }
+    while (cageHint < CAGE_PAGES && cagePageUsed(cageHint))
+        cageHint++;
+    pthread_mutex_unlock(&cageLock);
+    return heapCage + first * HEAP_PAGE_SIZE;
+#else
+    // a bit more than needed, trimmed so that it starts aligned.
+    uint8_t *memory = mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        exit(1);
+    uint8_t *base = (uint8_t *)(((uintptr_t)memory + align - 1) & ~(uintptr_t)(align - 1));
+    if (base > memory)
+        munmap(memory, (size_t)(base - memory));
+    munmap(base + size, (size_t)(memory + align - base));
+    return base;
+#endif
+}
+
+static void unmapSpace(uint8_t *base, size_t size)
+{
+#ifdef COMPRESSED_REFS
+    // the cage stays reserved, only its memory goes back.
+    madvise(base, size, MADV_DONTNEED);
+    size_t first = (size_t)(base - heapCage) / HEAP_PAGE_SIZE;
+    pthread_mutex_lock(&cageLock);
+    for (size_t page = first; page < first + size / HEAP_PAGE_SIZE; page++)
+    {
+        cageUsed[page / 64] &= ~((uint64_t)1 << (page % 64));
+    }
+    if (first < cageHint)
+        cageHint = first;
+    pthread_mutex_unlock(&cageLock);
+#else
+    munmap(base, size);
+#endif
+}
+
+static Region *newRegion(Heap *heap, size_t size, size_t align, bool isShared)
+{
+    Region *region = malloc(sizeof(Region));
+    if (region == NULL)
+        exit(1);
+    region->base = mapSpace(size, align);
+    region->size = size;
+    region->isShared = isShared;
+    region->used = 0;
+    region->committed = 0;
+    region->idle = 0;
+    if (isShared && heap->hugePages)
+        madvise(region->base, size, MADV_HUGEPAGE);
+
+    region->prev = NULL;
+    region->next = heap->regions;
+    if (region->next != NULL)
+        region->next->prev = region;
+    heap->regions = region;
+    heap->mapped += size;
+    return region;
+}
+
+static void freeRegion(Heap *heap, Region *region)
+{
+    if (region->prev != NULL)
+        region->prev->next = region->next;
+    else
+        heap->regions = region->next;
+    if (region->next != NULL)
+        region->next->prev = region->prev;
+    unmapSpace(region->base, region->size);
+    heap->mapped -= region->size;
+    free(region);
+}
+
+void *mapRegion(Heap *heap, size_t size)
+{
+    size = (size + HEAP_PAGE_SIZE - 1) & ~(size_t)(HEAP_PAGE_SIZE - 1);
+    return newRegion(heap, size, HEAP_PAGE_SIZE, false)->base;
+}
+
+void unmapRegion(Heap *heap, void *memory)
+{
+    for (Region *region = heap->regions; region != NULL; region = region->next)
+    {
+        if (region->base == memory)
+        {
+            freeRegion(heap, region);
+            return;
+        }
+    }
+}
+
+// a free page of a shared region, preferably one that still has memory
+// behind it.
+static uint8_t *takePage(Heap *heap, Region **owner)
+{
+    Region *found = NULL;
+    for (Region *region = heap->regions; region != NULL; region = region->next)
+    {
+        if (!region->isShared || region->used == ~(uint64_t)0)
+            continue;
+        if (region->committed & ~region->used)
+        {
+            found = region;
+            break;
+        }
+        if (found == NULL)
+            found = region;
+    }
+    if (found == NULL)
+        found = newRegion(heap, HEAP_REGION_SIZE, HEAP_REGION_SIZE, true);
+
+    uint64_t free = ~found->used;
+    uint64_t warm = free & found->committed;
+    int index = __builtin_ctzll(warm != 0 ? warm : free);
+    found->used |= (uint64_t)1 << index;
+    found->committed |= (uint64_t)1 << index;
+    found->idle &= ~((uint64_t)1 << index);
+    *owner = found;
+    return found->base + (size_t)index * HEAP_PAGE_SIZE;
+}
+
+static void freePage(Heap *heap, Page *page)
+{
+    Region *region = page->region;
+    if (!region->isShared)
+    {
+        freeRegion(heap, region);
+        return;
+    }
+    int index = (int)(((uint8_t *)page - region->base) / HEAP_PAGE_SIZE);
+    region->used &= ~((uint64_t)1 << index);
+}
+
+// a page that was freed this cycle is likely to be needed again by the
+// next one, only what stayed free through a whole cycle goes back.
+void releaseMemory(Heap *heap)
+{
+    bool released = false;
+    Region *region = heap->regions;
+    while (region != NULL)
+    {
+        Region *next = region->next;
+        if (!region->isShared)
+        {
+            region = next;
+            continue;
+        }
+        if (region->used == 0 && (region->committed & ~region->idle) == 0)
+        {
+            freeRegion(heap, region);
+            released = true;
+            region = next;
+            continue;
+        }
+        if (!heap->hugePages)
+        {
+            // one call per run of idle pages.
+            uint64_t stale = region->committed & region->idle;
+            region->committed &= ~stale;
+            released |= stale != 0;
+            while (stale != 0)
+            {
+                int first = __builtin_ctzll(stale);
+                uint64_t rest = ~(stale >> first);
+                int run = rest == 0 ? 64 - first : __builtin_ctzll(rest);
+                madvise(region->base + (size_t)first * HEAP_PAGE_SIZE,
+                        (size_t)run * HEAP_PAGE_SIZE, MADV_DONTNEED);
+                stale &= run == 64 ? 0 : ~((((uint64_t)1 << run) - 1) << first);
+            }
+        }
+        region->idle = ~region->used;
+        region = next;
+    }
+#ifdef __GLIBC__
+    // what objects owned outside the heap was freed through malloc, when
+    // the heap shrank that likely did too.
+    if (released)
+        malloc_trim(0);
+#endif
+}
+
+void initPages(Heap *heap, void (*release)(Object *))
+{
+    heap->pages = NULL;
+    for (int i = 0; i <= HEAP_CLASSES; i++)
+    {
+        heap->unswept[i] = NULL;
+    }
+    heap->unsweptCount = 0;
+    for (int i = 0; i < HEAP_CLASSES; i++)
+    {
+        heap->available[i] = NULL;
+    }
+    heap->release = release;
+    heap->enter = NULL;
+    heap->owner = NULL;
+    heap->parallel = false;
+    heap->regions = NULL;
+    heap->mapped = 0;
+    heap->hugePages = false;
+    pthread_once(&classesBuilt, buildClasses);
+}
+
+static void makeAvailable(Heap *heap, Page *page)
+{
+    if (page->isAvailable)
+        return;
+    page->isAvailable = true;
+    page->prevAvailable = NULL;
+    page->nextAvailable = heap->available[page->sizeClass];
+    if (page->nextAvailable != NULL)
+        page->nextAvailable->prevAvailable = page;
+    heap->available[page->sizeClass] = page;
+}
+
+static void makeUnavailable(Heap *heap, Page *page)
+{
+    if (!page->isAvailable)
+        return;
+    page->isAvailable = false;
+    if (page->prevAvailable != NULL)
+        page->prevAvailable->nextAvailable = page->nextAvailable;
+    else
+        heap->available[page->sizeClass] = page->nextAvailable;
+    if (page->nextAvailable != NULL)
+        page->nextAvailable->prevAvailable = page->prevAvailable;
+}
+
+static Page *newPage(Heap *heap, int sizeClass, size_t size)
+{
+    size_t mapped = HEAP_PAGE_SIZE;
+    if (sizeClass == HEAP_LARGE)
+        mapped = (HEAP_HEADER_SIZE + size + HEAP_PAGE_SIZE - 1) & ~(size_t)(HEAP_PAGE_SIZE - 1);
+
+    Region *region;
+    Page *page;
+    if (sizeClass == HEAP_LARGE)
+    {
+        region = newRegion(heap, mapped, HEAP_PAGE_SIZE, false);
+        page = (Page *)region->base;
+    }
+    else
+    {
+        page = (Page *)takePage(heap, &region);
+    }
+    memset(page, 0, sizeof(Page));
+    page->region = region;
+    page->sizeClass = sizeClass;
+    page->cells = (uint8_t *)page + HEAP_HEADER_SIZE;
+    if (sizeClass == HEAP_LARGE)
+    {
+        page->cellSize = (uint32_t)size;
+        page->cellCount = 1;
+        page->reciprocal = 0;
+    }
+    else
+    {
+        page->cellSize = classSizes[sizeClass];
+        page->cellCount = (uint32_t)((HEAP_PAGE_SIZE - HEAP_HEADER_SIZE) / page->cellSize);
+        page->reciprocal = (uint32_t)((((uint64_t)1 << 32) + page->cellSize - 1) / page->cellSize);
+    }
+
+    page->next = heap->pages;
+    heap->pages = page;
+    return page;
+}
+
+// frees the dead cells of a page and says whether anything survived. it
+// only touches the page, so sweeper threads can each take their own.
+static bool sweepCells(Page *page, void (*release)(Object *))
+{
+    bool survived = false;
+    // only the words up to the fresh cursor can have anything in them,
+    // and only dead cells are touched.
+    int words = (int)((page->fresh + 63) / 64);
+    for (int i = 0; i < words; i++)
+    {
+        uint64_t marks = page->bitmaps[PAGE_MARKED][i];
+        uint64_t dead = page->live[i] & ~marks;
+        while (dead != 0)
+        {
+            int bit = __builtin_ctzll(dead);
+            dead &= dead - 1;
+            uint8_t *cell = page->cells + ((size_t)i * 64 + bit) * page->cellSize;
+            release((Object *)cell);
+            *(void **)cell = page->freeList;
+            page->freeList = cell;
+        }
+        page->live[i] &= marks;
+        for (int bitmap = 0; bitmap < PAGE_BITMAPS; bitmap++)
+        {
+            page->bitmaps[bitmap][i] = 0;
+        }
+        survived |= page->live[i] != 0;
+    }
+    return survived;
+}
+
+static bool releaseCells(Page *page, void (*release)(Object *))
+{
+    visitLive(page, release);
+    return false;
+}
+
+// a swept page goes back on the heap, or back to the system if it's empty.
+static void returnPage(Heap *heap, Page *page, bool survived)
+{
+    if (!survived)
+    {
+        freePage(heap, page);
+        return;
+    }
+    page->next = heap->pages;
+    heap->pages = page;
+    if (page->sizeClass != HEAP_LARGE && (page->freeList != NULL || page->fresh < page->cellCount))
+        makeAvailable(heap, page);
+}
+
+void startSweep(Heap *heap)
+{
+    for (int i = 0; i < HEAP_CLASSES; i++)
+    {
+        heap->available[i] = NULL;
+    }
+    Page *page = heap->pages;
+    while (page != NULL)
+    {
+        Page *next = page->next;
+        int list = page->sizeClass == HEAP_LARGE ? HEAP_CLASSES : page->sizeClass;
+        page->isAvailable = false;
+        page->next = heap->unswept[list];
+        heap->unswept[list] = page;
+        heap->unsweptCount++;
+        page = next;
+    }
+    heap->pages = NULL;
+}
+
+static Page *takeUnswept(Heap *heap, int list)
+{
+    Page *page = heap->unswept[list];
+    if (page != NULL)
+    {
+        heap->unswept[list] = page->next;
+        heap->unsweptCount--;
+    }
+    return page;
+}
+
+// sweeps one page, small ones first since those are what allocation
+// waits on.
+bool sweepNext(Heap *heap)
+{
+    for (int list = 0; list <= HEAP_CLASSES; list++)
+    {
+        Page *page = takeUnswept(heap, list);
+        if (page != NULL)
+        {
+            returnPage(heap, page, sweepCells(page, heap->release));
+            return true;
+        }
+    }
+    return false;
+}
+
+Object *heapAllocate(Heap *heap, size_t size)
+{
+    Page *page;
+    uint8_t *cell;
+    if (size > HEAP_SMALL_MAX)
+    {
+        page = newPage(heap, HEAP_LARGE, size);
+        cell = page->cells;
+        page->fresh = 1;
+    }
+    else
+    {
+        int sizeClass = classOf[(size + 7) / 8];
+        // sweep this class until a page has room before growing the heap.
+        while (heap->available[sizeClass] == NULL && heap->unswept[sizeClass] != NULL)
+        {
+            Page *unswept = takeUnswept(heap, sizeClass);
+            returnPage(heap, unswept, sweepCells(unswept, heap->release));
+        }
+        page = heap->available[sizeClass];
+        if (page == NULL)
+        {
+            page = newPage(heap, sizeClass, size);
+            makeAvailable(heap, page);
+        }
+
+        if (page->freeList != NULL)
+        {
+            cell = page->freeList;
+            page->freeList = *(void **)cell;
+        }
+        else
+        {
+            cell = page->cells + (size_t)page->fresh++ * page->cellSize;
+        }
+        if (page->freeList == NULL && page->fresh == page->cellCount)
+            makeUnavailable(heap, page);
+    }
+
+    uint32_t index = cellIndex(page, (Object *)cell);
+    page->live[index / 64] |= (uint64_t)1 << (index % 64);
+    return (Object *)cell;
+}
+
+typedef struct
+{
+    Page **pages;
+    bool *survived;
+    int count;
+    bool (*visit)(Page *, void (*)(Object *));
+    Heap *heap;
+} PageJob;
+
+static void *pageWorker(void *arg)
+{
+    PageJob *job = arg;
+    if (job->heap->enter != NULL)
+        job->heap->enter(job->heap->owner);
+    for (int i = 0; i < job->count; i++)
+    {
+        job->survived[i] = job->visit(job->pages[i], job->heap->release);
+    }
+    return NULL;
+}
+
+static int heapThreads(int pages)
+{
+#ifdef HEAP_NO_THREADS
+    return 1;
+#else
+    if (pages < HEAP_PARALLEL_MIN)
+        return 1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = 1;
+    while (threads < cpus && threads < HEAP_THREADS_MAX)
+        threads++;
+    return threads;
+#endif
+}
+
+// visits every page on the list, split across threads when there are
+// enough of them, then hands each one to returnPage().
+static void visitPages(Heap *heap, Page *list, int count, bool (*visit)(Page *, void (*)(Object *)))
+{
+    if (count == 0)
+        return;
+    Page **pages = malloc(sizeof(Page *) * count);
+    bool *survived = malloc(sizeof(bool) * count);
+    if (pages == NULL || survived == NULL)
+        exit(1);
+    for (int i = 0; list != NULL; list = list->next)
+    {
+        pages[i++] = list;
+    }
+
+    int threads = heapThreads(count);
+    PageJob jobs[HEAP_THREADS_MAX];
+    for (int i = 0; i < threads; i++)
+    {
+        int start = (int)((int64_t)count * i / threads);
+        jobs[i].pages = pages + start;
+        jobs[i].survived = survived + start;
+        jobs[i].count = (int)((int64_t)count * (i + 1) / threads) - start;
+        jobs[i].visit = visit;
+        jobs[i].heap = heap;
+    }
+
+#ifndef HEAP_NO_THREADS
+    pthread_t workers[HEAP_THREADS_MAX];
+    bool started[HEAP_THREADS_MAX];
+    heap->parallel = threads > 1;
+    // the first part is done here.
+    for (int i = 1; i < threads; i++)
+        started[i] = pthread_create(&workers[i], NULL, pageWorker, &jobs[i]) == 0;
+    pageWorker(&jobs[0]);
+    for (int i = 1; i < threads; i++)
+    {
+        if (started[i])
+            pthread_join(workers[i], NULL);
+        else
+            pageWorker(&jobs[i]);
+    }
+    heap->parallel = false;
+#else
+    pageWorker(&jobs[0]);
+#endif
+
+    for (int i = 0; i < count; i++)
+    {
+        returnPage(heap, pages[i], survived[i]);
+    }
+    free(pages);
+    free(survived);
+}
+
+void sweepRest(Heap *heap)
+{
+    Page *list = NULL;
+    int count = 0;
+    for (int i = 0; i <= HEAP_CLASSES; i++)
+    {
+        Page *page;
+        while ((page = takeUnswept(heap, i)) != NULL)
+        {
+            page->next = list;
+            list = page;
+            count++;
+        }
+    }
+    visitPages(heap, list, count, sweepCells);
+}
+
+void freePages(Heap *heap)
+{
+    // a page that wasn't swept yet still has its dead objects live.
+    for (int i = 0; i <= HEAP_CLASSES; i++)
+    {
+        Page *page;
+        while ((page = takeUnswept(heap, i)) != NULL)
+        {
+            page->next = heap->pages;
+            heap->pages = page;
+        }
+    }
+    int count = 0;
+    for (Page *page = heap->pages; page != NULL; page = page->next)
+    {
+        count++;
+    }
+    Page *list = heap->pages;
+    heap->pages = NULL;
+    for (int i = 0; i < HEAP_CLASSES; i++)
+    {
+        heap->available[i] = NULL;
+    }
+    visitPages(heap, list, count, releaseCells);
+    while (heap->regions != NULL)
+        freeRegion(heap, heap->regions);
+}
+
+static uint32_t liveCount(Page *page)
+{
+    uint32_t count = 0;
+    for (int i = 0; i < (int)((page->fresh + 63) / 64); i++)
+    {
+        count += (uint32_t)__builtin_popcountll(page->live[i]);
+    }
+    return count;
+}
+
+double heapFragmentation(Heap *heap, size_t minimum)
+{
+    size_t capacity = 0;
+    size_t used = 0;
+    for (Page *page = heap->pages; page != NULL; page = page->next)
+    {
+        if (page->sizeClass == HEAP_LARGE)
+            continue;
+        capacity += (size_t)page->cellCount * page->cellSize;
+        used += (size_t)liveCount(page) * page->cellSize;
+    }
+    if (capacity < minimum)
+        return 0;
+    return 1 - (double)used / (double)capacity;
+}
+
+Page *takeSparsePages(Heap *heap)
+{
+    Page *sparse = NULL;
+    Page **link = &heap->pages;
+    while (*link != NULL)
+    {
+        Page *page = *link;
+        if (page->sizeClass != HEAP_LARGE &&
+            liveCount(page) * 100 <= page->cellCount * HEAP_SPARSE_PERCENT)
+        {
+            *link = page->next;
+            makeUnavailable(heap, page);
+            page->next = sparse;
+            sparse = page;
+        }
+        else
+        {
+            link = &page->next;
+        }
+    }
+    return sparse;
+}
+
+static void visitCells(Page *page, bool marked, void (*visit)(Object *))
+{
+    for (int i = 0; i < (int)((page->fresh + 63) / 64); i++)
+    {
+        uint64_t live = page->live[i];
+        if (marked)
+            live &= __atomic_load_n(&page->bitmaps[PAGE_MARKED][i], __ATOMIC_ACQUIRE);
+        while (live != 0)
+        {
+            int bit = __builtin_ctzll(live);
+            live &= live - 1;
+            visit((Object *)(page->cells + ((size_t)i * 64 + bit) * page->cellSize));
+        }
+    }
+}
+
+void visitLive(Page *page, void (*visit)(Object *))
+{
+    visitCells(page, false, visit);
+}
+
+void visitHeap(Heap *heap, bool marked, void (*visit)(Object *))
+{
+    for (Page *page = heap->pages; page != NULL; page = page->next)
+    {
+        visitCells(page, marked, visit);
+    }
+    for (int i = 0; i <= HEAP_CLASSES; i++)
+    {
+        for (Page *page = heap->unswept[i]; page != NULL; page = page->next)
+        {
+            visitCells(page, true, visit);
+        }
+    }
+}
+
+void dropPages(Heap *heap, Page *pages)
+{
+    while (pages != NULL)
+    {
+        Page *next = pages->next;
+        freePage(heap, pages);
+        pages = next;
+    }
+}
\ No newline at end of file
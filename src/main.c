@@ -2,16 +2,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
 #include "chunk.h"
 #include "debug.h"
+#include "gcstats.h"
+#include "mem.h"
 #include "vm.h"
 #include "ansi-color.h"
 
 #define VM_VERSION "1.0.0-alpha"
 
+// --gc-stats prints them to stderr at exit, --gc-stats-json writes them
+// to a file, or to stdout for '-'.
+static bool showGCStats = false;
+static const char *gcStatsPath = NULL;
+
 static char *trimwhitespace(char *str)
 {
     char *end;
@@ -42,46 +53,74 @@ static void runFromREPL()
             continue;
         }
         add_history(code);
-        interpret(code, "REPL", 0);
+        interpret(vm, code, "REPL", 0);
     }
 }
 
-static char *readFile(const char *path)
+static ObjectSource *readFile(const char *path)
 {
-    FILE *file = fopen(path, "rb");
-    if (file == NULL)
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
     {
         fprintf(stderr, RED "\nError: cannot OPEN '%s'. Possible error: ENOENT, EACCES.\n\n" RESET, path);
         exit(74);
     }
+    size_t fileSize = (size_t)st.st_size;
 
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
-
-    char *buffer = (char *)malloc(fileSize + 1);
-    if (buffer == NULL)
+    // map the file read-only when the page tail gives us the '\0' the
+    // scanner stops at for free. otherwise, fall back to reading it.
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    if (fileSize > 0 && fileSize % pageSize != 0)
     {
-        fprintf(stderr, RED "\nError: not ENOUGH MEMORY to read '%s'.\n\n", path);
-        exit(74);
+        void *mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            close(fd);
+            return newSource((const char *)mapped, fileSize, true);
+        }
     }
-    size_t b_read = fread(buffer, sizeof(char), fileSize, file);
-    if (b_read < fileSize)
+
+    char *buffer = ALLOCATE(char, fileSize + 1);
+    size_t b_read = 0;
+    while (b_read < fileSize)
     {
-        fprintf(stderr, "\nError: could not READ '%s'\n\n", path);
-        exit(74);
+        ssize_t n = read(fd, buffer + b_read, fileSize - b_read);
+        if (n <= 0)
+        {
+            fprintf(stderr, "\nError: could not READ '%s'\n\n", path);
+            exit(74);
+        }
+        b_read += (size_t)n;
     }
     buffer[b_read] = '\0';
 
-    fclose(file);
-    return buffer;
+    close(fd);
+    return newSource(buffer, fileSize, false);
+}
+
+static void reportGC()
+{
+    if (showGCStats)
+        printGCStats(stderr);
+    if (gcStatsPath == NULL)
+        return;
+    FILE *file = strcmp(gcStatsPath, "-") == 0 ? stdout : fopen(gcStatsPath, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, RED "\nError: cannot OPEN '%s' for the gc stats.\n\n" RESET, gcStatsPath);
+        return;
+    }
+    writeGCStatsJson(file);
+    if (file != stdout)
+        fclose(file);
 }
 
 static void runFromFile(const char *path, int debugLevel)
 {
-    char *source = readFile(path);
-    InterpretResult result = interpret(source, path, debugLevel);
-    free(source);
+    // the source is a GC object now, strings borrowed from it keep it alive.
+    InterpretResult result = interpretSource(vm, readFile(path), path, debugLevel);
+    reportGC();
 
     if (result == INTERPRET_COMPILE_ERROR)
         exit(65);
@@ -117,6 +156,24 @@ static void showUsage(int exitStatus)
     fprintf(FD, GRN "    -d, --disassemble" RESET "\t\tRun interpreter and also show disassembled instructions.\n");
     fprintf(FD, GRN "    -dd, --debug" RESET "\tRun interpreter and also show disassembled instructions and execution trace.\n");
     fprintf(FD, "\n");
+    fprintf(FD, YEL "GC OPTIONS:\n\n" RESET);
+    fprintf(FD, "    These go anywhere on the command line. Each one can also be set with\n");
+    fprintf(FD, "    an environment variable, MEON_GC_MIN_HEAP for --gc-min-heap and so on.\n\n");
+    fprintf(FD, GRN "    --gc-stats" RESET "\t\tPrint collector statistics to stderr at exit.\n");
+    fprintf(FD, GRN "    --gc-stats-json=FILE" RESET "\tWrite them to FILE as JSON, '-' for stdout.\n");
+    fprintf(FD, GRN "    --gc-growth=N" RESET "\t\tLet the heap grow to N times what survived a collection. (2)\n");
+    fprintf(FD, GRN "    --gc-utilization=U" RESET "\tThe same as a growth of 1 / U.\n");
+    fprintf(FD, GRN "    --gc-min-heap=SIZE" RESET "\tDon't collect a heap smaller than SIZE, like 512K or 64M. (1M)\n");
+    fprintf(FD, GRN "    --gc-max-heap=SIZE" RESET "\tNever let the heap grow past SIZE, a script that needs more fails.\n");
+    fprintf(FD, GRN "    --gc-pause=US" RESET "\t\tCollect incrementally in pauses of about US microseconds.\n");
+    fprintf(FD, GRN "    --gc-concurrent" RESET "\tMark on a thread of its own.\n");
+    fprintf(FD, GRN "    --gc-compact" RESET "\t\tMove objects off sparse pages.\n");
+    fprintf(FD, GRN "    --gc-hugepages" RESET "\tBack the heap with transparent huge pages.\n");
+    fprintf(FD, "\n");
+    fprintf(FD, YEL "LIMITS:\n\n" RESET);
+    fprintf(FD, GRN "    --fuel=N" RESET "\t\tStop a script after about N instructions.\n");
+    fprintf(FD, GRN "    --time-limit=SECONDS" RESET "\tStop a script that runs longer than SECONDS.\n");
+    fprintf(FD, "\n");
     fprintf(FD, YEL "EXAMPLES:\n\n" RESET);
     fprintf(FD, GRN "    meon -r hello.meon" RESET "\tInterpret and evaluate 'hello.meon'.\n");
     fprintf(FD, "\n");
@@ -124,13 +181,99 @@ static void showUsage(int exitStatus)
     exit(exitStatus);
 }
 
+// --gc-stats, --gc-stats-json=FILE or --gc-NAME[=VALUE] for a collector
+// option, a bare one is switched on.
+static void parseGCOption(const char *arg)
+{
+    if (strcmp(arg, "stats") == 0)
+    {
+        showGCStats = true;
+        return;
+    }
+    if (strncmp(arg, "stats-json=", 11) == 0)
+    {
+        gcStatsPath = arg + 11;
+        return;
+    }
+    char name[32];
+    const char *value = strchr(arg, '=');
+    size_t length = value != NULL ? (size_t)(value - arg) : strlen(arg);
+    if (length < sizeof(name))
+    {
+        memcpy(name, arg, length);
+        name[length] = '\0';
+        if (setGCOption(name, value != NULL ? value + 1 : "1"))
+            return;
+    }
+    fprintf(stderr, RED "\nError: bad gc option '--gc-%s'.\n" RESET, arg);
+    showUsage(1);
+}
+
+// --fuel=N or --time-limit=SECONDS.
+static void parseLimit(const char *arg, int64_t *fuel, double *seconds)
+{
+    const char *value = strchr(arg, '=');
+    if (value != NULL && value[1] != '\0')
+    {
+        char *end;
+        if (strncmp(arg, "--fuel=", 7) == 0)
+        {
+            long long n = strtoll(value + 1, &end, 10);
+            if (*end == '\0' && n > 0)
+            {
+                *fuel = n;
+                return;
+            }
+        }
+        else if (strncmp(arg, "--time-limit=", 13) == 0)
+        {
+            double n = strtod(value + 1, &end);
+            if (*end == '\0' && n > 0)
+            {
+                *seconds = n;
+                return;
+            }
+        }
+    }
+    fprintf(stderr, RED "\nError: bad limit '%s'.\n" RESET, arg);
+    showUsage(1);
+}
+
 int main(int argc, char *argv[])
 {
-    initVM();
+    // the cli only ever runs the one isolate.
+    VM *isolate = newVM();
+    if (isolate == NULL)
+        exit(70);
+    enterVM(isolate);
+    if (vm->gcBadEnv[0] != '\0')
+    {
+        fprintf(stderr, RED "\nError: bad gc option '%s=%s'.\n" RESET, vm->gcBadEnv, getenv(vm->gcBadEnv));
+        showUsage(1);
+    }
+
+    // gc options and limits are taken out wherever they are, the rest is
+    // the command.
+    int64_t fuel = 0;
+    double seconds = 0;
+    int count = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--gc-", 5) == 0)
+            parseGCOption(argv[i] + 5);
+        else if (strncmp(argv[i], "--fuel", 6) == 0 || strncmp(argv[i], "--time-limit", 12) == 0)
+            parseLimit(argv[i], &fuel, &seconds);
+        else
+            argv[count++] = argv[i];
+    }
+    argc = count;
+    argv[argc] = NULL;
+    setRunLimits(vm, fuel, seconds, false);
 
     if (argc == 1)
     {
         runFromREPL();
+        reportGC();
     }
     else if (argc > 1 && argc < 5)
     {
@@ -197,6 +340,6 @@ int main(int argc, char *argv[])
     {
         showUsage(1);
     }
-    freeVM();
+    freeVM(vm);
     return 0;
 }
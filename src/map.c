@@ -0,0 +1,228 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "map.h"
+#include "mem.h"
+#include "object.h"
+#include "value.h"
+
+// nested maps deeper than this print as {...}, a map can contain itself.
+#define MAP_PRINT_DEPTH 8
+
+bool isMapKey(Value key)
+{
+    return IS_STRING(key) || IS_BOOL(key) || (IS_NUMBER(key) && !isnan(AS_NUMBER(key)));
+}
+
+uint32_t hashMapKey(Value key)
+{
+    switch (key.t)
+    {
+    case VALUE_BOOLEAN:
+        return AS_BOOL(key) ? 0x9e3779b9u : 0x7f4a7c15u;
+    case VALUE_NUMBER:
+    {
+        // fmix64 from murmur3, the raw bits of small integers only
+        // differ in the high bits. -0 hashes like 0, they're equal.
+        double number = AS_NUMBER(key);
+        if (number == 0)
+            number = 0;
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        bits ^= bits >> 33;
+        bits *= 0xff51afd7ed558ccdull;
+        bits ^= bits >> 33;
+        bits *= 0xc4ceb9fe1a85ec53ull;
+        bits ^= bits >> 33;
+        return (uint32_t)bits;
+    }
+    default:
+        return AS_STRING(key)->hash;
+    }
+}
+
+static int findSlot(ObjectMap *map, Value key, uint32_t hash)
+{
+    if (map->slotCapacity == 0)
+        return -1;
+
+    uint32_t mask = (uint32_t)map->slotCapacity - 1;
+    for (uint32_t index = hash & mask;; index = (index + 1) & mask)
+    {
+        MapSlot *slot = &map->slots[index];
+        if (slot->entry == MAP_SLOT_EMPTY)
+            return -1;
+        if (slot->entry >= 0 && slot->hash == hash &&
+            valuesEqual(map->entries[slot->entry].key, key))
+            return (int)index;
+    }
+}
+
+static void insertSlot(ObjectMap *map, uint32_t hash, int entry)
+{
+    uint32_t mask = (uint32_t)map->slotCapacity - 1;
+    uint32_t index = hash & mask;
+    while (map->slots[index].entry >= 0)
+        index = (index + 1) & mask;
+
+    map->slots[index].hash = hash;
+    map->slots[index].entry = entry;
+}
+
+// called when entries is full. holes left by deletes are squeezed out
+// first, it only grows when at least half of the entries are live. the
+// index is rebuilt either way, which also drops its tombstones. running
+// out of memory leaves the map as it was, so nothing changes until both
+// arrays are in hand.
+static void rebuild(ObjectMap *map)
+{
+    int capacity = map->entryCapacity;
+    if (map->count >= capacity / 2)
+    {
+        capacity = GROW_ARRAY_SIZE(capacity);
+        map->entries = GROW_ARRAY(MapEntry, map->entries, map->entryCapacity, capacity);
+        map->entryCapacity = capacity;
+    }
+
+    // twice as many slots as entries keeps the index at most half full.
+    int slotCapacity = capacity * 2;
+    if (slotCapacity != map->slotCapacity)
+    {
+        MapSlot *slots = ALLOCATE(MapSlot, slotCapacity);
+        FREE_ARRAY(MapSlot, map->slots, map->slotCapacity);
+        map->slots = slots;
+        map->slotCapacity = slotCapacity;
+    }
+
+    int live = 0;
+    for (int i = 0; i < map->entryCount; i++)
+    {
+        if (!IS_NULL(map->entries[i].key))
+            map->entries[live++] = map->entries[i];
+    }
+    map->entryCount = live;
+
+    for (int i = 0; i < map->slotCapacity; i++)
+        map->slots[i].entry = MAP_SLOT_EMPTY;
+    for (int i = 0; i < live; i++)
+        insertSlot(map, map->entries[i].hash, i);
+}
+
+bool mapGet(ObjectMap *map, Value key, Value *value)
+{
+    int slot = findSlot(map, key, hashMapKey(key));
+    if (slot == -1)
+        return false;
+
+    *value = map->entries[map->slots[slot].entry].value;
+    return true;
+}
+
+// returns true if the key is new. key and value must be reachable,
+// growing the map may collect.
+bool mapSet(ObjectMap *map, Value key, Value value)
+{
+    // -0 and 0 are the same key.
+    if (IS_NUMBER(key) && AS_NUMBER(key) == 0)
+        key = NUMBER_VAL(0);
+
+    preWriteBarrier((Object *)map);
+    uint32_t hash = hashMapKey(key);
+    int slot = findSlot(map, key, hash);
+    if (slot != -1)
+    {
+        map->entries[map->slots[slot].entry].value = value;
+        writeBarrier((Object *)map, value);
+        return false;
+    }
+
+    if (map->entryCount == map->entryCapacity)
+        rebuild(map);
+
+    MapEntry *entry = &map->entries[map->entryCount];
+    entry->key = key;
+    entry->value = value;
+    entry->hash = hash;
+    insertSlot(map, hash, map->entryCount);
+    map->entryCount++;
+    map->count++;
+    writeBarrier((Object *)map, key);
+    writeBarrier((Object *)map, value);
+    return true;
+}
+
+bool mapDelete(ObjectMap *map, Value key)
+{
+    int slot = findSlot(map, key, hashMapKey(key));
+    if (slot == -1)
+        return false;
+
+    preWriteBarrier((Object *)map);
+    // leave a hole so iteration order and entry indices stay put.
+    MapEntry *entry = &map->entries[map->slots[slot].entry];
+    entry->key = NULL_VAL;
+    entry->value = NULL_VAL;
+    map->slots[slot].entry = MAP_SLOT_DELETED;
+    map->count--;
+    return true;
+}
+
+// walks entries in insertion order, cursor starts at 0.
+bool mapNext(ObjectMap *map, int *cursor, Value *key)
+{
+    while (*cursor < map->entryCount)
+    {
+        MapEntry *entry = &map->entries[(*cursor)++];
+        if (!IS_NULL(entry->key))
+        {
+            *key = entry->key;
+            return true;
+        }
+    }
+    return false;
+}
+
+void markMap(ObjectMap *map)
+{
+    // only the used prefix of entries, holes are nulls.
+    for (int i = 0; i < map->entryCount; i++)
+    {
+        markValue(map->entries[i].key);
+        markValue(map->entries[i].value);
+    }
+}
+
+void freeMap(ObjectMap *map)
+{
+    FREE_ARRAY(MapEntry, map->entries, map->entryCapacity);
+    FREE_ARRAY(MapSlot, map->slots, map->slotCapacity);
+}
+
+void printMap(ObjectMap *map)
+{
+    static __thread int depth = 0;
+    if (depth == MAP_PRINT_DEPTH)
+    {
+        printf("{...}");
+        return;
+    }
+
+    depth++;
+    printf("{");
+    bool first = true;
+    for (int i = 0; i < map->entryCount; i++)
+    {
+        MapEntry *entry = &map->entries[i];
+        if (IS_NULL(entry->key))
+            continue;
+        if (!first)
+            printf(", ");
+        first = false;
+        printValue(entry->key);
+        printf(": ");
+        printValue(entry->value);
+    }
+    printf("}");
+    depth--;
+}
\ No newline at end of file
@@ -1,26 +1,150 @@
+#include <sched.h>
+#include <setjmp.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "map.h"
 #include "mem.h"
 #include "vm.h"
 
 #ifdef DEBUG_LOG_GC
-#include <stdio.h>
 #include "debug.h"
 #endif
 
 #define GC_HEAP_GROW_FACTOR 2
+#define GC_MIN_HEAP (1024 * 1024)
+// an incremental collection takes a slice every GC_STEP_SIZE bytes and
+// looks at the clock every GC_CLOCK_STRIDE objects.
+#define GC_STEP_SIZE (64 * 1024)
+#define GC_CLOCK_STRIDE 32
+#define GC_WEAK_SLICE 256
+// with a concurrent marker, clearing and sweeping still run in slices
+// even if no pause budget was given.
+#define GC_CONCURRENT_PAUSE 1000
+#define GC_SATB_FLUSH 256
+// once marking is done the allocator sweeps what it needs for this many
+// bytes, then the collector sweeps the rest.
+#define GC_SWEEP_STEP (1024 * 1024)
+// compaction kicks in once this share of small page space is free, but
+// not before the heap has some size to it.
+#define GC_COMPACT_FRAGMENTATION 0.5
+#define GC_COMPACT_MIN (4 * 1024 * 1024)
+// what the heap grew by since the last minor collection, buffers of young
+// objects included, is held against the heap limit only past the slack,
+// at most a quarter of the limit. a minor collection is asked for at half
+// the slack.
+#define GC_YOUNG_SLACK (2 * GC_NURSERY_SIZE)
+// stop-the-world marking is split across threads once the heap is this
+// big. a marker holding more than GC_MARK_SHARE gray objects offers half
+// of them to the others.
+#define GC_MARK_PARALLEL_MIN (8 * 1024 * 1024)
+#define GC_MARK_THREADS_MAX 16
+#define GC_MARK_SHARE 64
+#define GC_GRAY_KEEP 4096
+
+static void freeObject(Object *object);
+
+// frees wrap around. sweeper threads free memory too.
+static inline void countBytes(size_t delta)
+{
+    if (vm->heap.parallel)
+        __atomic_fetch_add(&vm->bytesAllocated, delta, __ATOMIC_RELAXED);
+    else
+        vm->bytesAllocated += delta;
+}
+
+static void collect(bool finish, bool safepoint);
+
+static inline size_t heapInUse()
+{
+    return vm->bytesAllocated + __atomic_load_n(&vm->gcMetadata, __ATOMIC_RELAXED);
+}
+
+// what a major collection frees lowers the mark too.
+static inline size_t youngBytes()
+{
+    size_t bytes = vm->bytesAllocated;
+    if (bytes < vm->youngBase)
+        vm->youngBase = bytes;
+    return bytes - vm->youngBase;
+}
+
+static inline size_t youngSlack()
+{
+    if (vm->gcMaxHeap > 0 && vm->gcMaxHeap / 4 < GC_YOUNG_SLACK)
+        return vm->gcMaxHeap / 4;
+    return GC_YOUNG_SLACK;
+}
+
+static inline void checkYoung()
+{
+    if (youngBytes() > youngSlack() / 2)
+        vm->youngRequested = true;
+}
+
+// what the limit is held against. a major collection can't free young
+// objects, so what they grew the heap by waits for the next minor one.
+static inline size_t liveInUse()
+{
+    size_t young = youngBytes();
+    size_t slack = youngSlack();
+    return heapInUse() - (young < slack ? young : slack);
+}
+
+// the error is raised where the vm was entered, everything the host calls
+// runs under protectedCall(). outside of one there's no one to raise it
+// to, the limit isn't held and a failed allocation comes back NULL.
+static void outOfMemory(size_t size)
+{
+    if (vm->errorJump == NULL)
+        return;
+    if (vm->gcMaxHeap > 0 && liveInUse() + size > vm->gcMaxHeap)
+        runtimeError("Out of memory, %zu more bytes would go past the heap limit of %zu.",
+                     size, vm->gcMaxHeap);
+    else
+        runtimeError("Out of memory, the system wouldn't give %zu more bytes.", size);
+    longjmp(*vm->errorJump, 1);
+}
+
+// past the limit the next safepoint runs a minor collection. if old
+// objects alone are too many, everything that's garbage goes at once, and
+// only if that isn't enough the script gets an error instead of the memory.
+static inline void makeRoom(size_t size)
+{
+    if (vm->gcMaxHeap == 0 || heapInUse() + size <= vm->gcMaxHeap)
+        return;
+    vm->youngRequested = true;
+    if (liveInUse() + size <= vm->gcMaxHeap)
+        return;
+    // a cycle that was running only frees what was dead when it started.
+    bool running = vm->gcPhase != GC_IDLE;
+    collect(true, false);
+    if (running && liveInUse() + size > vm->gcMaxHeap)
+        collect(true, false);
+    if (liveInUse() + size > vm->gcMaxHeap)
+        outOfMemory(size);
+}
 
 void *reallocate(void *pointer, size_t oldSize, size_t newSize)
 {
-    vm.bytesAllocated += newSize - oldSize;
+    if (newSize > oldSize)
+        makeRoom(newSize - oldSize);
+    countBytes(newSize - oldSize);
+    // only growing may collect, a free inside sweep() must not re-enter it.
     if (newSize > oldSize)
     {
+        vm->gcAllocatedTotal += newSize - oldSize;
+        checkYoung();
 #ifdef DEBUG_STRESS_GC
         collectGarbage();
 #endif
-    }
-    if (vm.bytesAllocated > vm.nextGC)
-    {
-        collectGarbage();
+        if (vm->bytesAllocated > vm->nextGC)
+        {
+            collectGarbage();
+        }
     }
 
     if (newSize == 0)
@@ -30,33 +154,398 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize)
     }
     void *result = realloc(pointer, newSize);
     if (result == NULL)
-        exit(1);
+    {
+        countBytes(oldSize - newSize);
+        collect(true, false);
+        result = realloc(pointer, newSize);
+        if (result == NULL)
+        {
+            outOfMemory(newSize - oldSize);
+            return NULL;
+        }
+        countBytes(newSize - oldSize);
+    }
     return result;
 }
 
+// the collector's own arrays count towards the heap limit too, but they
+// grow while it runs, on any of its threads, so they never collect or
+// raise an error. when one can't grow, its user falls back on something
+// slower that needs no memory.
+static bool growGCArray(Object ***array, int *capacity, int newCapacity)
+{
+    Object **grown = realloc(*array, sizeof(Object *) * (size_t)newCapacity);
+    if (grown == NULL)
+        return false;
+    __atomic_fetch_add(&vm->gcMetadata, sizeof(Object *) * (size_t)(newCapacity - *capacity),
+                       __ATOMIC_RELAXED);
+    *array = grown;
+    *capacity = newCapacity;
+    return true;
+}
+
+static void freeGCArray(Object **array, int capacity)
+{
+    __atomic_fetch_sub(&vm->gcMetadata, sizeof(Object *) * (size_t)capacity, __ATOMIC_RELAXED);
+    free(array);
+}
+
+// a byte count with an optional K, M or G suffix and nothing after it.
+static bool parseSize(const char *text, size_t *size)
+{
+    char *end;
+    double bytes = strtod(text, &end);
+    if (end == text || !(bytes >= 0))
+        return false;
+    switch (*end)
+    {
+    case 'g':
+    case 'G':
+        bytes *= 1024;
+        // fall through
+    case 'm':
+    case 'M':
+        bytes *= 1024;
+        // fall through
+    case 'k':
+    case 'K':
+        bytes *= 1024;
+        end++;
+    }
+    if (*end != '\0' || bytes >= (double)SIZE_MAX)
+        return false;
+    *size = (size_t)bytes;
+    return true;
+}
+
+// in the order the environment is read, a pause given along with
+// concurrent is kept.
+static const char *const gcOptions[] = {
+    "growth", "utilization", "min-heap", "max-heap",
+    "hugepages", "pause", "compact", "concurrent"};
+
+static bool isOn(const char *value)
+{
+    return strcmp(value, "0") != 0 && strcmp(value, "off") != 0 && strcmp(value, "false") != 0;
+}
+
+bool setGCOption(const char *name, const char *value)
+{
+    char *end;
+    if (strcmp(name, "growth") == 0)
+    {
+        double growth = strtod(value, &end);
+        if (*end != '\0' || !(growth > 1))
+            return false;
+        vm->gcGrowth = growth;
+    }
+    else if (strcmp(name, "utilization") == 0)
+    {
+        // a target utilization u is a growth factor of 1 / u.
+        double utilization = strtod(value, &end);
+        if (*end != '\0' || !(utilization > 0 && utilization < 1))
+            return false;
+        vm->gcGrowth = 1 / utilization;
+    }
+    else if (strcmp(name, "min-heap") == 0)
+    {
+        size_t size;
+        if (!parseSize(value, &size) || size == 0)
+            return false;
+        vm->gcMinHeap = size;
+        if (vm->gcCycles == 0)
+            vm->nextGC = size;
+    }
+    else if (strcmp(name, "max-heap") == 0)
+    {
+        // no limit is spelled 0, a size that rounds down to it is a mistake.
+        size_t size;
+        if (!parseSize(value, &size) || (size == 0 && strcmp(value, "0") != 0))
+            return false;
+        vm->gcMaxHeap = size;
+    }
+    else if (strcmp(name, "hugepages") == 0)
+    {
+        vm->heap.hugePages = isOn(value);
+    }
+    else if (strcmp(name, "pause") == 0)
+    {
+        long budget = strtol(value, &end, 10);
+        if (*end != '\0' || budget < 0)
+            return false;
+        vm->gcPauseBudget = budget;
+    }
+    else if (strcmp(name, "compact") == 0)
+    {
+        vm->gcCompact = isOn(value);
+    }
+    else if (strcmp(name, "concurrent") == 0)
+    {
+        vm->gcConcurrent = isOn(value);
+        if (vm->gcConcurrent && vm->gcPauseBudget <= 0)
+            vm->gcPauseBudget = GC_CONCURRENT_PAUSE;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// sweeper threads free objects into the isolate's accounting.
+static void enterSweeper(void *isolate)
+{
+    vm = isolate;
+}
+
+void initHeap()
+{
+    initPages(&vm->heap, freeObject);
+    vm->heap.enter = enterSweeper;
+    vm->heap.owner = vm;
+    vm->nurseryStart = mapRegion(&vm->heap, GC_NURSERY_SIZE);
+    vm->nurseryTop = vm->nurseryStart;
+    vm->nurseryEnd = vm->nurseryStart + GC_NURSERY_SIZE;
+    vm->youngRequested = false;
+    vm->globalsRemembered = false;
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
+    vm->remembered = NULL;
+    vm->promotedCount = 0;
+    vm->promotedCapacity = 0;
+    vm->promoted = NULL;
+    vm->rememberedOverflow = false;
+    vm->promotedOverflow = false;
+    vm->youngAllocated = 0;
+    vm->youngBase = 0;
+    vm->gcPhase = GC_IDLE;
+    vm->gcCycles = 0;
+    vm->gcMinorCycles = 0;
+    vm->gcPauses = 0;
+    vm->gcMaxPause = 0;
+    vm->gcPauseTotal = 0;
+    memset(vm->gcPauseCounts, 0, sizeof(vm->gcPauseCounts));
+    vm->gcAllocatedTotal = 0;
+    vm->gcMetadata = 0;
+    vm->gcStartTime = gcClock();
+    vm->compactRequested = false;
+    vm->gcCompactions = 0;
+
+    vm->gcGrowth = GC_HEAP_GROW_FACTOR;
+    vm->gcMinHeap = GC_MIN_HEAP;
+    vm->gcMaxHeap = 0;
+    vm->heap.hugePages = false;
+    vm->gcPauseBudget = 0;
+    vm->gcCompact = false;
+    vm->gcConcurrent = false;
+    // MEON_GC_MIN_HEAP is min-heap and so on.
+    vm->gcBadEnv[0] = '\0';
+    for (int i = 0; i < (int)(sizeof(gcOptions) / sizeof(gcOptions[0])); i++)
+    {
+        char name[32] = "MEON_GC_";
+        for (int j = 0; gcOptions[i][j] != '\0'; j++)
+        {
+            char c = gcOptions[i][j];
+            name[8 + j] = c == '-' ? '_' : (char)(c - 'a' + 'A');
+        }
+        const char *value = getenv(name);
+        if (value != NULL && !setGCOption(gcOptions[i], value) && vm->gcBadEnv[0] == '\0')
+            strcpy(vm->gcBadEnv, name);
+    }
+
+    vm->markerRunning = false;
+    pthread_mutex_init(&vm->gcMutex, NULL);
+    pthread_cond_init(&vm->gcCond, NULL);
+    vm->satbCount = 0;
+    vm->satbCapacity = 0;
+    vm->satb = NULL;
+    vm->satbQueueCount = 0;
+    vm->satbQueueCapacity = 0;
+    vm->satbQueue = NULL;
+}
+
+// an object that doesn't fit in the set keeps only its flag, and the heap
+// is searched for those.
+void rememberObject(Object *object)
+{
+    object->isRemembered = true;
+    if (vm->rememberedCapacity < vm->rememberedCount + 1 &&
+        !growGCArray(&vm->remembered, &vm->rememberedCapacity, GROW_ARRAY_SIZE(vm->rememberedCapacity)))
+    {
+        vm->rememberedOverflow = true;
+        return;
+    }
+    vm->remembered[vm->rememberedCount++] = object;
+}
+
+// new objects are bump allocated in the nursery. once it's full they go
+// straight to the old generation until a safepoint empties it, and such
+// objects start out remembered since their fields may point anywhere.
+// between the start of marking and the sweep, anything new in the old
+// generation is black so that it won't be taken for garbage. once the
+// sweep starts it only goes on pages that were already swept.
+static inline void allocateOld(Object *object)
+{
+    object->isMarked = false;
+    object->isRemembered = false;
+    if (vm->gcPhase == GC_MARKING || vm->gcPhase == GC_CLEARING)
+    {
+        heapSet(object, PAGE_MARKED);
+        heapSet(object, PAGE_CLAIMED);
+        heapSet(object, PAGE_SCANNED);
+    }
+}
+
+Object *allocateObject(size_t size, object_t t)
+{
+#ifdef DEBUG_STRESS_GC
+    collectGarbage();
+    vm->youngRequested = true;
+#endif
+    size_t aligned = GC_ALIGN(size);
+    makeRoom(aligned);
+    vm->bytesAllocated += aligned;
+    vm->gcAllocatedTotal += aligned;
+    checkYoung();
+    if (vm->bytesAllocated > vm->nextGC)
+        collectGarbage();
+
+    Object *object;
+    if (aligned <= (size_t)(vm->nurseryEnd - vm->nurseryTop))
+    {
+        object = (Object *)vm->nurseryTop;
+        vm->nurseryTop += aligned;
+        object->isRemembered = false;
+        object->isMarked = false;
+    }
+    else
+    {
+        vm->youngRequested = true;
+        object = heapAllocate(&vm->heap, size);
+        allocateOld(object);
+        rememberObject(object);
+    }
+    object->t = t;
+
+#ifdef DEBUG_LOG_GC
+    printf("%p allocate %ld for %d\n", (void *)object, size, t);
+#endif
+    return object;
+}
+
+size_t objectSize(Object *object)
+{
+    switch (object->t)
+    {
+    case OBJECT_STRING:
+        return sizeof(ObjectString);
+    case OBJECT_FUNCTION:
+        return sizeof(ObjectFunction);
+    case OBJECT_NATIVE:
+        return sizeof(ObjectNative);
+    case OBJECT_CLOSURE:
+        return sizeof(ObjectClosure);
+    case OBJECT_UPVALUE:
+        return sizeof(ObjectUpvalue);
+    case OBJECT_SOURCE:
+        return sizeof(ObjectSource);
+    case OBJECT_MAP:
+        return sizeof(ObjectMap);
+    case OBJECT_ARRAY:
+        return sizeof(ObjectArray);
+    case OBJECT_TYPED_ARRAY:
+        return sizeof(ObjectTypedArray);
+    case OBJECT_SHAPE:
+        return sizeof(ObjectShape);
+    case OBJECT_RECORD:
+        return sizeof(ObjectRecord);
+    case OBJECT_VECTOR_NODE:
+        return sizeof(ObjectVectorNode);
+    case OBJECT_PVECTOR:
+        return sizeof(ObjectPVector);
+    case OBJECT_HAMT_NODE:
+        return sizeof(ObjectHamtNode) + sizeof(Value) * 2 * ((ObjectHamtNode *)object)->size;
+    case OBJECT_PMAP:
+        return sizeof(ObjectPMap);
+    case OBJECT_SEQ:
+        return sizeof(ObjectSeq);
+    case OBJECT_SEQ_ITER:
+        return sizeof(ObjectSeqIter);
+    }
+    return 0;
+}
+
+// one thread of a parallel mark. the owner pushes and pops its stack
+// without locking, others only take from shared, under lock.
+typedef struct Marker
+{
+    int count;
+    int capacity;
+    Object **stack;
+    pthread_mutex_t lock;
+    int sharedCount;
+    int sharedCapacity;
+    Object **shared;
+    struct MarkGroup *group;
+} Marker;
+
+typedef struct MarkGroup
+{
+    Marker markers[GC_MARK_THREADS_MAX];
+    int count;
+    int idle;
+    // the helper threads take it on, it's the one being collected.
+    VM *isolate;
+} MarkGroup;
+
+// set on each thread of a parallel mark, gray objects go to the vm
+// otherwise.
+static __thread Marker *currentMarker;
+
+// everything on a gray stack is marked already. one that's dropped for
+// lack of room is found again when marking finishes.
+static void pushObject(Object ***stack, int *count, int *capacity, Object *object)
+{
+    if (*capacity < *count + 1 && !growGCArray(stack, capacity, GROW_ARRAY_SIZE(*capacity)))
+    {
+        __atomic_store_n(&vm->grayOverflow, true, __ATOMIC_RELAXED);
+        return;
+    }
+
+    (*stack)[(*count)++] = object;
+}
+
+static void pushGray(Object *object)
+{
+    Marker *marker = currentMarker;
+    if (marker != NULL)
+        pushObject(&marker->stack, &marker->count, &marker->capacity, object);
+    else
+        pushObject(&vm->grayStack, &vm->grayCount, &vm->grayCapacity, object);
+}
+
 void markObject(Object *object)
 {
     if (object == NULL)
         return;
-    if (object->isMarked)
+    // young objects are only traced in the final pause, until then their
+    // mark bit is the minor collector's forwarding flag.
+    if (IN_NURSERY(object))
+    {
+        if (vm->gcPhase != GC_REMARK || object->isMarked ||
+            __atomic_exchange_n(&object->isMarked, true, __ATOMIC_ACQ_REL))
+            return;
+    }
+    else if (!heapMark(object))
+    {
         return;
+    }
 #ifdef DEBUG_LOG_GC
     printf("%p mark ", (void *)object);
     printValue(OBJ_VAL(object));
     printf("\n");
 #endif
-    object->isMarked = true;
-    if (vm.grayCapacity < vm.grayCount + 1)
-    {
-        vm.grayCapacity = GROW_ARRAY_SIZE(vm.grayCapacity);
-        vm.grayStack = realloc(vm.grayStack,
-                               sizeof(Object *) * vm.grayCapacity);
-
-        if (vm.grayStack == NULL)
-            exit(1);
-    }
-
-    vm.grayStack[vm.grayCount++] = object;
+    pushGray(object);
 }
 
 void markValue(Value value)
@@ -68,7 +557,7 @@ void markValue(Value value)
 
 static void markArray(ValueArr *array)
 {
-    for (int i = 0; i < array->maxSize; i++)
+    for (int i = 0; i < array->size; i++)
     {
         markValue(array->values[i]);
     }
@@ -86,156 +575,1312 @@ static void blackenObject(Object *object)
     case OBJECT_CLOSURE:
     {
         ObjectClosure *closure = (ObjectClosure *)object;
-        markObject((Object *)closure->function);
+        markObject((Object *)DEREF(ObjectFunction, closure->function));
         for (int i = 0; i < closure->upvalueCount; i++)
         {
-            markObject((Object *)closure->upvalues[i]);
+            markObject((Object *)DEREF(ObjectUpvalue, closure->upvalues[i]));
         }
         break;
     }
     case OBJECT_FUNCTION:
     {
         ObjectFunction *function = (ObjectFunction *)object;
-        markObject((Object *)function->name);
+        markObject((Object *)DEREF(ObjectString, function->name));
         markArray(&function->chunk.constants);
+        for (int i = 0; i < function->chunk.cacheSize; i++)
+        {
+            // a dead shape's address could be reused, keep cached ones alive.
+            markObject((Object *)function->chunk.caches[i].shape);
+            markObject((Object *)function->chunk.caches[i].transition);
+        }
         break;
     }
     case OBJECT_UPVALUE:
         markValue(((ObjectUpvalue *)object)->closed);
         break;
-    case OBJECT_NATIVE:
     case OBJECT_STRING:
+        // borrowed chars live inside the source, keep it mapped.
+        markObject((Object *)((ObjectString *)object)->owner);
+        break;
+    case OBJECT_MAP:
+        markMap((ObjectMap *)object);
+        break;
+    case OBJECT_ARRAY:
+        markArray(&((ObjectArray *)object)->items);
+        break;
+    case OBJECT_SHAPE:
+    {
+        ObjectShape *shape = (ObjectShape *)object;
+        markObject((Object *)shape->parent);
+        markObject((Object *)shape->name);
+        markTable(&shape->transitions);
         break;
     }
-}
-
-static void freeObject(Object *object)
-{
-#ifdef DEBUG_LOG_GC
-    printf("%p free type %d\n", (void *)object, object->t);
-#endif
-    switch (object->t)
+    case OBJECT_RECORD:
     {
-    case OBJECT_STRING:
+        ObjectRecord *record = (ObjectRecord *)object;
+        ObjectShape *shape = DEREF(ObjectShape, record->shape);
+        markObject((Object *)shape);
+        for (int i = 0; i < shape->slotCount; i++)
+        {
+            markValue(record->fields[i]);
+        }
+        break;
+    }
+    case OBJECT_VECTOR_NODE:
     {
-        ObjectString *string = (ObjectString *)object;
-        FREE_ARRAY(char, string->chars, string->length + 1);
-        FREE(ObjectString, object);
+        ObjectVectorNode *node = (ObjectVectorNode *)object;
+        for (int i = 0; i < PERSISTENT_WIDTH; i++)
+        {
+            markValue(node->slots[i]);
+        }
         break;
     }
-    case OBJECT_FUNCTION:
+    case OBJECT_PVECTOR:
+        markObject((Object *)((ObjectPVector *)object)->root);
+        markObject((Object *)((ObjectPVector *)object)->tail);
+        break;
+    case OBJECT_HAMT_NODE:
     {
-        ObjectFunction *function = (ObjectFunction *)object;
-        freeChunk(&function->chunk);
-        FREE(ObjectFunction, object);
+        ObjectHamtNode *node = (ObjectHamtNode *)object;
+        for (int i = 0; i < 2 * node->size; i++)
+        {
+            markValue(node->entries[i]);
+        }
         break;
     }
+    case OBJECT_PMAP:
+        markObject((Object *)((ObjectPMap *)object)->root);
+        break;
+    case OBJECT_SEQ:
+        markObject((Object *)((ObjectSeq *)object)->parent);
+        markValue(((ObjectSeq *)object)->value);
+        break;
+    case OBJECT_SEQ_ITER:
+        // its stages all hang off seq.
+        markObject((Object *)((ObjectSeqIter *)object)->seq);
+        break;
     case OBJECT_NATIVE:
-        FREE(ObjectNative, object);
+    case OBJECT_SOURCE:
+    case OBJECT_TYPED_ARRAY:
         break;
+    }
+}
+
+static void visitValue(Value *value, ObjectVisitor visit)
+{
+    if (IS_OBJ(*value))
+        value->as.object = visit(AS_OBJ(*value));
+}
+
+#define VISIT(field) ((field) = (void *)visit((Object *)(field)))
+#define VISIT_REF(type, field) ((field) = REF((type *)visit((Object *)DEREF(type, field))))
+
+// like blackenObject(), but every reference is replaced with whatever
+// visit returns, so a moving collector can update fields in place.
+static void visitReferences(Object *object, ObjectVisitor visit)
+{
+    switch (object->t)
+    {
     case OBJECT_CLOSURE:
     {
         ObjectClosure *closure = (ObjectClosure *)object;
-        FREE_ARRAY(ObjectUpvalue *, closure->upvalues, closure->upvalueCount);
-        FREE(ObjectClosure, object);
+        VISIT_REF(ObjectFunction, closure->function);
+        for (int i = 0; i < closure->upvalueCount; i++)
+        {
+            VISIT_REF(ObjectUpvalue, closure->upvalues[i]);
+        }
+        break;
+    }
+    case OBJECT_FUNCTION:
+    {
+        ObjectFunction *function = (ObjectFunction *)object;
+        VISIT_REF(ObjectString, function->name);
+        for (int i = 0; i < function->chunk.constants.size; i++)
+        {
+            visitValue(&function->chunk.constants.values[i], visit);
+        }
+        for (int i = 0; i < function->chunk.cacheSize; i++)
+        {
+            VISIT(function->chunk.caches[i].shape);
+            VISIT(function->chunk.caches[i].transition);
+        }
         break;
     }
     case OBJECT_UPVALUE:
-        FREE(ObjectUpvalue, object);
+        // next only means something while open, the root walk updates it.
+        visitValue(&((ObjectUpvalue *)object)->closed, visit);
+        break;
+    case OBJECT_STRING:
+        VISIT(((ObjectString *)object)->owner);
+        break;
+    case OBJECT_MAP:
+    {
+        ObjectMap *map = (ObjectMap *)object;
+        for (int i = 0; i < map->entryCount; i++)
+        {
+            visitValue(&map->entries[i].key, visit);
+            visitValue(&map->entries[i].value, visit);
+        }
         break;
     }
-}
-
-static void markRoots()
-{
-    for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
+    case OBJECT_ARRAY:
     {
-        markValue(*slot);
+        ValueArr *items = &((ObjectArray *)object)->items;
+        for (int i = 0; i < items->size; i++)
+        {
+            visitValue(&items->values[i], visit);
+        }
+        break;
     }
-    for (int i = 0; i < vm.frameCount; i++)
+    case OBJECT_SHAPE:
     {
-        markObject((Object *)vm.frames[i].closure);
+        ObjectShape *shape = (ObjectShape *)object;
+        VISIT(shape->parent);
+        VISIT(shape->name);
+        tableVisit(&shape->transitions, visit);
+        break;
     }
-    for (ObjectUpvalue *upvalue = vm.openUpvalues;
-         upvalue != NULL;
-         upvalue = upvalue->next)
+    case OBJECT_RECORD:
     {
-        markObject((Object *)upvalue);
+        ObjectRecord *record = (ObjectRecord *)object;
+        VISIT_REF(ObjectShape, record->shape);
+        for (int i = 0; i < DEREF(ObjectShape, record->shape)->slotCount; i++)
+        {
+            visitValue(&record->fields[i], visit);
+        }
+        break;
     }
-
-    markTable(&vm.globals);
-    markCompilerRoots();
-}
-
-static void traceReferences()
-{
-    while (vm.grayCount > 0)
+    case OBJECT_VECTOR_NODE:
     {
-        Object *object = vm.grayStack[--vm.grayCount];
-        blackenObject(object);
+        ObjectVectorNode *node = (ObjectVectorNode *)object;
+        for (int i = 0; i < PERSISTENT_WIDTH; i++)
+        {
+            visitValue(&node->slots[i], visit);
+        }
+        break;
     }
-}
-
-static void sweep()
-{
-    Object *previous = NULL;
-    Object *object = vm.objects;
-    while (object != NULL)
+    case OBJECT_PVECTOR:
+        VISIT(((ObjectPVector *)object)->root);
+        VISIT(((ObjectPVector *)object)->tail);
+        break;
+    case OBJECT_HAMT_NODE:
     {
-        if (object->isMarked)
+        ObjectHamtNode *node = (ObjectHamtNode *)object;
+        for (int i = 0; i < 2 * node->size; i++)
         {
-            object->isMarked = false;
-            previous = object;
-            object = object->next;
+            visitValue(&node->entries[i], visit);
         }
-        else
+        break;
+    }
+    case OBJECT_PMAP:
+        VISIT(((ObjectPMap *)object)->root);
+        break;
+    case OBJECT_SEQ:
+        VISIT(((ObjectSeq *)object)->parent);
+        visitValue(&((ObjectSeq *)object)->value, visit);
+        break;
+    case OBJECT_SEQ_ITER:
+    {
+        ObjectSeqIter *iter = (ObjectSeqIter *)object;
+        VISIT(iter->seq);
+        for (int i = 0; i < iter->stageCount; i++)
         {
-            Object *unreached = object;
-            object = object->next;
-            if (previous != NULL)
-            {
-                previous->next = object;
-            }
-            else
-            {
-                vm.objects = object;
-            }
-
-            freeObject(unreached);
+            VISIT(iter->stages[i]);
         }
+        break;
+    }
+    case OBJECT_NATIVE:
+    case OBJECT_SOURCE:
+    case OBJECT_TYPED_ARRAY:
+        break;
     }
 }
 
-void collectGarbage()
+#undef VISIT
+
+// frees what an object owns outside of itself, not the object.
+static void releaseObject(Object *object)
 {
 #ifdef DEBUG_LOG_GC
-    printf("-- gc begin\n");
-    size_t before = vm.bytesAllocated;
+    printf("%p free type %d\n", (void *)object, object->t);
+#endif
+    switch (object->t)
+    {
+    case OBJECT_STRING:
+    {
+        ObjectString *string = (ObjectString *)object;
+        if (string->owner == NULL)
+            FREE_ARRAY(char, (char *)string->chars, string->length + 1);
+        break;
+    }
+    case OBJECT_FUNCTION:
+        freeChunk(&((ObjectFunction *)object)->chunk);
+        break;
+    case OBJECT_CLOSURE:
+    {
+        ObjectClosure *closure = (ObjectClosure *)object;
+        FREE_ARRAY(OBJ_REF(ObjectUpvalue), closure->upvalues, closure->upvalueCount);
+        break;
+    }
+    case OBJECT_SOURCE:
+    {
+        ObjectSource *source = (ObjectSource *)object;
+        if (source->isMapped)
+            munmap((void *)source->bytes, source->length);
+        else
+            FREE_ARRAY(char, (char *)source->bytes, source->length + 1);
+        break;
+    }
+    case OBJECT_MAP:
+        freeMap((ObjectMap *)object);
+        break;
+    case OBJECT_ARRAY:
+        freeValueArr(&((ObjectArray *)object)->items);
+        break;
+    case OBJECT_TYPED_ARRAY:
+    {
+        ObjectTypedArray *array = (ObjectTypedArray *)object;
+        if (array->kind == TYPED_FLOAT64)
+            FREE_ARRAY(double, array->as.f64, array->length);
+        else
+            FREE_ARRAY(int64_t, array->as.i64, array->length);
+        break;
+    }
+    case OBJECT_SHAPE:
+        freeTable(&((ObjectShape *)object)->transitions);
+        break;
+    case OBJECT_RECORD:
+    {
+        ObjectRecord *record = (ObjectRecord *)object;
+        FREE_ARRAY(Value, record->fields, record->capacity);
+        break;
+    }
+    case OBJECT_SEQ_ITER:
+    {
+        ObjectSeqIter *iter = (ObjectSeqIter *)object;
+        FREE_ARRAY(ObjectSeq *, iter->stages, iter->stageCount);
+        FREE_ARRAY(int, iter->taken, iter->stageCount);
+        break;
+    }
+    case OBJECT_NATIVE:
+    case OBJECT_UPVALUE:
+    case OBJECT_VECTOR_NODE:
+    case OBJECT_PVECTOR:
+    case OBJECT_HAMT_NODE:
+    case OBJECT_PMAP:
+    case OBJECT_SEQ:
+        break;
+    }
+}
+
+// what releaseObject() gives back, the memory an object owns outside its
+// cell.
+static size_t ownedSize(Object *object)
+{
+    switch (object->t)
+    {
+    case OBJECT_STRING:
+    {
+        ObjectString *string = (ObjectString *)object;
+        return string->owner == NULL ? (size_t)string->length + 1 : 0;
+    }
+    case OBJECT_FUNCTION:
+    {
+        Chunk *chunk = &((ObjectFunction *)object)->chunk;
+        return (size_t)chunk->maxSize + sizeof(LineStart) * (size_t)chunk->lineMaxSize +
+               sizeof(InlineCache) * (size_t)chunk->cacheMaxSize +
+               sizeof(Value) * (size_t)chunk->constants.maxSize;
+    }
+    case OBJECT_CLOSURE:
+        return sizeof(OBJ_REF(ObjectUpvalue)) * (size_t)((ObjectClosure *)object)->upvalueCount;
+    case OBJECT_SOURCE:
+    {
+        ObjectSource *source = (ObjectSource *)object;
+        return source->isMapped ? 0 : (size_t)source->length + 1;
+    }
+    case OBJECT_MAP:
+    {
+        ObjectMap *map = (ObjectMap *)object;
+        return sizeof(MapEntry) * (size_t)map->entryCapacity + sizeof(MapSlot) * (size_t)map->slotCapacity;
+    }
+    case OBJECT_ARRAY:
+        return sizeof(Value) * (size_t)((ObjectArray *)object)->items.maxSize;
+    case OBJECT_TYPED_ARRAY:
+        return sizeof(double) * (size_t)((ObjectTypedArray *)object)->length;
+    case OBJECT_SHAPE:
+        return (sizeof(uint8_t) + sizeof(TableItem)) * (size_t)((ObjectShape *)object)->transitions.maxSize;
+    case OBJECT_RECORD:
+        return sizeof(Value) * (size_t)((ObjectRecord *)object)->capacity;
+    case OBJECT_SEQ_ITER:
+        return (sizeof(ObjectSeq *) + sizeof(int)) * (size_t)((ObjectSeqIter *)object)->stageCount;
+    case OBJECT_NATIVE:
+    case OBJECT_UPVALUE:
+    case OBJECT_VECTOR_NODE:
+    case OBJECT_PVECTOR:
+    case OBJECT_HAMT_NODE:
+    case OBJECT_PMAP:
+    case OBJECT_SEQ:
+        break;
+    }
+    return 0;
+}
+
+// old objects only, nursery space comes back all at once and the cell
+// goes back to its page.
+static void freeObject(Object *object)
+{
+    countBytes(0 - objectSize(object));
+    releaseObject(object);
+}
+
+static void markRoots()
+{
+    markObject((Object *)vm->rootShape);
+    for (Value *slot = vm->stack; slot < vm->stackTop; slot++)
+    {
+        markValue(*slot);
+    }
+    for (int i = 0; i < vm->frameCount; i++)
+    {
+        markObject((Object *)vm->frames[i].closure);
+    }
+    for (ObjectUpvalue *upvalue = vm->openUpvalues;
+         upvalue != NULL;
+         upvalue = upvalue->next)
+    {
+        markObject((Object *)upvalue);
+    }
+
+    markTable(&vm->globals);
+    for (int i = 0; i < vm->handles.size; i++)
+    {
+        markValue(vm->handles.values[i]);
+    }
+    markCompilerRoots();
+}
+
+double gcClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void recordPause(double start)
+{
+    double pause = gcClock() - start;
+    vm->gcPauses++;
+    vm->gcPauseTotal += pause;
+    vm->gcPauseCounts[pauseBucket(pause)]++;
+    if (pause > vm->gcMaxPause)
+        vm->gcMaxPause = pause;
+}
+
+// a deadline of 0 means no limit.
+static inline bool sliceOver(double deadline, int *work)
+{
+    return deadline > 0 && ++*work % GC_CLOCK_STRIDE == 0 && gcClock() > deadline;
+}
+
+// the older half of the stack goes where idle markers can take it. only
+// the owner ever adds to shared, so it's empty here.
+static void shareWork(Marker *marker)
+{
+    int half = marker->count / 2;
+    pthread_mutex_lock(&marker->lock);
+    if (marker->sharedCapacity < half)
+    {
+        int capacity = marker->sharedCapacity;
+        while (capacity < half)
+            capacity = GROW_ARRAY_SIZE(capacity);
+        // without room to share, the owner keeps it all.
+        if (!growGCArray(&marker->shared, &marker->sharedCapacity, capacity))
+        {
+            pthread_mutex_unlock(&marker->lock);
+            return;
+        }
+    }
+    memcpy(marker->shared, marker->stack, sizeof(Object *) * half);
+    __atomic_store_n(&marker->sharedCount, half, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&marker->lock);
+
+    marker->count -= half;
+    memmove(marker->stack, marker->stack + half, sizeof(Object *) * marker->count);
+}
+
+// a thief takes half of what's shared, the owner takes it all back.
+static bool takeWork(Marker *thief, Marker *victim)
+{
+    if (__atomic_load_n(&victim->sharedCount, __ATOMIC_ACQUIRE) == 0)
+        return false;
+    pthread_mutex_lock(&victim->lock);
+    int taken = thief == victim ? victim->sharedCount : (victim->sharedCount + 1) / 2;
+    int left = victim->sharedCount - taken;
+    for (int i = left; i < victim->sharedCount; i++)
+    {
+        pushObject(&thief->stack, &thief->count, &thief->capacity, victim->shared[i]);
+    }
+    __atomic_store_n(&victim->sharedCount, left, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&victim->lock);
+    return taken > 0;
+}
+
+static bool stealWork(Marker *marker)
+{
+    MarkGroup *group = marker->group;
+    int self = (int)(marker - group->markers);
+    for (int i = 0; i < group->count; i++)
+    {
+        if (takeWork(marker, &group->markers[(self + i) % group->count]))
+            return true;
+    }
+    return false;
+}
+
+static bool workShared(MarkGroup *group)
+{
+    for (int i = 0; i < group->count; i++)
+    {
+        if (__atomic_load_n(&group->markers[i].sharedCount, __ATOMIC_ACQUIRE) > 0)
+            return true;
+    }
+    return false;
+}
+
+// a marker that ran dry only holds nothing and shares nothing, so once
+// all of them are idle marking is over.
+static void *markWorker(void *arg)
+{
+    Marker *marker = arg;
+    MarkGroup *group = marker->group;
+    vm = group->isolate;
+    currentMarker = marker;
+    for (;;)
+    {
+        while (marker->count > 0)
+        {
+            blackenObject(marker->stack[--marker->count]);
+            if (marker->count > GC_MARK_SHARE &&
+                __atomic_load_n(&marker->sharedCount, __ATOMIC_RELAXED) == 0)
+                shareWork(marker);
+        }
+        if (stealWork(marker))
+            continue;
+
+        __atomic_add_fetch(&group->idle, 1, __ATOMIC_ACQ_REL);
+        for (;;)
+        {
+            if (__atomic_load_n(&group->idle, __ATOMIC_ACQUIRE) == group->count)
+            {
+                currentMarker = NULL;
+                return NULL;
+            }
+            if (workShared(group))
+            {
+                __atomic_sub_fetch(&group->idle, 1, __ATOMIC_ACQ_REL);
+                if (stealWork(marker))
+                    break;
+                __atomic_add_fetch(&group->idle, 1, __ATOMIC_ACQ_REL);
+            }
+            sched_yield();
+        }
+    }
+}
+
+static int markThreads()
+{
+#ifdef MARK_NO_THREADS
+    return 1;
+#else
+    if (vm->bytesAllocated < GC_MARK_PARALLEL_MIN)
+        return 1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = 1;
+    while (threads < cpus && threads < GC_MARK_THREADS_MAX)
+        threads++;
+    return threads;
+#endif
+}
+
+// the gray stack becomes the first marker's, this thread runs it and the
+// others start out stealing. false if there was no memory to start.
+static bool traceParallel(int threads)
+{
+    MarkGroup *group = malloc(sizeof(MarkGroup));
+    if (group == NULL)
+        return false;
+    group->count = threads;
+    group->idle = 0;
+    group->isolate = vm;
+    for (int i = 0; i < threads; i++)
+    {
+        Marker *marker = &group->markers[i];
+        marker->count = 0;
+        marker->capacity = 0;
+        marker->stack = NULL;
+        pthread_mutex_init(&marker->lock, NULL);
+        marker->sharedCount = 0;
+        marker->sharedCapacity = 0;
+        marker->shared = NULL;
+        marker->group = group;
+    }
+    Marker *first = &group->markers[0];
+    first->count = vm->grayCount;
+    first->capacity = vm->grayCapacity;
+    first->stack = vm->grayStack;
+
+    pthread_t workers[GC_MARK_THREADS_MAX];
+    bool started[GC_MARK_THREADS_MAX];
+    for (int i = 1; i < threads; i++)
+    {
+        started[i] = pthread_create(&workers[i], NULL, markWorker, &group->markers[i]) == 0;
+        // one that didn't start has nothing, it's idle from the outset.
+        if (!started[i])
+            __atomic_add_fetch(&group->idle, 1, __ATOMIC_ACQ_REL);
+    }
+    markWorker(first);
+    for (int i = 1; i < threads; i++)
+    {
+        if (started[i])
+            pthread_join(workers[i], NULL);
+    }
+
+    vm->grayCount = 0;
+    vm->grayCapacity = first->capacity;
+    vm->grayStack = first->stack;
+    for (int i = 0; i < threads; i++)
+    {
+        Marker *marker = &group->markers[i];
+        if (i > 0)
+            freeGCArray(marker->stack, marker->capacity);
+        freeGCArray(marker->shared, marker->sharedCapacity);
+        pthread_mutex_destroy(&marker->lock);
+    }
+    free(group);
+    return true;
+}
+
+// true once the gray stack is empty, false if the slice ran out first.
+static bool traceReferences(double deadline)
+{
+    if (deadline == 0 && vm->grayCount > 0)
+    {
+        int threads = markThreads();
+        if (threads > 1 && traceParallel(threads))
+            return true;
+    }
+
+    int work = 0;
+    while (vm->grayCount > 0)
+    {
+        if (sliceOver(deadline, &work))
+            return false;
+        Object *object = vm->grayStack[--vm->grayCount];
+        blackenObject(object);
+    }
+    return true;
+}
+
+// whatever the allocator hasn't swept by now. without a deadline it's all
+// done at once, split across threads when there's a lot of it.
+static bool sweep(double deadline)
+{
+    if (deadline == 0)
+    {
+        sweepRest(&vm->heap);
+        return true;
+    }
+    while (sweepNext(&vm->heap))
+    {
+        if (gcClock() > deadline)
+            return vm->heap.unsweptCount == 0;
+    }
+    return true;
+}
+
+// what's left of a moved object, every object has room for a pointer past
+// its header.
+typedef struct
+{
+    Object obj;
+    Object *to;
+} ObjectForward;
+
+// the old copy is dead from here on, anything about it must be read first.
+static void leaveForward(Object *object, Object *copy)
+{
+    if (object->t == OBJECT_UPVALUE)
+    {
+        ObjectUpvalue *upvalue = (ObjectUpvalue *)object;
+        if (upvalue->location == &upvalue->closed)
+            ((ObjectUpvalue *)copy)->location = &((ObjectUpvalue *)copy)->closed;
+    }
+    object->isMarked = true;
+    ((ObjectForward *)object)->to = copy;
+}
+
+// objects whose references are still to be scanned. one that doesn't fit
+// is found again through its mark bit.
+static void pushPromoted(Object *object)
+{
+    if (vm->promotedCapacity < vm->promotedCount + 1 &&
+        !growGCArray(&vm->promoted, &vm->promotedCapacity, GROW_ARRAY_SIZE(vm->promotedCapacity)))
+        vm->promotedOverflow = true;
+    else
+        vm->promoted[vm->promotedCount++] = object;
+}
+
+// copies a young object into the old generation the first time it's
+// reached, and leaves a forwarding pointer behind.
+static Object *evacuate(Object *object)
+{
+    if (object == NULL)
+        return NULL;
+    if (!IN_NURSERY(object))
+    {
+        // while marking, survivors are black and can't point at white. the
+        // concurrent marker doesn't need this, it works off the snapshot.
+        if (vm->gcPhase == GC_MARKING && !vm->markerRunning)
+            markObject(object);
+        return object;
+    }
+    if (object->isMarked)
+        return ((ObjectForward *)object)->to;
+
+    size_t size = objectSize(object);
+    Object *copy = heapAllocate(&vm->heap, size);
+    memcpy(copy, object, size);
+    vm->bytesAllocated += size;
+    allocateOld(copy);
+    pushPromoted(copy);
+
+    if (object->t == OBJECT_STRING)
+        tableReplaceKey(&vm->strings, (ObjectString *)object, (ObjectString *)copy);
+    leaveForward(object, copy);
+    return copy;
+}
+
+// a moved old object keeps the same forwarding pointer as a young one,
+// an old object's own mark bit is otherwise unused.
+static Object *forward(Object *object)
+{
+    if (object != NULL && !IN_NURSERY(object) && object->isMarked)
+        return ((ObjectForward *)object)->to;
+    return object;
+}
+
+static void moveObject(Object *object)
+{
+    size_t size = objectSize(object);
+    Object *copy = heapAllocate(&vm->heap, size);
+    memcpy(copy, object, size);
+    leaveForward(object, copy);
+}
+
+static void updateObject(Object *object)
+{
+    visitReferences(object, forward);
+}
+
+// moves everything on sparse pages into the rest of the heap and gives
+// those pages back. it runs right after a minor collection and between
+// major ones, so there's nothing young, remembered or gray to update.
+static void compactHeap()
+{
+    double start = gcClock();
+    vm->compactRequested = false;
+    Page *sparse = takeSparsePages(&vm->heap);
+    for (Page *page = sparse; page != NULL; page = page->next)
+    {
+        visitLive(page, moveObject);
+    }
+
+    vm->rootShape = (ObjectShape *)forward((Object *)vm->rootShape);
+    for (Value *slot = vm->stack; slot < vm->stackTop; slot++)
+    {
+        visitValue(slot, forward);
+    }
+    for (int i = 0; i < vm->handles.size; i++)
+    {
+        visitValue(&vm->handles.values[i], forward);
+    }
+    for (int i = 0; i < vm->frameCount; i++)
+    {
+        vm->frames[i].closure = (ObjectClosure *)forward((Object *)vm->frames[i].closure);
+    }
+    for (ObjectUpvalue **upvalue = &vm->openUpvalues; *upvalue != NULL; upvalue = &(*upvalue)->next)
+    {
+        *upvalue = (ObjectUpvalue *)forward((Object *)*upvalue);
+    }
+    tableVisit(&vm->globals, forward);
+    // keys keep their hash, so they stay in the same slots.
+    tableVisit(&vm->strings, forward);
+    for (Page *page = vm->heap.pages; page != NULL; page = page->next)
+    {
+        visitLive(page, updateObject);
+    }
+
+    dropPages(&vm->heap, sparse);
+    releaseMemory(&vm->heap);
+    vm->gcCompactions++;
+    recordPause(start);
+}
+
+// where a minor collection starts from, besides the remembered set.
+static void visitYoungRoots(ObjectVisitor visit)
+{
+    vm->rootShape = (ObjectShape *)visit((Object *)vm->rootShape);
+    for (Value *slot = vm->stack; slot < vm->stackTop; slot++)
+    {
+        visitValue(slot, visit);
+    }
+    for (int i = 0; i < vm->handles.size; i++)
+    {
+        visitValue(&vm->handles.values[i], visit);
+    }
+    for (int i = 0; i < vm->frameCount; i++)
+    {
+        vm->frames[i].closure = (ObjectClosure *)visit((Object *)vm->frames[i].closure);
+    }
+    for (ObjectUpvalue **upvalue = &vm->openUpvalues; *upvalue != NULL; upvalue = &(*upvalue)->next)
+    {
+        *upvalue = (ObjectUpvalue *)visit((Object *)*upvalue);
+    }
+    if (vm->globalsRemembered)
+        tableVisit(&vm->globals, visit);
+}
+
+static void scanRemembered(Object *object)
+{
+    if (!object->isRemembered)
+        return;
+    object->isRemembered = false;
+    preWriteBarrier(object);
+    visitReferences(object, evacuate);
+}
+
+static void scanPromoted(ObjectVisitor visit)
+{
+    while (vm->promotedCount > 0)
+    {
+        visitReferences(vm->promoted[--vm->promotedCount], visit);
+    }
+}
+
+// a minor collection. it only runs at safepoints in the interpreter loop,
+// where no C code is holding a pointer into the nursery, because the
+// survivors move. it traces from the roots and the remembered set only.
+void collectYoung()
+{
+#ifdef DEBUG_LOG_GC
+    printf("-- minor gc begin\n");
+    size_t before = vm->bytesAllocated;
 #endif
+    double start = gcClock();
+    vm->youngRequested = false;
+
+    visitYoungRoots(evacuate);
+    for (int i = 0; i < vm->rememberedCount; i++)
+    {
+        scanRemembered(vm->remembered[i]);
+    }
+    if (vm->rememberedOverflow)
+    {
+        // once marking is over, what it didn't reach may point at freed
+        // objects, only marked ones are scanned then. copies go on the
+        // front of the page list, but a page swept for them would move
+        // under the walk, so the sweep is finished first.
+        vm->rememberedOverflow = false;
+        if (vm->gcPhase == GC_SWEEPING)
+            sweep(0);
+        visitHeap(&vm->heap, vm->gcPhase == GC_CLEARING, scanRemembered);
+    }
+    // scan copies until no new ones turn up. copies that didn't fit on the
+    // list are found through what they left in the nursery, every copy is
+    // scanned again until a pass leaves none out.
+    scanPromoted(evacuate);
+    while (vm->promotedOverflow)
+    {
+        vm->promotedOverflow = false;
+        for (uint8_t *cursor = vm->nurseryStart; cursor < vm->nurseryTop;)
+        {
+            Object *object = (Object *)cursor;
+            if (!object->isMarked)
+            {
+                cursor += GC_ALIGN(objectSize(object));
+                continue;
+            }
+            Object *copy = ((ObjectForward *)object)->to;
+            cursor += GC_ALIGN(objectSize(copy));
+            visitReferences(copy, evacuate);
+        }
+        scanPromoted(evacuate);
+    }
+
+    // whatever wasn't copied is dead, but may still own memory.
+    for (uint8_t *cursor = vm->nurseryStart; cursor < vm->nurseryTop;)
+    {
+        Object *object = (Object *)cursor;
+        if (object->isMarked)
+        {
+            cursor += GC_ALIGN(objectSize(((ObjectForward *)object)->to));
+            continue;
+        }
+        cursor += GC_ALIGN(objectSize(object));
+        if (object->t == OBJECT_STRING)
+            tableDelete(&vm->strings, (ObjectString *)object);
+        releaseObject(object);
+    }
+
+    vm->bytesAllocated -= vm->nurseryTop - vm->nurseryStart;
+    vm->youngAllocated += vm->nurseryTop - vm->nurseryStart;
+    vm->nurseryTop = vm->nurseryStart;
+    vm->youngBase = vm->bytesAllocated;
+    vm->gcMinorCycles++;
+    vm->rememberedCount = 0;
+    vm->globalsRemembered = false;
+    recordPause(start);
+
+    if (vm->compactRequested && vm->gcPhase == GC_IDLE)
+        compactHeap();
+
+#ifdef DEBUG_LOG_GC
+    printf("-- minor gc end\n");
+    printf("   collected %ld bytes (from %ld to %ld)\n",
+           before - vm->bytesAllocated, before, vm->bytesAllocated);
+#endif
+
+    // a heap that stopped growing is still collected once the nursery has
+    // been through as much as it holds, so what a peak left behind goes
+    // back.
+    size_t settled = vm->bytesAllocated > vm->gcMinHeap ? vm->bytesAllocated : vm->gcMinHeap;
+    if (vm->bytesAllocated > vm->nextGC || (vm->gcPhase == GC_IDLE && vm->youngAllocated > settled))
+        collect(false, true);
+}
+
+// the queue has room for one batch from the start. when it can't grow,
+// the mutator waits for the marker to take what's there.
+static void flushSatb()
+{
+    if (vm->satbCount == 0)
+        return;
+    pthread_mutex_lock(&vm->gcMutex);
+    if (vm->satbQueueCapacity < vm->satbQueueCount + vm->satbCount)
+    {
+        int capacity = vm->satbQueueCapacity;
+        while (capacity < vm->satbQueueCount + vm->satbCount)
+            capacity = GROW_ARRAY_SIZE(capacity);
+        if (!growGCArray(&vm->satbQueue, &vm->satbQueueCapacity, capacity))
+        {
+            while (vm->satbQueueCount > 0)
+                pthread_cond_wait(&vm->gcCond, &vm->gcMutex);
+        }
+    }
+    memcpy(vm->satbQueue + vm->satbQueueCount, vm->satb, sizeof(Object *) * vm->satbCount);
+    vm->satbQueueCount += vm->satbCount;
+    vm->satbCount = 0;
+    pthread_cond_signal(&vm->gcCond);
+    pthread_mutex_unlock(&vm->gcMutex);
+}
+
+// the mutator never marks while the marker runs, it only queues objects
+// for it. a stale mark bit just means a duplicate entry.
+static Object *shadeSnapshot(Object *object)
+{
+    if (object == NULL || IN_NURSERY(object) || heapIsMarked(object))
+        return object;
+    vm->satb[vm->satbCount++] = object;
+    if (vm->satbCount >= GC_SATB_FLUSH)
+        flushSatb();
+    return object;
+}
+
+// for an old object the mutator got hold of without a root or a barrier
+// seeing it, like a string out of the intern table.
+void keepAlive(Object *object)
+{
+    if (vm->gcPhase != GC_MARKING || IN_NURSERY(object) || heapIsMarked(object))
+        return;
+    if (vm->markerRunning)
+        shadeSnapshot(object);
+    else
+        markObject(object);
+}
+
+// whoever claims an object scans it, the other side never touches it
+// again this cycle.
+static bool claimScan(Object *object)
+{
+    return heapSet(object, PAGE_CLAIMED);
+}
+
+void scanBeforeWrite(Object *object)
+{
+    if (claimScan(object))
+    {
+        visitReferences(object, shadeSnapshot);
+        heapSet(object, PAGE_SCANNED);
+        return;
+    }
+    // the marker has it, which takes no longer than one object.
+    while (!heapTest(object, PAGE_SCANNED))
+        ;
+}
+
+static void *markerMain(void *isolate)
+{
+    vm = isolate;
+    for (;;)
+    {
+        int work = 0;
+        while (vm->grayCount > 0)
+        {
+            if (++work % GC_CLOCK_STRIDE == 0 && __atomic_load_n(&vm->markerStop, __ATOMIC_ACQUIRE))
+                return NULL;
+            Object *object = vm->grayStack[--vm->grayCount];
+            if (claimScan(object))
+            {
+                blackenObject(object);
+                heapSet(object, PAGE_SCANNED);
+            }
+        }
+
+        pthread_mutex_lock(&vm->gcMutex);
+        while (vm->satbQueueCount == 0 && !vm->markerStop)
+        {
+            vm->markerIdle = true;
+            pthread_cond_wait(&vm->gcCond, &vm->gcMutex);
+        }
+        vm->markerIdle = false;
+        bool stop = vm->markerStop;
+        for (int i = 0; i < vm->satbQueueCount; i++)
+        {
+            markObject(vm->satbQueue[i]);
+        }
+        vm->satbQueueCount = 0;
+        pthread_cond_signal(&vm->gcCond);
+        pthread_mutex_unlock(&vm->gcMutex);
+        if (stop)
+            return NULL;
+    }
+}
 
+// a batch always fits in both buffers, the marker isn't started if there's
+// no room for that.
+static void startMarker()
+{
+    vm->markerRunning = false;
+    if ((vm->satbCapacity < GC_SATB_FLUSH &&
+         !growGCArray(&vm->satb, &vm->satbCapacity, GC_SATB_FLUSH)) ||
+        (vm->satbQueueCapacity < GC_SATB_FLUSH &&
+         !growGCArray(&vm->satbQueue, &vm->satbQueueCapacity, GC_SATB_FLUSH)))
+        return;
+    vm->markerStop = false;
+    vm->markerIdle = false;
+    vm->markerRunning = pthread_create(&vm->marker, NULL, markerMain, vm) == 0;
+}
+
+// done once it ran dry and the mutator has nothing left to hand over.
+static bool markerDone()
+{
+    flushSatb();
+    pthread_mutex_lock(&vm->gcMutex);
+    bool done = vm->markerIdle && vm->satbQueueCount == 0;
+    pthread_mutex_unlock(&vm->gcMutex);
+    return done;
+}
+
+// whatever the marker didn't get to is left on the gray stack.
+static void stopMarker()
+{
+    pthread_mutex_lock(&vm->gcMutex);
+    __atomic_store_n(&vm->markerStop, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&vm->gcCond);
+    pthread_mutex_unlock(&vm->gcMutex);
+    pthread_join(vm->marker, NULL);
+    vm->markerRunning = false;
+
+    flushSatb();
+    for (int i = 0; i < vm->satbQueueCount; i++)
+    {
+        markObject(vm->satbQueue[i]);
+    }
+    vm->satbQueueCount = 0;
+}
+
+static void startCycle()
+{
+    vm->gcPhase = GC_MARKING;
+    vm->youngAllocated = 0;
+    vm->gcHardLimit = (size_t)((double)vm->nextGC * vm->gcGrowth);
     markRoots();
-    traceReferences();
-    tableRemoveWhite(&vm.strings);
-    sweep();
+}
 
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+static void blackenRemembered(Object *object)
+{
+    if (object->isRemembered)
+        blackenObject(object);
+}
+
+// the atomic end of marking. the stack and globals have no barrier so
+// roots are marked again, black remembered objects may have been filled
+// in without one, and the nursery is traced now that nothing moves.
+static void finishMarking()
+{
+    vm->gcPhase = GC_REMARK;
+    markRoots();
+    for (int i = 0; i < vm->rememberedCount; i++)
+    {
+        if (heapIsMarked(vm->remembered[i]))
+            blackenObject(vm->remembered[i]);
+    }
+    if (vm->rememberedOverflow)
+        visitHeap(&vm->heap, true, blackenRemembered);
+    traceReferences(0);
+    // what a gray stack had no room for is marked but wasn't scanned, so
+    // everything marked is, until nothing more is left out.
+    while (vm->grayOverflow)
+    {
+        vm->grayOverflow = false;
+        visitHeap(&vm->heap, true, blackenObject);
+        for (uint8_t *cursor = vm->nurseryStart; cursor < vm->nurseryTop;)
+        {
+            Object *object = (Object *)cursor;
+            cursor += GC_ALIGN(objectSize(object));
+            if (object->isMarked)
+                blackenObject(object);
+        }
+        traceReferences(0);
+    }
+
+    int remembered = 0;
+    for (int i = 0; i < vm->rememberedCount; i++)
+    {
+        if (heapIsMarked(vm->remembered[i]))
+            vm->remembered[remembered++] = vm->remembered[i];
+    }
+    vm->rememberedCount = remembered;
+
+    for (uint8_t *cursor = vm->nurseryStart; cursor < vm->nurseryTop;)
+    {
+        Object *object = (Object *)cursor;
+        object->isMarked = false;
+        cursor += GC_ALIGN(objectSize(object));
+    }
+
+    vm->gcPhase = GC_CLEARING;
+}
+
+// dead strings leave the intern table before anything is freed, cpString()
+// won't hand one out in the meantime.
+static bool clearStrings(double deadline)
+{
+    while (!tableRemoveWhite(&vm->strings, deadline > 0 ? GC_WEAK_SLICE : 0))
+    {
+        if (gcClock() > deadline)
+            return false;
+    }
+    startSweep(&vm->heap);
+    vm->gcPhase = GC_SWEEPING;
+    return true;
+}
+
+// room for what survived to grow by the growth factor, within the limits.
+static size_t heapTarget()
+{
+    size_t target = (size_t)((double)vm->bytesAllocated * vm->gcGrowth);
+    if (vm->gcMaxHeap > 0 && target > vm->gcMaxHeap)
+        target = vm->gcMaxHeap;
+    // past the ceiling it still gets some room, or it would collect
+    // without end.
+    if (target < vm->bytesAllocated + GC_SWEEP_STEP)
+        target = vm->bytesAllocated + GC_SWEEP_STEP;
+    if (target < vm->gcMinHeap)
+        target = vm->gcMinHeap;
+    return target;
+}
+
+// everything is swept, so whatever pages were freed can go back.
+static void finishCycle()
+{
+    vm->gcPhase = GC_IDLE;
+    vm->gcCycles++;
+    vm->nextGC = heapTarget();
+    // the gray stack is empty until the next cycle, a big one goes back.
+    if (vm->grayCapacity > GC_GRAY_KEEP)
+    {
+        freeGCArray(vm->grayStack, vm->grayCapacity);
+        vm->grayStack = NULL;
+        vm->grayCapacity = 0;
+    }
+    releaseMemory(&vm->heap);
+    if (vm->gcCompact && heapFragmentation(&vm->heap, GC_COMPACT_MIN) >= GC_COMPACT_FRAGMENTATION)
+    {
+        vm->compactRequested = true;
+        vm->youngRequested = true;
+    }
+}
+
+// a major collection never moves anything, so it can run at any
+// allocation. without a pause budget it marks in one go and sweeps what
+// the allocator left at the next call, otherwise each call advances it by
+// one slice and schedules the next one. a concurrent one only pauses to
+// start the marker and, once it's done, to finish. with finish it all
+// happens in this pause, a cycle is started if none is running.
+static void collect(bool finish, bool safepoint)
+{
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+    size_t before = vm->bytesAllocated;
+#endif
+    double start = gcClock();
+    long budget = vm->gcPauseBudget;
+    double deadline = budget > 0 ? start + (double)budget / 1e6 : 0;
+    // the mutator is outrunning the collector, finish this cycle now.
+    bool outrun = finish || (vm->gcPhase != GC_IDLE && vm->bytesAllocated > vm->gcHardLimit);
+    if (outrun)
+        deadline = 0;
+
+    if (vm->gcConcurrent && !outrun)
+    {
+        // the snapshot is taken right after a minor collection, so there's
+        // no nursery to trace until the final pause. that's also a safepoint,
+        // anywhere else the caller may have passed a barrier for an object
+        // it's about to change, and a new marker could be scanning it.
+        if (vm->gcPhase == GC_IDLE && safepoint)
+        {
+            startCycle();
+            startMarker();
+            if (vm->markerRunning)
+            {
+                vm->nextGC = vm->bytesAllocated + GC_STEP_SIZE;
+                recordPause(start);
+                return;
+            }
+        }
+        else if (vm->gcPhase == GC_IDLE && vm->bytesAllocated <= (size_t)((double)vm->nextGC * vm->gcGrowth))
+        {
+            vm->youngRequested = true;
+            return;
+        }
+        else if (vm->gcPhase == GC_MARKING && vm->markerRunning && !markerDone())
+        {
+            vm->nextGC = vm->bytesAllocated + GC_STEP_SIZE;
+            return;
+        }
+    }
+
+    if (vm->markerRunning)
+    {
+        stopMarker();
+        finishMarking();
+    }
+    if (vm->gcPhase == GC_IDLE)
+        startCycle();
+    if (vm->gcPhase == GC_MARKING && traceReferences(deadline))
+        finishMarking();
+    if (vm->gcPhase == GC_CLEARING && clearStrings(deadline) && !outrun)
+        vm->nextGC = vm->bytesAllocated + GC_SWEEP_STEP;
+    else if (vm->gcPhase == GC_SWEEPING && sweep(deadline))
+        finishCycle();
+    else
+        vm->nextGC = vm->bytesAllocated + GC_STEP_SIZE;
+    recordPause(start);
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
     printf("   collected %ld bytes (from %ld to %ld) next at %ld\n",
-           before - vm.bytesAllocated, before, vm.bytesAllocated,
-           vm.nextGC);
+           before - vm->bytesAllocated, before, vm->bytesAllocated,
+           vm->nextGC);
 #endif
 }
 
+static __thread size_t *census;
+
+static void countObject(Object *object)
+{
+    census[object->t] += objectSize(object) + ownedSize(object);
+}
+
+static Object *countYoung(Object *object)
+{
+    if (object == NULL || !IN_NURSERY(object) || object->isMarked)
+        return object;
+    object->isMarked = true;
+    countObject(object);
+    pushPromoted(object);
+    return object;
+}
+
+static void countRemembered(Object *object)
+{
+    if (!object->isRemembered)
+        return;
+    preWriteBarrier(object);
+    visitReferences(object, countYoung);
+}
+
+void liveBytes(size_t bytes[])
+{
+    memset(bytes, 0, sizeof(size_t) * OBJECT_TYPES);
+    census = bytes;
+    // a young object counts if a minor collection would keep it. it's
+    // traced the same way, but nothing moves and the mark bit that would
+    // say it did is cleared afterwards.
+    visitYoungRoots(countYoung);
+    for (int i = 0; i < vm->rememberedCount; i++)
+    {
+        countRemembered(vm->remembered[i]);
+    }
+    if (vm->rememberedOverflow)
+        visitHeap(&vm->heap, vm->gcPhase == GC_CLEARING, countRemembered);
+    scanPromoted(countYoung);
+    while (vm->promotedOverflow)
+    {
+        vm->promotedOverflow = false;
+        for (uint8_t *cursor = vm->nurseryStart; cursor < vm->nurseryTop;)
+        {
+            Object *object = (Object *)cursor;
+            cursor += GC_ALIGN(objectSize(object));
+            if (object->isMarked)
+                visitReferences(object, countYoung);
+        }
+        scanPromoted(countYoung);
+    }
+    for (uint8_t *cursor = vm->nurseryStart; cursor < vm->nurseryTop;)
+    {
+        Object *object = (Object *)cursor;
+        object->isMarked = false;
+        cursor += GC_ALIGN(objectSize(object));
+    }
+    // once marking is over, what it didn't reach is garbage even if it
+    // wasn't swept yet.
+    visitHeap(&vm->heap, vm->gcPhase == GC_CLEARING, countObject);
+}
+
+void collectGarbage()
+{
+    collect(false, false);
+}
+
 void freeObjects()
 {
-    Object *object = vm.objects;
-    while (object != NULL)
+    if (vm->markerRunning)
+        stopMarker();
+    for (uint8_t *cursor = vm->nurseryStart; cursor < vm->nurseryTop;)
     {
-        Object *next = object->next;
-        freeObject(object);
-        object = next;
+        Object *object = (Object *)cursor;
+        cursor += GC_ALIGN(objectSize(object));
+        releaseObject(object);
     }
-    free(vm.grayStack);
+    unmapRegion(&vm->heap, vm->nurseryStart);
+    freePages(&vm->heap);
+    freeGCArray(vm->remembered, vm->rememberedCapacity);
+    freeGCArray(vm->promoted, vm->promotedCapacity);
+    freeGCArray(vm->grayStack, vm->grayCapacity);
+    freeGCArray(vm->satb, vm->satbCapacity);
+    freeGCArray(vm->satbQueue, vm->satbQueueCapacity);
+    pthread_mutex_destroy(&vm->gcMutex);
+    pthread_cond_destroy(&vm->gcCond);
 }
\ No newline at end of file
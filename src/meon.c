@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meon.h"
+#include "compiler.h"
+#include "gcstats.h"
+#include "mem.h"
+#include "native.h"
+#include "object.h"
+#include "vm.h"
+
+// a compiled script's closure is held by a handle, so it survives
+// collections between runs.
+struct MeonScript
+{
+    VM *isolate;
+    int handle;
+};
+
+static MeonValue toMeon(Value value)
+{
+    if (IS_BOOL(value))
+        return meonBool(AS_BOOL(value));
+    if (IS_NUMBER(value))
+        return meonNumber(AS_NUMBER(value));
+    if (IS_NULL(value))
+        return meonNull();
+    if (IS_STRING(value))
+        return meonString(AS_STRING(value)->chars, AS_STRING(value)->length);
+    MeonValue other = meonNull();
+    other.type = MEON_OBJECT;
+    return other;
+}
+
+// a string is copied in, which may collect.
+static Value fromMeon(MeonValue value)
+{
+    switch (value.type)
+    {
+    case MEON_BOOL:
+        return BOOL_VAL(value.as.boolean);
+    case MEON_NUMBER:
+        return NUMBER_VAL(value.as.number);
+    case MEON_STRING:
+        return OBJ_VAL(cpString(value.as.string.chars, value.as.string.length));
+    default:
+        return NULL_VAL;
+    }
+}
+
+// everything that goes into an isolate goes in under protectedCall(), so
+// running out of memory is an error for the host, never an exit.
+MeonVM *meonNewVM(void)
+{
+    VM *isolate = newVM();
+    if (isolate == NULL)
+        return NULL;
+    if (isolate->gcBadEnv[0] != '\0')
+    {
+        fprintf(stderr, "meon: bad gc option '%s=%s'.\n", isolate->gcBadEnv, getenv(isolate->gcBadEnv));
+        freeVM(isolate);
+        return NULL;
+    }
+    return isolate;
+}
+
+void meonFreeVM(MeonVM *isolate)
+{
+    freeVM(isolate);
+}
+
+typedef struct
+{
+    const char *name;
+    const char *value;
+} OptionJob;
+
+static InterpretResult setOption(void *data)
+{
+    OptionJob *job = data;
+    return setGCOption(job->name, job->value) ? INTERPRET_OK : INTERPRET_RUNTIME_ERROR;
+}
+
+bool meonSetOption(MeonVM *isolate, const char *name, const char *value)
+{
+    OptionJob job = {name, value};
+    return protectedCall(isolate, setOption, &job) == INTERPRET_OK;
+}
+
+void meonSetLimits(MeonVM *isolate, int64_t fuel, double seconds)
+{
+    setRunLimits(isolate, fuel, seconds, false);
+}
+
+typedef struct
+{
+    const char *source;
+    const char *name;
+    int handle;
+} CompileJob;
+
+static InterpretResult compileScript(void *data)
+{
+    CompileJob *job = data;
+    ObjectFunction *function = compile(job->source, NULL, job->name, 0);
+    if (function == NULL)
+        return INTERPRET_COMPILE_ERROR;
+    push(OBJ_VAL(function));
+    ObjectClosure *closure = newClosure(function);
+    push(OBJ_VAL(closure));
+    job->handle = newHandle(OBJ_VAL(closure));
+    pop();
+    pop();
+    return INTERPRET_OK;
+}
+
+static InterpretResult releaseHandle(void *data)
+{
+    freeHandle(*(int *)data);
+    return INTERPRET_OK;
+}
+
+MeonScript *meonCompile(MeonVM *isolate, const char *source, const char *name)
+{
+    CompileJob job = {source, name, -1};
+    if (protectedCall(isolate, compileScript, &job) != INTERPRET_OK)
+        return NULL;
+    MeonScript *script = malloc(sizeof(MeonScript));
+    if (script == NULL)
+    {
+        protectedCall(isolate, releaseHandle, &job.handle);
+        return NULL;
+    }
+    script->isolate = isolate;
+    script->handle = job.handle;
+    return script;
+}
+
+static InterpretResult runScript(void *data)
+{
+    MeonScript *script = data;
+    push(vm->handles.values[script->handle]);
+    InterpretResult result = callOnStack(0);
+    if (result == INTERPRET_OK)
+        pop();
+    return result;
+}
+
+MeonResult meonRun(MeonScript *script)
+{
+    return (MeonResult)protectedCall(script->isolate, runScript, script);
+}
+
+void meonFreeScript(MeonScript *script)
+{
+    protectedCall(script->isolate, releaseHandle, &script->handle);
+    free(script);
+}
+
+typedef struct
+{
+    const char *name;
+    int argCount;
+    const MeonValue *args;
+    MeonValue *result;
+} CallJob;
+
+static InterpretResult callFunction(void *data)
+{
+    CallJob *job = data;
+    if (job->argCount >= UINT8_COUNT)
+    {
+        runtimeError("Can't have more than 255 arguments.");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    if (vm->stackTop + job->argCount + 1 > vm->stack + STACK_MAX)
+    {
+        runtimeError("Oops! stack OVERFLOW.");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    Value callee;
+    ObjectString *name = cpString(job->name, (int)strlen(job->name));
+    if (!tableGet(&vm->globals, name, &callee))
+    {
+        runtimeError("Undefined variable '%s'.", job->name);
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    push(callee);
+    for (int i = 0; i < job->argCount; i++)
+    {
+        push(fromMeon(job->args[i]));
+    }
+    InterpretResult result = callOnStack(job->argCount);
+    if (result == INTERPRET_OK)
+    {
+        Value value = pop();
+        if (job->result != NULL)
+            *job->result = toMeon(value);
+    }
+    return result;
+}
+
+MeonResult meonCall(MeonVM *isolate, const char *name, int argCount, const MeonValue *args,
+                    MeonValue *result)
+{
+    CallJob job = {name, argCount, args, result};
+    return (MeonResult)protectedCall(isolate, callFunction, &job);
+}
+
+// every host native is this one, it finds which it is just under its
+// arguments on the stack.
+static bool callHost(int argCount, Value *args, Value *result)
+{
+    ObjectNative *native = AS_NATIVE(args[-1]);
+    MeonValue in[UINT8_COUNT];
+    for (int i = 0; i < argCount; i++)
+    {
+        in[i] = toMeon(args[i]);
+    }
+    MeonValue out = meonNull();
+    if (!native->host(vm, argCount, in, &out, native->data))
+    {
+        if (out.type == MEON_STRING)
+            runtimeError("%.*s", out.as.string.length, out.as.string.chars);
+        else
+            runtimeError("Native failed.");
+        return false;
+    }
+    *result = fromMeon(out);
+    return true;
+}
+
+typedef struct
+{
+    const char *name;
+    int arity;
+    MeonNative function;
+    void *data;
+} NativeJob;
+
+static InterpretResult defineHost(void *data)
+{
+    NativeJob *job = data;
+    ObjectNative *native = defineNative(vm, job->name, callHost, job->arity);
+    native->host = job->function;
+    native->data = job->data;
+    return INTERPRET_OK;
+}
+
+bool meonDefineNative(MeonVM *isolate, const char *name, int arity, MeonNative function,
+                      void *data)
+{
+    NativeJob job = {name, arity, function, data};
+    return protectedCall(isolate, defineHost, &job) == INTERPRET_OK;
+}
+
+void meonStats(MeonVM *isolate, MeonStats *stats)
+{
+    VM *previous = enterVM(isolate);
+    GCStats gc;
+    gcStats(&gc);
+    enterVM(previous);
+    stats->cycles = gc.cycles;
+    stats->minorCycles = gc.minorCycles;
+    stats->compactions = gc.compactions;
+    stats->pauses = gc.pauses;
+    stats->totalPause = gc.totalPause;
+    stats->p50Pause = gc.p50Pause;
+    stats->p99Pause = gc.p99Pause;
+    stats->maxPause = gc.maxPause;
+    stats->heap = gc.heap;
+    stats->metadata = gc.metadata;
+    stats->mapped = gc.mapped;
+    stats->allocated = gc.allocated;
+    stats->freed = gc.freed;
+    stats->allocationRate = gc.allocationRate;
+}
\ No newline at end of file
@@ -1,28 +1,788 @@
+#include <math.h>
 #include <string.h>
 
+#include "gcstats.h"
+#include "map.h"
+#include "mem.h"
 #include "native.h"
+#include "persistent.h"
+#include "seq.h"
+#include "simd.h"
+#include "sort.h"
 
-static Value getUnixEpoch(int argCount, Value *args)
+static bool getUnixEpoch(int argCount, Value *args, Value *result)
 {
-    return NUMBER_VAL(time(NULL));
+    *result = NUMBER_VAL(time(NULL));
+    return true;
 }
 
-static Value clockNative(int argCount, Value *args)
+static bool clockNative(int argCount, Value *args, Value *result)
 {
-    return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    *result = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    return true;
 }
 
-static void defineNative(VM *vm, const char *name, NativeFn function)
+static void setStat(ObjectMap *stats, const char *name, double value)
+{
+    Value key = OBJ_VAL(cpString(name, (int)strlen(name)));
+    push(key);
+    mapSet(stats, key, NUMBER_VAL(value));
+    pop();
+}
+
+// pauses are in milliseconds, sizes in bytes. live has the bytes taken up
+// by each type of object, with what it owns off the heap.
+static bool gcStatsNative(int argCount, Value *args, Value *result)
+{
+    GCStats gc;
+    gcStats(&gc);
+    ObjectMap *stats = newMap();
+    push(OBJ_VAL(stats));
+    setStat(stats, "cycles", (double)gc.cycles);
+    setStat(stats, "minorCycles", (double)gc.minorCycles);
+    setStat(stats, "pauses", (double)gc.pauses);
+    setStat(stats, "totalPause", gc.totalPause * 1e3);
+    setStat(stats, "p50Pause", gc.p50Pause * 1e3);
+    setStat(stats, "p99Pause", gc.p99Pause * 1e3);
+    setStat(stats, "maxPause", gc.maxPause * 1e3);
+    setStat(stats, "budget", (double)vm->gcPauseBudget / 1e3);
+    setStat(stats, "heap", (double)gc.heap);
+    setStat(stats, "metadata", (double)gc.metadata);
+    setStat(stats, "compactions", (double)gc.compactions);
+    setStat(stats, "mapped", (double)gc.mapped);
+    setStat(stats, "allocated", (double)gc.allocated);
+    setStat(stats, "freed", (double)gc.freed);
+    setStat(stats, "allocationRate", gc.allocationRate);
+
+    ObjectMap *live = newMap();
+    push(OBJ_VAL(live));
+    for (int i = 0; i < OBJECT_TYPES; i++)
+    {
+        if (gc.live[i] > 0)
+            setStat(live, objectTypeName(i), (double)gc.live[i]);
+    }
+    Value key = OBJ_VAL(cpString("live", 4));
+    push(key);
+    mapSet(stats, key, OBJ_VAL(live));
+    pop();
+    pop();
+    *result = pop();
+    return true;
+}
+
+static bool hasNative(int argCount, Value *args, Value *result)
+{
+    Value value;
+    if (IS_PMAP(args[0]))
+    {
+        *result = BOOL_VAL(isMapKey(args[1]) && pmapGet(AS_PMAP(args[0]), args[1], &value));
+        return true;
+    }
+    if (!IS_MAP(args[0]))
+    {
+        runtimeError("has() expects a map.");
+        return false;
+    }
+    *result = BOOL_VAL(isMapKey(args[1]) && mapGet(AS_MAP(args[0]), args[1], &value));
+    return true;
+}
+
+static bool deleteNative(int argCount, Value *args, Value *result)
+{
+    if (!IS_MAP(args[0]))
+    {
+        runtimeError("delete() expects a map.");
+        return false;
+    }
+    *result = BOOL_VAL(isMapKey(args[1]) && mapDelete(AS_MAP(args[0]), args[1]));
+    return true;
+}
+
+static bool pushNative(int argCount, Value *args, Value *result)
+{
+    if (!IS_ARRAY(args[0]))
+    {
+        runtimeError("push() expects an array.");
+        return false;
+    }
+    ObjectArray *array = AS_ARRAY(args[0]);
+    preWriteBarrier((Object *)array);
+    writeValueArr(&array->items, args[1]);
+    writeBarrier((Object *)array, args[1]);
+    *result = NUMBER_VAL(array->items.size);
+    return true;
+}
+
+static bool popNative(int argCount, Value *args, Value *result)
+{
+    if (!IS_ARRAY(args[0]) || AS_ARRAY(args[0])->items.size == 0)
+    {
+        runtimeError("pop() expects a non-empty array.");
+        return false;
+    }
+    ObjectArray *array = AS_ARRAY(args[0]);
+    preWriteBarrier((Object *)array);
+    *result = array->items.values[--array->items.size];
+    return true;
+}
+
+// negative bounds count from the end, both are clamped to the array. a
+// fraction is an error, the same one indexing raises.
+static bool sliceBound(Value bound, int size, int *slot)
+{
+    double number = AS_NUMBER(bound);
+    if (number != floor(number))
+    {
+        runtimeError("Array index %.15g is out of bounds for size %d.", number, size);
+        return false;
+    }
+    if (number < 0)
+        number += size;
+    if (number < 0)
+        *slot = 0;
+    else if (number > size)
+        *slot = size;
+    else
+        *slot = (int)number;
+    return true;
+}
+
+static bool sliceNative(int argCount, Value *args, Value *result)
+{
+    if (argCount < 2 || argCount > 3)
+    {
+        runtimeError("Expected 2 or 3 arguments but got %d.", argCount);
+        return false;
+    }
+    if (!IS_ARRAY(args[0]) || !IS_NUMBER(args[1]) || (argCount == 3 && !IS_NUMBER(args[2])))
+    {
+        runtimeError("slice() expects an array and number bounds.");
+        return false;
+    }
+
+    ValueArr *items = &AS_ARRAY(args[0])->items;
+    int start;
+    int end = items->size;
+    if (!sliceBound(args[1], items->size, &start) ||
+        (argCount == 3 && !sliceBound(args[2], items->size, &end)))
+        return false;
+
+    ObjectArray *slice = newArray();
+    if (end > start)
+    {
+        push(OBJ_VAL(slice));
+        slice->items.values = ALLOCATE(Value, end - start);
+        slice->items.maxSize = end - start;
+        memcpy(slice->items.values, items->values + start, sizeof(Value) * (end - start));
+        slice->items.size = end - start;
+        pop();
+    }
+    *result = OBJ_VAL(slice);
+    return true;
+}
+
+static bool makeTypedArray(typed_t kind, const char *name, Value arg, Value *result)
+{
+    if (IS_NUMBER(arg))
+    {
+        double length = AS_NUMBER(arg);
+        if (!(length >= 0 && length <= INT32_MAX) || length != (int)length)
+        {
+            runtimeError("%s() length must be a non-negative integer.", name);
+            return false;
+        }
+        *result = OBJ_VAL(newTypedArray(kind, (int)length));
+        return true;
+    }
+
+    if (!IS_ARRAY(arg))
+    {
+        runtimeError("%s() expects a length or an array of numbers.", name);
+        return false;
+    }
+
+    // check everything first, the copy can't fail halfway.
+    ValueArr *items = &AS_ARRAY(arg)->items;
+    int64_t integer;
+    for (int i = 0; i < items->size; i++)
+    {
+        Value item = items->values[i];
+        if (!IS_NUMBER(item) || (kind == TYPED_INT64 && !numberToInt64(AS_NUMBER(item), &integer)))
+        {
+            runtimeError("%s() element %d is not %s.", name, i, kind == TYPED_FLOAT64 ? "a number" : "an integer");
+            return false;
+        }
+    }
+
+    ObjectTypedArray *array = newTypedArray(kind, items->size);
+    for (int i = 0; i < items->size; i++)
+    {
+        if (kind == TYPED_FLOAT64)
+            array->as.f64[i] = AS_NUMBER(items->values[i]);
+        else
+            numberToInt64(AS_NUMBER(items->values[i]), &array->as.i64[i]);
+    }
+    *result = OBJ_VAL(array);
+    return true;
+}
+
+static bool float64ArrayNative(int argCount, Value *args, Value *result)
+{
+    return makeTypedArray(TYPED_FLOAT64, "Float64Array", args[0], result);
+}
+
+static bool int64ArrayNative(int argCount, Value *args, Value *result)
+{
+    return makeTypedArray(TYPED_INT64, "Int64Array", args[0], result);
+}
+
+static ObjectTypedArray *typedArg(Value arg, const char *name)
+{
+    if (!IS_TYPED_ARRAY(arg))
+    {
+        runtimeError("%s() expects a Float64Array or an Int64Array.", name);
+        return NULL;
+    }
+    return AS_TYPED_ARRAY(arg);
+}
+
+// binary kernels need two arrays of the same kind and length.
+static bool typedPair(Value *args, const char *name, ObjectTypedArray **a, ObjectTypedArray **b)
+{
+    if ((*a = typedArg(args[0], name)) == NULL || (*b = typedArg(args[1], name)) == NULL)
+        return false;
+    if ((*a)->kind != (*b)->kind || (*a)->length != (*b)->length)
+    {
+        runtimeError("%s() expects arrays of the same type and length.", name);
+        return false;
+    }
+    return true;
+}
+
+static bool sumNative(int argCount, Value *args, Value *result)
+{
+    ObjectTypedArray *array = typedArg(args[0], "sum");
+    if (array == NULL)
+        return false;
+    if (array->kind == TYPED_FLOAT64)
+        *result = NUMBER_VAL(simd.sumF64(array->as.f64, array->length));
+    else
+        *result = NUMBER_VAL((double)simd.sumI64(array->as.i64, array->length));
+    return true;
+}
+
+static bool minNative(int argCount, Value *args, Value *result)
+{
+    ObjectTypedArray *array = typedArg(args[0], "min");
+    if (array == NULL)
+        return false;
+    if (array->length == 0)
+    {
+        runtimeError("min() of an empty array.");
+        return false;
+    }
+    if (array->kind == TYPED_FLOAT64)
+        *result = NUMBER_VAL(simd.minF64(array->as.f64, array->length));
+    else
+        *result = NUMBER_VAL((double)simd.minI64(array->as.i64, array->length));
+    return true;
+}
+
+static bool maxNative(int argCount, Value *args, Value *result)
+{
+    ObjectTypedArray *array = typedArg(args[0], "max");
+    if (array == NULL)
+        return false;
+    if (array->length == 0)
+    {
+        runtimeError("max() of an empty array.");
+        return false;
+    }
+    if (array->kind == TYPED_FLOAT64)
+        *result = NUMBER_VAL(simd.maxF64(array->as.f64, array->length));
+    else
+        *result = NUMBER_VAL((double)simd.maxI64(array->as.i64, array->length));
+    return true;
+}
+
+static bool dotNative(int argCount, Value *args, Value *result)
+{
+    ObjectTypedArray *a, *b;
+    if (!typedPair(args, "dot", &a, &b))
+        return false;
+    if (a->kind == TYPED_FLOAT64)
+        *result = NUMBER_VAL(simd.dotF64(a->as.f64, b->as.f64, a->length));
+    else
+        *result = NUMBER_VAL((double)simd.dotI64(a->as.i64, b->as.i64, a->length));
+    return true;
+}
+
+// scale, add and prefixSum work in place and return their first argument.
+static bool scaleNative(int argCount, Value *args, Value *result)
+{
+    ObjectTypedArray *array = typedArg(args[0], "scale");
+    if (array == NULL)
+        return false;
+    if (!IS_NUMBER(args[1]))
+    {
+        runtimeError("scale() factor must be a number.");
+        return false;
+    }
+
+    if (array->kind == TYPED_FLOAT64)
+    {
+        simd.scaleF64(array->as.f64, array->length, AS_NUMBER(args[1]));
+    }
+    else
+    {
+        int64_t factor;
+        if (!numberToInt64(AS_NUMBER(args[1]), &factor))
+        {
+            runtimeError("scale() factor of an Int64Array must be an integer.");
+            return false;
+        }
+        simd.scaleI64(array->as.i64, array->length, factor);
+    }
+    *result = args[0];
+    return true;
+}
+
+static bool addNative(int argCount, Value *args, Value *result)
+{
+    ObjectTypedArray *a, *b;
+    if (!typedPair(args, "add", &a, &b))
+        return false;
+    if (a->kind == TYPED_FLOAT64)
+        simd.addF64(a->as.f64, b->as.f64, a->length);
+    else
+        simd.addI64(a->as.i64, b->as.i64, a->length);
+    *result = args[0];
+    return true;
+}
+
+static bool prefixSumNative(int argCount, Value *args, Value *result)
+{
+    ObjectTypedArray *array = typedArg(args[0], "prefixSum");
+    if (array == NULL)
+        return false;
+    if (array->kind == TYPED_FLOAT64)
+        simd.prefixSumF64(array->as.f64, array->length);
+    else
+        simd.prefixSumI64(array->as.i64, array->length);
+    *result = args[0];
+    return true;
+}
+
+// pvector(a, b, ...). each step's result replaces args[0] on the stack so
+// it stays reachable while the next one is built.
+static bool pvectorNative(int argCount, Value *args, Value *result)
+{
+    ObjectPVector *vector = newPVector(0, PERSISTENT_BITS, NULL, NULL);
+    push(OBJ_VAL(vector));
+    for (int i = 0; i < argCount; i++)
+    {
+        vector = pvectorConj(vector, args[i]);
+        vm->stackTop[-1] = OBJ_VAL(vector);
+    }
+    pop();
+    *result = OBJ_VAL(vector);
+    return true;
+}
+
+// pmap(k1, v1, k2, v2, ...).
+static bool pmapNative(int argCount, Value *args, Value *result)
+{
+    if (argCount % 2 != 0)
+    {
+        runtimeError("pmap() expects key and value pairs.");
+        return false;
+    }
+
+    ObjectPMap *map = newPMap(0, NULL);
+    push(OBJ_VAL(map));
+    for (int i = 0; i < argCount; i += 2)
+    {
+        if (!isMapKey(args[i]))
+        {
+            pop();
+            runtimeError("Map key must be a string, number or boolean.");
+            return false;
+        }
+        map = pmapAssoc(map, args[i], args[i + 1]);
+        vm->stackTop[-1] = OBJ_VAL(map);
+    }
+    pop();
+    *result = OBJ_VAL(map);
+    return true;
+}
+
+static bool conjNative(int argCount, Value *args, Value *result)
+{
+    if (!IS_PVECTOR(args[0]))
+    {
+        runtimeError("conj() expects a pvector.");
+        return false;
+    }
+    *result = OBJ_VAL(pvectorConj(AS_PVECTOR(args[0]), args[1]));
+    return true;
+}
+
+static bool assocNative(int argCount, Value *args, Value *result)
+{
+    if (IS_PVECTOR(args[0]))
+    {
+        ObjectPVector *vector = AS_PVECTOR(args[0]);
+        double index = IS_NUMBER(args[1]) ? AS_NUMBER(args[1]) : -1;
+        if (!(index >= 0 && index <= vector->count) || index != (int)index)
+        {
+            runtimeError("assoc() index must be an integer from 0 to %d.", vector->count);
+            return false;
+        }
+        *result = OBJ_VAL(pvectorAssoc(vector, (int)index, args[2]));
+        return true;
+    }
+    if (IS_PMAP(args[0]))
+    {
+        if (!isMapKey(args[1]))
+        {
+            runtimeError("Map key must be a string, number or boolean.");
+            return false;
+        }
+        *result = OBJ_VAL(pmapAssoc(AS_PMAP(args[0]), args[1], args[2]));
+        return true;
+    }
+    runtimeError("assoc() expects a pvector or a pmap.");
+    return false;
+}
+
+static bool dissocNative(int argCount, Value *args, Value *result)
+{
+    if (!IS_PMAP(args[0]))
+    {
+        runtimeError("dissoc() expects a pmap.");
+        return false;
+    }
+    *result = isMapKey(args[1]) ? OBJ_VAL(pmapDissoc(AS_PMAP(args[0]), args[1])) : args[0];
+    return true;
+}
+
+static bool sizeNative(int argCount, Value *args, Value *result)
+{
+    if (IS_PVECTOR(args[0]))
+    {
+        *result = NUMBER_VAL(AS_PVECTOR(args[0])->count);
+        return true;
+    }
+    if (IS_PMAP(args[0]))
+    {
+        *result = NUMBER_VAL(AS_PMAP(args[0])->count);
+        return true;
+    }
+    if (IS_TYPED_ARRAY(args[0]))
+    {
+        *result = NUMBER_VAL(AS_TYPED_ARRAY(args[0])->length);
+        return true;
+    }
+    if (IS_ARRAY(args[0]))
+    {
+        *result = NUMBER_VAL(AS_ARRAY(args[0])->items.size);
+        return true;
+    }
+    if (IS_MAP(args[0]))
+    {
+        *result = NUMBER_VAL(AS_MAP(args[0])->count);
+        return true;
+    }
+    if (IS_STRING(args[0]))
+    {
+        *result = NUMBER_VAL(AS_STRING(args[0])->length);
+        return true;
+    }
+    runtimeError("size() expects a collection or a string.");
+    return false;
+}
+
+static bool rangeNative(int argCount, Value *args, Value *result)
+{
+    if (argCount < 1 || argCount > 3)
+    {
+        runtimeError("Expected 1 to 3 arguments but got %d.", argCount);
+        return false;
+    }
+    for (int i = 0; i < argCount; i++)
+    {
+        if (!IS_NUMBER(args[i]))
+        {
+            runtimeError("range() expects number bounds.");
+            return false;
+        }
+    }
+    if (argCount == 3 && AS_NUMBER(args[2]) == 0)
+    {
+        runtimeError("range() step can't be zero.");
+        return false;
+    }
+
+    ObjectSeq *range = newSeq(SEQ_RANGE, NULL, NULL_VAL);
+    range->start = argCount == 1 ? 0 : AS_NUMBER(args[0]);
+    range->end = argCount == 1 ? AS_NUMBER(args[0]) : AS_NUMBER(args[1]);
+    range->step = argCount == 3 ? AS_NUMBER(args[2]) : 1;
+    *result = OBJ_VAL(range);
+    return true;
+}
+
+// wraps a plain collection so every stage can take either.
+static bool toSeq(Value value, const char *name, ObjectSeq **seq)
+{
+    if (IS_SEQ(value))
+    {
+        *seq = AS_SEQ(value);
+        return true;
+    }
+    if (!isSeqSource(value))
+    {
+        runtimeError("%s() expects a sequence, an array, a typed array or a pvector.", name);
+        return false;
+    }
+    *seq = newSeq(SEQ_SOURCE, NULL, value);
+    return true;
+}
+
+static bool seqNative(int argCount, Value *args, Value *result)
+{
+    ObjectSeq *seq;
+    if (!toSeq(args[0], "seq", &seq))
+        return false;
+    *result = OBJ_VAL(seq);
+    return true;
+}
+
+static bool addStage(seq_t kind, const char *name, Value *args, Value *result)
+{
+    ObjectSeq *parent;
+    if (!toSeq(args[0], name, &parent))
+        return false;
+
+    if (kind == SEQ_TAKE)
+    {
+        if (!IS_NUMBER(args[1]))
+        {
+            runtimeError("take() expects a number.");
+            return false;
+        }
+    }
+    else
+    {
+        PreparedCall call;
+        if (!prepareCall(&call, args[1], 1))
+            return false;
+    }
+
+    push(OBJ_VAL(parent));
+    ObjectSeq *stage = newSeq(kind, parent, kind == SEQ_TAKE ? NULL_VAL : args[1]);
+    if (kind == SEQ_TAKE)
+        stage->end = AS_NUMBER(args[1]);
+    pop();
+    *result = OBJ_VAL(stage);
+    return true;
+}
+
+static bool mapNative(int argCount, Value *args, Value *result)
+{
+    return addStage(SEQ_MAP, "map", args, result);
+}
+
+static bool filterNative(int argCount, Value *args, Value *result)
+{
+    return addStage(SEQ_FILTER, "filter", args, result);
+}
+
+static bool takeNative(int argCount, Value *args, Value *result)
+{
+    return addStage(SEQ_TAKE, "take", args, result);
+}
+
+static bool reduceNative(int argCount, Value *args, Value *result)
+{
+    ObjectSeq *seq;
+    PreparedCall call;
+    if (!toSeq(args[0], "reduce", &seq))
+        return false;
+    push(OBJ_VAL(seq));
+    if (!prepareCall(&call, args[1], 2))
+        return false;
+    call.movable = true;
+
+    push(OBJ_VAL(newSeqIter(seq)));
+    Value *iter = vm->stackTop - 1;
+    // the accumulator lives on the stack so it survives collections.
+    push(args[2]);
+    Value *acc = vm->stackTop - 1;
+    for (;;)
+    {
+        Value pair[2];
+        bool hasNext;
+        if (!seqNext(iter, &pair[1], &hasNext))
+            return false;
+        if (!hasNext)
+            break;
+        // the stages ran scripts too, args[1] is where the reducer is now.
+        call.callee = args[1];
+        pair[0] = *acc;
+        if (!callPrepared(&call, pair, acc))
+            return false;
+    }
+    *result = *acc;
+    vm->stackTop -= 3;
+    return true;
+}
+
+static bool collectNative(int argCount, Value *args, Value *result)
+{
+    ObjectSeq *seq;
+    if (!toSeq(args[0], "collect", &seq))
+        return false;
+    push(OBJ_VAL(seq));
+    push(OBJ_VAL(newSeqIter(seq)));
+    Value *iter = vm->stackTop - 1;
+    push(OBJ_VAL(newArray()));
+    for (;;)
+    {
+        Value value;
+        bool hasNext;
+        if (!seqNext(iter, &value, &hasNext))
+            return false;
+        if (!hasNext)
+            break;
+        // the stages may have moved it.
+        ObjectArray *array = AS_ARRAY(vm->stackTop[-1]);
+        push(value);
+        writeValueArr(&array->items, value);
+        writeBarrier((Object *)array, value);
+        pop();
+    }
+    *result = vm->stackTop[-1];
+    vm->stackTop -= 3;
+    return true;
+}
+
+static bool sortNative(int argCount, Value *args, Value *result)
+{
+    if (argCount < 1 || argCount > 2)
+    {
+        runtimeError("Expected 1 or 2 arguments but got %d.", argCount);
+        return false;
+    }
+    if (IS_TYPED_ARRAY(args[0]) && argCount == 1)
+    {
+        sortTypedArray(AS_TYPED_ARRAY(args[0]));
+        *result = args[0];
+        return true;
+    }
+    if (!IS_ARRAY(args[0]))
+    {
+        runtimeError("sort() expects an array and an optional comparator, or a typed array.");
+        return false;
+    }
+    if (!sortArray(AS_ARRAY(args[0]), argCount == 2 ? args[1] : NULL_VAL))
+        return false;
+    *result = args[0];
+    return true;
+}
+
+static bool sortByNative(int argCount, Value *args, Value *result)
+{
+    if (!IS_ARRAY(args[0]))
+    {
+        runtimeError("sortBy() expects an array and a key function.");
+        return false;
+    }
+    if (!sortArrayBy(AS_ARRAY(args[0]), args[1]))
+        return false;
+    *result = args[0];
+    return true;
+}
+
+static bool searchNative(int argCount, Value *args, Value *result)
+{
+    if (argCount < 2 || argCount > 3)
+    {
+        runtimeError("Expected 2 or 3 arguments but got %d.", argCount);
+        return false;
+    }
+    if (IS_TYPED_ARRAY(args[0]) && argCount == 2)
+    {
+        if (!IS_NUMBER(args[1]))
+        {
+            runtimeError("search() expects a number in a typed array.");
+            return false;
+        }
+        *result = NUMBER_VAL(searchTypedArray(AS_TYPED_ARRAY(args[0]), AS_NUMBER(args[1])));
+        return true;
+    }
+    if (!IS_ARRAY(args[0]))
+    {
+        runtimeError("search() expects a sorted array, a value and an optional comparator.");
+        return false;
+    }
+    int index;
+    if (!searchArray(AS_ARRAY(args[0]), args[1], argCount == 3 ? args[2] : NULL_VAL, &index))
+        return false;
+    *result = NUMBER_VAL(index);
+    return true;
+}
+
+ObjectNative *defineNative(VM *vm, const char *name, NativeFn function, int arity)
 {
     push(OBJ_VAL(cpString(name, (int)strlen(name))));
-    push(OBJ_VAL(newNative(function)));
-    tableSet(&vm->globals, AS_STRING(vm->stack[0]), vm->stack[1]);
+    push(OBJ_VAL(newNative(function, arity)));
+    ObjectString *key = AS_STRING(vm->stackTop[-2]);
+    ObjectNative *native = AS_NATIVE(vm->stackTop[-1]);
+    tableSet(&vm->globals, key, OBJ_VAL(native));
+    writeBarrierGlobal(key, OBJ_VAL(native));
     pop();
     pop();
+    return native;
 }
 
 void loadNativeFunction(VM *vm)
 {
-    defineNative(vm, "time", getUnixEpoch);
-    defineNative(vm, "clock", clockNative);
+    defineNative(vm, "time", getUnixEpoch, 0);
+    defineNative(vm, "clock", clockNative, 0);
+    defineNative(vm, "gcStats", gcStatsNative, 0);
+    defineNative(vm, "has", hasNative, 2);
+    defineNative(vm, "delete", deleteNative, 2);
+    defineNative(vm, "size", sizeNative, 1);
+    defineNative(vm, "push", pushNative, 2);
+    defineNative(vm, "pop", popNative, 1);
+    defineNative(vm, "slice", sliceNative, -1);
+
+    defineNative(vm, "pvector", pvectorNative, -1);
+    defineNative(vm, "pmap", pmapNative, -1);
+    defineNative(vm, "conj", conjNative, 2);
+    defineNative(vm, "assoc", assocNative, 3);
+    defineNative(vm, "dissoc", dissocNative, 2);
+
+    initSimd();
+    defineNative(vm, "Float64Array", float64ArrayNative, 1);
+    defineNative(vm, "Int64Array", int64ArrayNative, 1);
+    defineNative(vm, "sum", sumNative, 1);
+    defineNative(vm, "min", minNative, 1);
+    defineNative(vm, "max", maxNative, 1);
+    defineNative(vm, "dot", dotNative, 2);
+    defineNative(vm, "scale", scaleNative, 2);
+    defineNative(vm, "add", addNative, 2);
+    defineNative(vm, "prefixSum", prefixSumNative, 1);
+
+    defineNative(vm, "range", rangeNative, -1);
+    defineNative(vm, "seq", seqNative, 1);
+    defineNative(vm, "map", mapNative, 2);
+    defineNative(vm, "filter", filterNative, 2);
+    defineNative(vm, "take", takeNative, 2);
+    defineNative(vm, "reduce", reduceNative, 3);
+    defineNative(vm, "collect", collectNative, 1);
+
+    defineNative(vm, "sort", sortNative, -1);
+    defineNative(vm, "sortBy", sortByNative, 2);
+    defineNative(vm, "search", searchNative, -1);
 }
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "map.h"
 #include "mem.h"
 #include "object.h"
+#include "persistent.h"
+#include "record.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
@@ -10,44 +13,47 @@
 #define ALLOCATE_OBJ(t, ot) \
     (t *)allocateObject(sizeof(t), ot);
 
-static Object *allocateObject(size_t size, object_t t)
-{
-    Object *object = (Object *)reallocate(NULL, 0, size);
-    object->t = t;
-    object->isMarked = false;
-
-    object->next = vm.objects;
-    vm.objects = object;
-#ifdef DEBUG_LOG_GC
-    printf("%p allocate %ld for %d\n", (void *)object, size, t);
-#endif
-
-    return object;
-}
-
 ObjectFunction *newFunction()
 {
     ObjectFunction *function = ALLOCATE_OBJ(ObjectFunction, OBJECT_FUNCTION);
 
     function->argsCount = 0;
-    function->name = NULL;
+    function->name = REF(NULL);
     function->upvalueCount = 0;
     initChunk(&function->chunk);
     return function;
 }
 
-static ObjectString *allocateString(char *chars, int length, uint32_t hash)
+static ObjectString *allocateString(const char *chars, int length, uint32_t hash, ObjectSource *owner)
 {
     ObjectString *string = ALLOCATE_OBJ(ObjectString, OBJECT_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
+    string->owner = owner;
     push(OBJ_VAL(string));
-    tableSet(&vm.strings, string, NULL_VAL);
+    tableSet(&vm->strings, string, NULL_VAL);
     pop();
     return string;
 }
 
+// while the collector is clearing the intern table it may still hold
+// strings that are already dead, those must not come back to life. one
+// handed out while marking may not be reachable from the snapshot.
+static ObjectString *findString(const char *chars, int length, uint32_t hash)
+{
+    ObjectString *interned = tableFindString(&vm->strings, chars, length, hash);
+    if (interned != NULL && vm->gcPhase == GC_CLEARING &&
+        !IN_NURSERY(interned) && !heapIsMarked(&interned->object))
+    {
+        tableDelete(&vm->strings, interned);
+        return NULL;
+    }
+    if (interned != NULL)
+        keepAlive((Object *)interned);
+    return interned;
+}
+
 static uint32_t hashString(const char *k, int length)
 {
     uint32_t hash = 2166136261u;
@@ -62,7 +68,7 @@ static uint32_t hashString(const char *k, int length)
 ObjectString *cpString(const char *chars, int length)
 {
     uint32_t hash = hashString(chars, length);
-    ObjectString *interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjectString *interned = findString(chars, length, hash);
     if (interned != NULL)
         return interned;
 
@@ -70,7 +76,177 @@ ObjectString *cpString(const char *chars, int length)
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
 
-    return allocateString(heapChars, length, hash);
+    return allocateString(heapChars, length, hash, NULL);
+}
+
+ObjectString *borrowString(ObjectSource *owner, const char *chars, int length)
+{
+    uint32_t hash = hashString(chars, length);
+    ObjectString *interned = findString(chars, length, hash);
+    if (interned != NULL)
+        return interned;
+
+    // no copy, the string just points into owner's bytes.
+    return allocateString(chars, length, hash, owner);
+}
+
+ObjectSource *newSource(const char *bytes, size_t length, bool isMapped)
+{
+    ObjectSource *source = ALLOCATE_OBJ(ObjectSource, OBJECT_SOURCE);
+    source->bytes = bytes;
+    source->length = length;
+    source->isMapped = isMapped;
+    return source;
+}
+
+ObjectMap *newMap()
+{
+    ObjectMap *map = ALLOCATE_OBJ(ObjectMap, OBJECT_MAP);
+    map->count = 0;
+    map->entryCount = 0;
+    map->entryCapacity = 0;
+    map->entries = NULL;
+    map->slotCapacity = 0;
+    map->slots = NULL;
+    return map;
+}
+
+ObjectArray *newArray()
+{
+    ObjectArray *array = ALLOCATE_OBJ(ObjectArray, OBJECT_ARRAY);
+    initValueArr(&array->items);
+    return array;
+}
+
+// zero-filled.
+ObjectTypedArray *newTypedArray(typed_t kind, int length)
+{
+    ObjectTypedArray *array = ALLOCATE_OBJ(ObjectTypedArray, OBJECT_TYPED_ARRAY);
+    array->kind = kind;
+    array->length = 0;
+    array->as.f64 = NULL;
+
+    // an empty one keeps no storage, a zero sized allocation is NULL.
+    if (length == 0)
+        return array;
+    push(OBJ_VAL(array));
+    if (kind == TYPED_FLOAT64)
+    {
+        array->as.f64 = ALLOCATE(double, length);
+        memset(array->as.f64, 0, sizeof(double) * length);
+    }
+    else
+    {
+        array->as.i64 = ALLOCATE(int64_t, length);
+        memset(array->as.i64, 0, sizeof(int64_t) * length);
+    }
+    array->length = length;
+    pop();
+    return array;
+}
+
+ObjectShape *newShape(ObjectShape *parent, ObjectString *name)
+{
+    ObjectShape *shape = ALLOCATE_OBJ(ObjectShape, OBJECT_SHAPE);
+    shape->parent = parent;
+    shape->name = name;
+    shape->slotCount = parent == NULL ? 0 : parent->slotCount + 1;
+    initTable(&shape->transitions);
+    return shape;
+}
+
+ObjectRecord *newRecord()
+{
+    ObjectRecord *record = ALLOCATE_OBJ(ObjectRecord, OBJECT_RECORD);
+    record->shape = REF(vm->rootShape);
+    record->capacity = 0;
+    record->fields = NULL;
+    return record;
+}
+
+// a copy of from, or an empty node when from is NULL.
+ObjectVectorNode *newVectorNode(ObjectVectorNode *from)
+{
+    ObjectVectorNode *node = ALLOCATE_OBJ(ObjectVectorNode, OBJECT_VECTOR_NODE);
+    for (int i = 0; i < PERSISTENT_WIDTH; i++)
+    {
+        node->slots[i] = from == NULL ? NULL_VAL : from->slots[i];
+    }
+    return node;
+}
+
+ObjectPVector *newPVector(int count, int shift, ObjectVectorNode *root, ObjectVectorNode *tail)
+{
+    ObjectPVector *vector = ALLOCATE_OBJ(ObjectPVector, OBJECT_PVECTOR);
+    vector->count = count;
+    vector->shift = shift;
+    vector->root = root;
+    vector->tail = tail;
+    return vector;
+}
+
+// entries are left as nulls for the caller to fill.
+ObjectHamtNode *newHamtNode(int size)
+{
+    ObjectHamtNode *node = (ObjectHamtNode *)allocateObject(
+        sizeof(ObjectHamtNode) + sizeof(Value) * 2 * size, OBJECT_HAMT_NODE);
+    node->isCollision = false;
+    node->bitmap = 0;
+    node->hash = 0;
+    node->size = size;
+    for (int i = 0; i < 2 * size; i++)
+    {
+        node->entries[i] = NULL_VAL;
+    }
+    return node;
+}
+
+ObjectPMap *newPMap(int count, ObjectHamtNode *root)
+{
+    ObjectPMap *map = ALLOCATE_OBJ(ObjectPMap, OBJECT_PMAP);
+    map->count = count;
+    map->root = root;
+    return map;
+}
+
+ObjectSeq *newSeq(seq_t kind, ObjectSeq *parent, Value value)
+{
+    ObjectSeq *seq = ALLOCATE_OBJ(ObjectSeq, OBJECT_SEQ);
+    seq->kind = kind;
+    seq->parent = parent;
+    seq->value = value;
+    seq->start = 0;
+    seq->end = 0;
+    seq->step = 1;
+    seq->depth = parent == NULL ? 0 : parent->depth + 1;
+    return seq;
+}
+
+ObjectSeqIter *newSeqIter(ObjectSeq *seq)
+{
+    ObjectSeqIter *iter = ALLOCATE_OBJ(ObjectSeqIter, OBJECT_SEQ_ITER);
+    iter->seq = seq;
+    iter->cursor = seq->kind == SEQ_RANGE ? seq->start : 0;
+    iter->done = false;
+    iter->stageCount = 0;
+    iter->stages = NULL;
+    iter->taken = NULL;
+
+    push(OBJ_VAL(iter));
+    int count = seq->depth + 1;
+    iter->stages = ALLOCATE(ObjectSeq *, count);
+    iter->stageCount = count;
+    iter->taken = ALLOCATE(int, count);
+    for (int i = count - 1; i >= 0; i--)
+    {
+        iter->stages[i] = seq;
+        iter->taken[i] = 0;
+        if (seq->kind == SEQ_TAKE && seq->end <= 0)
+            iter->done = true;
+        seq = seq->parent;
+    }
+    pop();
+    return iter;
 }
 
 ObjectUpvalue *newUpvalue(Value *slot)
@@ -84,12 +260,50 @@ ObjectUpvalue *newUpvalue(Value *slot)
 
 static void printFunction(ObjectFunction *function)
 {
-    if (function->name == NULL)
+    ObjectString *name = DEREF(ObjectString, function->name);
+    if (name == NULL)
     {
         printf("[ script ]");
         return;
     }
-    printf("[ func %s ]", function->name->chars);
+    printf("[ func %.*s ]", name->length, name->chars);
+}
+
+static void printArray(ObjectArray *array)
+{
+    // an array can contain itself, stop after a few levels.
+    static __thread int depth = 0;
+    if (depth == 8)
+    {
+        printf("[...]");
+        return;
+    }
+
+    depth++;
+    printf("[");
+    for (int i = 0; i < array->items.size; i++)
+    {
+        if (i > 0)
+            printf(", ");
+        printValue(array->items.values[i]);
+    }
+    printf("]");
+    depth--;
+}
+
+static void printTypedArray(ObjectTypedArray *array)
+{
+    printf(array->kind == TYPED_FLOAT64 ? "Float64Array[" : "Int64Array[");
+    for (int i = 0; i < array->length; i++)
+    {
+        if (i > 0)
+            printf(", ");
+        if (array->kind == TYPED_FLOAT64)
+            printf("%.15g", array->as.f64[i]);
+        else
+            printf("%lld", (long long)array->as.i64[i]);
+    }
+    printf("]");
 }
 
 void printObject(Value value)
@@ -97,13 +311,13 @@ void printObject(Value value)
     switch (OBJ_TYPE(value))
     {
     case OBJECT_STRING:
-        printf("%s", AS_CSTRING(value));
+        printf("%.*s", AS_STRING(value)->length, AS_CSTRING(value));
         break;
     case OBJECT_FUNCTION:
         printFunction(AS_FUNCTION(value));
         break;
     case OBJECT_CLOSURE:
-        printFunction(AS_CLOSURE(value)->function);
+        printFunction(DEREF(ObjectFunction, AS_CLOSURE(value)->function));
         break;
     case OBJECT_NATIVE:
         printf("[ native func ]");
@@ -111,26 +325,63 @@ void printObject(Value value)
     case OBJECT_UPVALUE:
         printf("upvalue");
         break;
+    case OBJECT_SOURCE:
+        printf("[ source ]");
+        break;
+    case OBJECT_MAP:
+        printMap(AS_MAP(value));
+        break;
+    case OBJECT_ARRAY:
+        printArray(AS_ARRAY(value));
+        break;
+    case OBJECT_TYPED_ARRAY:
+        printTypedArray(AS_TYPED_ARRAY(value));
+        break;
+    case OBJECT_SHAPE:
+        printf("[ shape ]");
+        break;
+    case OBJECT_RECORD:
+        printRecord(AS_RECORD(value));
+        break;
+    case OBJECT_VECTOR_NODE:
+    case OBJECT_HAMT_NODE:
+        printf("[ node ]");
+        break;
+    case OBJECT_PVECTOR:
+        printPVector(AS_PVECTOR(value));
+        break;
+    case OBJECT_PMAP:
+        printPMap(AS_PMAP(value));
+        break;
+    case OBJECT_SEQ:
+        printf("[ seq ]");
+        break;
+    case OBJECT_SEQ_ITER:
+        printf("[ seq iterator ]");
+        break;
     }
 }
 
-ObjectNative *newNative(NativeFn function)
+ObjectNative *newNative(NativeFn function, int arity)
 {
     ObjectNative *native = ALLOCATE_OBJ(ObjectNative, OBJECT_NATIVE);
     native->function = function;
+    native->arity = arity;
+    native->host = NULL;
+    native->data = NULL;
     return native;
 }
 
 ObjectClosure *newClosure(ObjectFunction *function)
 {
-    ObjectUpvalue **upvalues = ALLOCATE(ObjectUpvalue *, function->upvalueCount);
+    OBJ_REF(ObjectUpvalue) *upvalues = ALLOCATE(OBJ_REF(ObjectUpvalue), function->upvalueCount);
     for (int i = 0; i < function->upvalueCount; i++)
     {
-        upvalues[i] = NULL;
+        upvalues[i] = REF(NULL);
     }
 
     ObjectClosure *closure = ALLOCATE_OBJ(ObjectClosure, OBJECT_CLOSURE);
-    closure->function = function;
+    closure->function = REF(function);
     closure->upvalues = upvalues;
     closure->upvalueCount = function->upvalueCount;
     return closure;
@@ -139,13 +390,13 @@ ObjectClosure *newClosure(ObjectFunction *function)
 ObjectString *takeString(char *chars, int length)
 {
     uint32_t hash = hashString(chars, length);
-    ObjectString *interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjectString *interned = findString(chars, length, hash);
     if (interned != NULL)
     {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
     }
-    return allocateString(chars, length, hash);
+    return allocateString(chars, length, hash, NULL);
 }
 
 char *object2string(Value value)
@@ -156,18 +407,18 @@ char *object2string(Value value)
     {
         ObjectString *stringObj = AS_STRING(value);
         char *string = malloc(sizeof(char) * stringObj->length + 3);
-        snprintf(string, stringObj->length + 3, "%s", stringObj->chars);
+        snprintf(string, stringObj->length + 3, "%.*s", stringObj->length, stringObj->chars);
         return string;
     }
     case OBJECT_FUNCTION:
     {
-        ObjectFunction *function = AS_FUNCTION(value);
-        if (function->name == NULL)
+        ObjectString *name = DEREF(ObjectString, AS_FUNCTION(value)->name);
+        if (name == NULL)
         {
             return "[ script ]";
         }
-        char *string = malloc(sizeof(char) * function->name->length + 12);
-        snprintf(string, function->name->length + 12, "[ func %s ]", function->name->chars);
+        char *string = malloc(sizeof(char) * name->length + 12);
+        snprintf(string, name->length + 12, "[ func %.*s ]", name->length, name->chars);
         return string;
     }
     case OBJECT_NATIVE:
@@ -178,13 +429,14 @@ char *object2string(Value value)
     }
     case OBJECT_CLOSURE:
     {
-        ObjectFunction *function = AS_CLOSURE(value)->function;
-        if (function->name == NULL)
+        ObjectFunction *function = DEREF(ObjectFunction, AS_CLOSURE(value)->function);
+        ObjectString *name = DEREF(ObjectString, function->name);
+        if (name == NULL)
         {
             return "[ closure ]";
         }
-        char *string = malloc(sizeof(char) * function->name->length + 12);
-        snprintf(string, function->name->length + 12, "[ func %s ]", function->name->chars);
+        char *string = malloc(sizeof(char) * name->length + 12);
+        snprintf(string, name->length + 12, "[ func %.*s ]", name->length, name->chars);
         return string;
         break;
     }
@@ -194,6 +446,74 @@ char *object2string(Value value)
         snprintf(up, 12, "%s", "[ upvalue ]");
         return up;
     }
+    case OBJECT_SOURCE:
+    {
+        char *source = malloc(sizeof(char) * 12);
+        snprintf(source, 11, "%s", "[ source ]");
+        return source;
+    }
+    case OBJECT_MAP:
+    {
+        char *map = malloc(sizeof(char) * 9);
+        snprintf(map, 8, "%s", "[ map ]");
+        return map;
+    }
+    case OBJECT_ARRAY:
+    {
+        char *array = malloc(sizeof(char) * 11);
+        snprintf(array, 10, "%s", "[ array ]");
+        return array;
+    }
+    case OBJECT_TYPED_ARRAY:
+    {
+        const char *name = AS_TYPED_ARRAY(value)->kind == TYPED_FLOAT64 ? "[ Float64Array ]" : "[ Int64Array ]";
+        char *array = malloc(sizeof(char) * (strlen(name) + 1));
+        snprintf(array, strlen(name) + 1, "%s", name);
+        return array;
+    }
+    case OBJECT_SHAPE:
+    {
+        char *shape = malloc(sizeof(char) * 11);
+        snprintf(shape, 10, "%s", "[ shape ]");
+        return shape;
+    }
+    case OBJECT_RECORD:
+    {
+        char *record = malloc(sizeof(char) * 12);
+        snprintf(record, 11, "%s", "[ record ]");
+        return record;
+    }
+    case OBJECT_VECTOR_NODE:
+    case OBJECT_HAMT_NODE:
+    {
+        char *node = malloc(sizeof(char) * 10);
+        snprintf(node, 9, "%s", "[ node ]");
+        return node;
+    }
+    case OBJECT_PVECTOR:
+    {
+        char *vector = malloc(sizeof(char) * 13);
+        snprintf(vector, 12, "%s", "[ pvector ]");
+        return vector;
+    }
+    case OBJECT_PMAP:
+    {
+        char *map = malloc(sizeof(char) * 10);
+        snprintf(map, 9, "%s", "[ pmap ]");
+        return map;
+    }
+    case OBJECT_SEQ:
+    {
+        char *seq = malloc(sizeof(char) * 9);
+        snprintf(seq, 8, "%s", "[ seq ]");
+        return seq;
+    }
+    case OBJECT_SEQ_ITER:
+    {
+        char *iter = malloc(sizeof(char) * 18);
+        snprintf(iter, 17, "%s", "[ seq iterator ]");
+        return iter;
+    }
     default:
     {
         char *unknown = malloc(sizeof(char) * 9);
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "object.h"
+#include "output.h"
+
+// without a buffer everything is written straight through.
+void initOutput(OutputBuffer *output)
+{
+    output->buffer = malloc(OUTPUT_BUFFER_SIZE);
+    output->size = 0;
+    output->capacity = output->buffer != NULL ? OUTPUT_BUFFER_SIZE : 0;
+    // a person is watching a terminal, show each line as it comes.
+    output->lineBuffered = isatty(STDOUT_FILENO);
+}
+
+void freeOutput(OutputBuffer *output)
+{
+    flushOutput(output);
+    free(output->buffer);
+    output->buffer = NULL;
+    output->capacity = 0;
+}
+
+void flushOutput(OutputBuffer *output)
+{
+    if (output->size > 0)
+    {
+        fwrite(output->buffer, 1, output->size, stdout);
+        output->size = 0;
+    }
+    fflush(stdout);
+}
+
+void writeOutput(OutputBuffer *output, const char *chars, size_t length)
+{
+    if (output->size + length > output->capacity || output->buffer == NULL)
+    {
+        flushOutput(output);
+        if (length > output->capacity || output->buffer == NULL)
+        {
+            fwrite(chars, 1, length, stdout);
+            return;
+        }
+    }
+    memcpy(output->buffer + output->size, chars, length);
+    output->size += length;
+}
+
+static void writeNumber(OutputBuffer *output, double number)
+{
+    // integers below 1e15 print the same as "%.15g" does, so skip printf.
+    // the range is checked first, casting anything outside it is undefined.
+    if (isfinite(number) && fabs(number) < 1e15 &&
+        number == (double)(int64_t)number && !(number == 0 && signbit(number)))
+    {
+        char digits[24];
+        char *end = digits + sizeof(digits);
+        char *start = end;
+        int64_t n = (int64_t)number;
+        uint64_t u = n < 0 ? (uint64_t)(-n) : (uint64_t)n;
+        do
+        {
+            *--start = (char)('0' + u % 10);
+            u /= 10;
+        } while (u != 0);
+        if (n < 0)
+            *--start = '-';
+        writeOutput(output, start, (size_t)(end - start));
+        return;
+    }
+
+    char formatted[32];
+    int length = snprintf(formatted, sizeof(formatted), "%.15g", number);
+    writeOutput(output, formatted, (size_t)length);
+}
+
+void writeOutputValue(OutputBuffer *output, Value value)
+{
+    switch (value.t)
+    {
+    case VALUE_NULL:
+        writeOutput(output, "null", 4);
+        break;
+    case VALUE_BOOLEAN:
+        if (AS_BOOL(value))
+            writeOutput(output, "true", 4);
+        else
+            writeOutput(output, "false", 5);
+        break;
+    case VALUE_NUMBER:
+        writeNumber(output, AS_NUMBER(value));
+        break;
+    case VALUE_OBJECT:
+        if (IS_STRING(value))
+        {
+            writeOutput(output, AS_CSTRING(value), (size_t)AS_STRING(value)->length);
+            break;
+        }
+        // rare object kinds still go through stdio, keep the order.
+        flushOutput(output);
+        printObject(value);
+        break;
+    }
+}
+
+void writeOutputLine(OutputBuffer *output, Value value)
+{
+    writeOutputValue(output, value);
+    writeOutput(output, "\n", 1);
+    if (output->lineBuffered)
+        flushOutput(output);
+}
\ No newline at end of file
@@ -0,0 +1,522 @@
+#include <stdio.h>
+
+#include "map.h"
+#include "mem.h"
+#include "persistent.h"
+#include "vm.h"
+
+#define AS_VECTOR_NODE(value) ((ObjectVectorNode *)AS_OBJ(value))
+#define AS_HAMT_NODE(value) ((ObjectHamtNode *)AS_OBJ(value))
+
+// every node built here is pushed until it's linked into something
+// reachable, a collection can run on any allocation.
+
+static int tailOffset(int count)
+{
+    if (count < PERSISTENT_WIDTH)
+        return 0;
+    return ((count - 1) >> PERSISTENT_BITS) << PERSISTENT_BITS;
+}
+
+Value pvectorGet(ObjectPVector *vector, int index)
+{
+    if (index >= tailOffset(vector->count))
+        return vector->tail->slots[index & PERSISTENT_MASK];
+
+    ObjectVectorNode *node = vector->root;
+    for (int level = vector->shift; level > 0; level -= PERSISTENT_BITS)
+    {
+        node = AS_VECTOR_NODE(node->slots[(index >> level) & PERSISTENT_MASK]);
+    }
+    return node->slots[index & PERSISTENT_MASK];
+}
+
+// a chain of single-child branches down to node.
+static ObjectVectorNode *newPath(int level, ObjectVectorNode *node)
+{
+    if (level == 0)
+        return node;
+
+    ObjectVectorNode *branch = newVectorNode(NULL);
+    push(OBJ_VAL(branch));
+    ObjectVectorNode *child = newPath(level - PERSISTENT_BITS, node);
+    branch->slots[0] = OBJ_VAL(child);
+    pop();
+    return branch;
+}
+
+static ObjectVectorNode *pushTail(int count, int level, ObjectVectorNode *parent, ObjectVectorNode *tail)
+{
+    int index = ((count - 1) >> level) & PERSISTENT_MASK;
+    ObjectVectorNode *branch = newVectorNode(parent);
+    push(OBJ_VAL(branch));
+
+    ObjectVectorNode *child;
+    if (level == PERSISTENT_BITS)
+        child = tail;
+    else if (parent != NULL && !IS_NULL(parent->slots[index]))
+        child = pushTail(count, level - PERSISTENT_BITS, AS_VECTOR_NODE(parent->slots[index]), tail);
+    else
+        child = newPath(level - PERSISTENT_BITS, tail);
+    branch->slots[index] = OBJ_VAL(child);
+
+    pop();
+    return branch;
+}
+
+ObjectPVector *pvectorConj(ObjectPVector *vector, Value value)
+{
+    int count = vector->count;
+    int shift = vector->shift;
+    ObjectVectorNode *root = vector->root;
+
+    // room in the tail, copy just that.
+    if (count - tailOffset(count) < PERSISTENT_WIDTH)
+    {
+        ObjectVectorNode *tail = newVectorNode(vector->tail);
+        tail->slots[count - tailOffset(count)] = value;
+        push(OBJ_VAL(tail));
+        ObjectPVector *result = newPVector(count + 1, shift, root, tail);
+        pop();
+        return result;
+    }
+
+    // the full tail moves into the trie, which grows a level when the
+    // root has no room left.
+    if ((count >> PERSISTENT_BITS) > (1 << shift))
+    {
+        root = newVectorNode(NULL);
+        push(OBJ_VAL(root));
+        root->slots[0] = OBJ_VAL(vector->root);
+        ObjectVectorNode *path = newPath(shift, vector->tail);
+        root->slots[1] = OBJ_VAL(path);
+        shift += PERSISTENT_BITS;
+    }
+    else
+    {
+        root = pushTail(count, shift, vector->root, vector->tail);
+        push(OBJ_VAL(root));
+    }
+
+    ObjectVectorNode *tail = newVectorNode(NULL);
+    tail->slots[0] = value;
+    push(OBJ_VAL(tail));
+    ObjectPVector *result = newPVector(count + 1, shift, root, tail);
+    pop();
+    pop();
+    return result;
+}
+
+static ObjectVectorNode *assocNode(int level, ObjectVectorNode *node, int index, Value value)
+{
+    ObjectVectorNode *copy = newVectorNode(node);
+    if (level == 0)
+    {
+        copy->slots[index & PERSISTENT_MASK] = value;
+        return copy;
+    }
+
+    push(OBJ_VAL(copy));
+    int slot = (index >> level) & PERSISTENT_MASK;
+    ObjectVectorNode *child = assocNode(level - PERSISTENT_BITS, AS_VECTOR_NODE(node->slots[slot]), index, value);
+    copy->slots[slot] = OBJ_VAL(child);
+    pop();
+    return copy;
+}
+
+// index must be in [0, count], count appends.
+ObjectPVector *pvectorAssoc(ObjectPVector *vector, int index, Value value)
+{
+    if (index == vector->count)
+        return pvectorConj(vector, value);
+
+    ObjectVectorNode *root = vector->root;
+    ObjectVectorNode *tail = vector->tail;
+    if (index >= tailOffset(vector->count))
+    {
+        tail = newVectorNode(tail);
+        tail->slots[index & PERSISTENT_MASK] = value;
+        push(OBJ_VAL(tail));
+    }
+    else
+    {
+        root = assocNode(vector->shift, root, index, value);
+        push(OBJ_VAL(root));
+    }
+
+    ObjectPVector *result = newPVector(vector->count, vector->shift, root, tail);
+    pop();
+    return result;
+}
+
+static int bitIndex(uint32_t bitmap, uint32_t bit)
+{
+    return __builtin_popcount(bitmap & (bit - 1));
+}
+
+static uint32_t bitFor(uint32_t hash, int shift)
+{
+    return 1u << ((hash >> shift) & PERSISTENT_MASK);
+}
+
+static ObjectHamtNode *cloneHamtNode(ObjectHamtNode *node)
+{
+    ObjectHamtNode *copy = newHamtNode(node->size);
+    copy->isCollision = node->isCollision;
+    copy->bitmap = node->bitmap;
+    copy->hash = node->hash;
+    for (int i = 0; i < 2 * node->size; i++)
+    {
+        copy->entries[i] = node->entries[i];
+    }
+    return copy;
+}
+
+bool pmapGet(ObjectPMap *map, Value key, Value *value)
+{
+    uint32_t hash = hashMapKey(key);
+    ObjectHamtNode *node = map->root;
+    for (int shift = 0; node != NULL; shift += PERSISTENT_BITS)
+    {
+        if (node->isCollision)
+        {
+            for (int i = 0; i < node->size; i++)
+            {
+                if (valuesEqual(node->entries[2 * i], key))
+                {
+                    *value = node->entries[2 * i + 1];
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        uint32_t bit = bitFor(hash, shift);
+        if ((node->bitmap & bit) == 0)
+            return false;
+
+        int index = bitIndex(node->bitmap, bit);
+        Value k = node->entries[2 * index];
+        if (IS_NULL(k))
+        {
+            node = AS_HAMT_NODE(node->entries[2 * index + 1]);
+            continue;
+        }
+        if (!valuesEqual(k, key))
+            return false;
+        *value = node->entries[2 * index + 1];
+        return true;
+    }
+    return false;
+}
+
+// a node holding two keys that landed in the same slot one level up.
+static ObjectHamtNode *splitNode(int shift, Value k1, uint32_t h1, Value v1, Value k2, uint32_t h2, Value v2)
+{
+    if (h1 == h2)
+    {
+        ObjectHamtNode *node = newHamtNode(2);
+        node->isCollision = true;
+        node->hash = h1;
+        node->entries[0] = k1;
+        node->entries[1] = v1;
+        node->entries[2] = k2;
+        node->entries[3] = v2;
+        return node;
+    }
+
+    uint32_t b1 = bitFor(h1, shift);
+    uint32_t b2 = bitFor(h2, shift);
+    if (b1 == b2)
+    {
+        ObjectHamtNode *node = newHamtNode(1);
+        node->bitmap = b1;
+        push(OBJ_VAL(node));
+        ObjectHamtNode *child = splitNode(shift + PERSISTENT_BITS, k1, h1, v1, k2, h2, v2);
+        node->entries[1] = OBJ_VAL(child);
+        pop();
+        return node;
+    }
+
+    ObjectHamtNode *node = newHamtNode(2);
+    node->bitmap = b1 | b2;
+    int first = b1 < b2 ? 0 : 2;
+    node->entries[first] = k1;
+    node->entries[first + 1] = v1;
+    node->entries[2 - first] = k2;
+    node->entries[3 - first] = v2;
+    return node;
+}
+
+// returns node itself when nothing changed.
+static ObjectHamtNode *assocHamt(ObjectHamtNode *node, int shift, uint32_t hash, Value key, Value value, bool *added)
+{
+    if (node == NULL)
+    {
+        ObjectHamtNode *leaf = newHamtNode(1);
+        leaf->bitmap = bitFor(hash, shift);
+        leaf->entries[0] = key;
+        leaf->entries[1] = value;
+        *added = true;
+        return leaf;
+    }
+
+    if (node->isCollision)
+    {
+        if (node->hash != hash)
+        {
+            // nest the collision node one level down and insert beside it.
+            ObjectHamtNode *parent = newHamtNode(1);
+            parent->bitmap = bitFor(node->hash, shift);
+            parent->entries[1] = OBJ_VAL(node);
+            push(OBJ_VAL(parent));
+            ObjectHamtNode *result = assocHamt(parent, shift, hash, key, value, added);
+            pop();
+            return result;
+        }
+
+        for (int i = 0; i < node->size; i++)
+        {
+            if (valuesEqual(node->entries[2 * i], key))
+            {
+                if (valuesEqual(node->entries[2 * i + 1], value))
+                    return node;
+                ObjectHamtNode *copy = cloneHamtNode(node);
+                copy->entries[2 * i + 1] = value;
+                return copy;
+            }
+        }
+
+        ObjectHamtNode *copy = newHamtNode(node->size + 1);
+        copy->isCollision = true;
+        copy->hash = hash;
+        for (int i = 0; i < 2 * node->size; i++)
+        {
+            copy->entries[i] = node->entries[i];
+        }
+        copy->entries[2 * node->size] = key;
+        copy->entries[2 * node->size + 1] = value;
+        *added = true;
+        return copy;
+    }
+
+    uint32_t bit = bitFor(hash, shift);
+    int index = bitIndex(node->bitmap, bit);
+    if ((node->bitmap & bit) == 0)
+    {
+        ObjectHamtNode *copy = newHamtNode(node->size + 1);
+        copy->bitmap = node->bitmap | bit;
+        for (int i = 0; i < 2 * index; i++)
+        {
+            copy->entries[i] = node->entries[i];
+        }
+        copy->entries[2 * index] = key;
+        copy->entries[2 * index + 1] = value;
+        for (int i = 2 * index; i < 2 * node->size; i++)
+        {
+            copy->entries[i + 2] = node->entries[i];
+        }
+        *added = true;
+        return copy;
+    }
+
+    Value k = node->entries[2 * index];
+    Value v = node->entries[2 * index + 1];
+    ObjectHamtNode *child;
+    if (IS_NULL(k))
+    {
+        child = assocHamt(AS_HAMT_NODE(v), shift + PERSISTENT_BITS, hash, key, value, added);
+        if (child == AS_HAMT_NODE(v))
+            return node;
+    }
+    else if (valuesEqual(k, key))
+    {
+        if (valuesEqual(v, value))
+            return node;
+        ObjectHamtNode *copy = cloneHamtNode(node);
+        copy->entries[2 * index + 1] = value;
+        return copy;
+    }
+    else
+    {
+        child = splitNode(shift + PERSISTENT_BITS, k, hashMapKey(k), v, key, hash, value);
+        *added = true;
+    }
+
+    push(OBJ_VAL(child));
+    ObjectHamtNode *copy = cloneHamtNode(node);
+    copy->entries[2 * index] = NULL_VAL;
+    copy->entries[2 * index + 1] = OBJ_VAL(child);
+    pop();
+    return copy;
+}
+
+ObjectPMap *pmapAssoc(ObjectPMap *map, Value key, Value value)
+{
+    // -0 and 0 are the same key.
+    if (IS_NUMBER(key) && AS_NUMBER(key) == 0)
+        key = NUMBER_VAL(0);
+
+    bool added = false;
+    ObjectHamtNode *root = assocHamt(map->root, 0, hashMapKey(key), key, value, &added);
+    if (root == map->root)
+        return map;
+
+    push(OBJ_VAL(root));
+    ObjectPMap *result = newPMap(map->count + (added ? 1 : 0), root);
+    pop();
+    return result;
+}
+
+// a copy of node without pair index, NULL when nothing is left.
+static ObjectHamtNode *removePair(ObjectHamtNode *node, int index, uint32_t bit)
+{
+    if (node->size == 1)
+        return NULL;
+
+    ObjectHamtNode *copy = newHamtNode(node->size - 1);
+    copy->isCollision = node->isCollision;
+    copy->bitmap = node->bitmap & ~bit;
+    copy->hash = node->hash;
+    for (int i = 0, j = 0; i < node->size; i++)
+    {
+        if (i == index)
+            continue;
+        copy->entries[2 * j] = node->entries[2 * i];
+        copy->entries[2 * j + 1] = node->entries[2 * i + 1];
+        j++;
+    }
+    return copy;
+}
+
+static ObjectHamtNode *dissocHamt(ObjectHamtNode *node, int shift, uint32_t hash, Value key)
+{
+    if (node->isCollision)
+    {
+        for (int i = 0; i < node->size; i++)
+        {
+            if (valuesEqual(node->entries[2 * i], key))
+                return removePair(node, i, 0);
+        }
+        return node;
+    }
+
+    uint32_t bit = bitFor(hash, shift);
+    if ((node->bitmap & bit) == 0)
+        return node;
+
+    int index = bitIndex(node->bitmap, bit);
+    Value k = node->entries[2 * index];
+    if (!IS_NULL(k))
+        return valuesEqual(k, key) ? removePair(node, index, bit) : node;
+
+    ObjectHamtNode *child = AS_HAMT_NODE(node->entries[2 * index + 1]);
+    ObjectHamtNode *newChild = dissocHamt(child, shift + PERSISTENT_BITS, hash, key);
+    if (newChild == child)
+        return node;
+    if (newChild == NULL)
+        return removePair(node, index, bit);
+
+    push(OBJ_VAL(newChild));
+    ObjectHamtNode *copy = cloneHamtNode(node);
+    copy->entries[2 * index + 1] = OBJ_VAL(newChild);
+    pop();
+    return copy;
+}
+
+ObjectPMap *pmapDissoc(ObjectPMap *map, Value key)
+{
+    if (map->root == NULL)
+        return map;
+
+    ObjectHamtNode *root = dissocHamt(map->root, 0, hashMapKey(key), key);
+    if (root == map->root)
+        return map;
+
+    if (root != NULL)
+        push(OBJ_VAL(root));
+    ObjectPMap *result = newPMap(map->count - 1, root);
+    if (root != NULL)
+        pop();
+    return result;
+}
+
+static void collectKeys(ObjectHamtNode *node, ObjectArray *keys)
+{
+    for (int i = 0; i < node->size; i++)
+    {
+        Value key = node->entries[2 * i];
+        if (IS_NULL(key))
+            collectKeys(AS_HAMT_NODE(node->entries[2 * i + 1]), keys);
+        else
+        {
+            writeValueArr(&keys->items, key);
+            writeBarrier((Object *)keys, key);
+        }
+    }
+}
+
+// keys in trie order, the array and map must be reachable.
+void pmapKeys(ObjectPMap *map, ObjectArray *keys)
+{
+    if (map->root != NULL)
+        collectKeys(map->root, keys);
+}
+
+void printPVector(ObjectPVector *vector)
+{
+    static __thread int depth = 0;
+    if (depth == 8)
+    {
+        printf("pvector[...]");
+        return;
+    }
+
+    depth++;
+    printf("pvector[");
+    for (int i = 0; i < vector->count; i++)
+    {
+        if (i > 0)
+            printf(", ");
+        printValue(pvectorGet(vector, i));
+    }
+    printf("]");
+    depth--;
+}
+
+static void printHamtNode(ObjectHamtNode *node, bool *first)
+{
+    for (int i = 0; i < node->size; i++)
+    {
+        Value key = node->entries[2 * i];
+        if (IS_NULL(key))
+        {
+            printHamtNode(AS_HAMT_NODE(node->entries[2 * i + 1]), first);
+            continue;
+        }
+        if (!*first)
+            printf(", ");
+        *first = false;
+        printValue(key);
+        printf(": ");
+        printValue(node->entries[2 * i + 1]);
+    }
+}
+
+void printPMap(ObjectPMap *map)
+{
+    static __thread int depth = 0;
+    if (depth == 8)
+    {
+        printf("pmap{...}");
+        return;
+    }
+
+    depth++;
+    printf("pmap{");
+    bool first = true;
+    if (map->root != NULL)
+        printHamtNode(map->root, &first);
+    printf("}");
+    depth--;
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include <stdio.h>
+
+#include "mem.h"
+#include "record.h"
+#include "vm.h"
+
+// -1 when the shape has no such field. only the slow path of a field
+// access gets here, inline caches skip it.
+int shapeSlot(ObjectShape *shape, ObjectString *name)
+{
+    for (; shape->parent != NULL; shape = shape->parent)
+    {
+        if (shape->name == name)
+            return shape->slotCount - 1;
+    }
+    return -1;
+}
+
+// the shape a record moves to when it gains name.
+ObjectShape *shapeTransition(ObjectShape *shape, ObjectString *name)
+{
+    Value next;
+    if (tableGet(&shape->transitions, name, &next))
+        return (ObjectShape *)AS_OBJ(next);
+
+    ObjectShape *child = newShape(shape, name);
+    push(OBJ_VAL(child));
+    preWriteBarrier((Object *)shape);
+    tableSet(&shape->transitions, name, OBJ_VAL(child));
+    writeBarrierObject((Object *)shape, (Object *)name);
+    writeBarrierObject((Object *)shape, (Object *)child);
+    pop();
+    return child;
+}
+
+// the record and value must be reachable, the slots may grow.
+void recordAddField(ObjectRecord *record, ObjectShape *shape, Value value)
+{
+    preWriteBarrier((Object *)record);
+    if (record->capacity < shape->slotCount)
+    {
+        int oldCapacity = record->capacity;
+        int capacity = GROW_ARRAY_SIZE(oldCapacity);
+        record->fields = GROW_ARRAY(Value, record->fields, oldCapacity, capacity);
+        record->capacity = capacity;
+    }
+    record->fields[shape->slotCount - 1] = value;
+    record->shape = REF(shape);
+    writeBarrier((Object *)record, value);
+    writeBarrierObject((Object *)record, (Object *)shape);
+}
+
+static void printFields(ObjectRecord *record, ObjectShape *shape)
+{
+    if (shape->parent == NULL)
+        return;
+
+    printFields(record, shape->parent);
+    if (shape->parent->parent != NULL)
+        printf(", ");
+    printf("%.*s: ", shape->name->length, shape->name->chars);
+    printValue(record->fields[shape->slotCount - 1]);
+}
+
+void printRecord(ObjectRecord *record)
+{
+    // a record can contain itself, stop after a few levels.
+    static __thread int depth = 0;
+    if (depth == 8)
+    {
+        printf("record {...}");
+        return;
+    }
+
+    depth++;
+    printf("record {");
+    printFields(record, DEREF(ObjectShape, record->shape));
+    printf("}");
+    depth--;
+}
\ No newline at end of file
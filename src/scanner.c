@@ -3,7 +3,6 @@
 
 #include "common.h"
 #include "scanner.h"
-#include "mem.h"
 
 typedef struct
 {
@@ -13,7 +12,8 @@ typedef struct
     int sourceIndex;
 } Scanner;
 
-Scanner scanner;
+// one per thread, like the compiler driving it.
+static __thread Scanner scanner;
 
 void initScanner(const char *source)
 {
@@ -243,7 +243,9 @@ static token_t detectIdentifier()
             switch (scanner.start[1])
             {
             case 'f':
-                return TOKEN_IF;
+                return detectReservedWord(2, 0, "", TOKEN_IF);
+            case 'n':
+                return detectReservedWord(2, 0, "", TOKEN_IN);
                 // case 'o':
                 //     return detectReservedWord(2, 5, "olean", TOKEN_VT_BOOLEAN);
             }
@@ -295,7 +297,17 @@ static token_t detectIdentifier()
             switch (scanner.start[1])
             {
             case 'e':
-                return detectReservedWord(2, 4, "turn", TOKEN_RETURN);
+                if (scanner.current - scanner.start > 2)
+                {
+                    switch (scanner.start[2])
+                    {
+                    case 'c':
+                        return detectReservedWord(3, 3, "ord", TOKEN_RECORD);
+                    case 't':
+                        return detectReservedWord(3, 3, "urn", TOKEN_RETURN);
+                    }
+                }
+                break;
             }
         }
         break;
@@ -380,56 +392,13 @@ static Token makeNumber()
 
 static Token makeString()
 {
-#define CONCAT_STRING(pointer, c, length)                    \
-    pointer = GROW_ARRAY(char, pointer, length, length + 1); \
-    str[length++] = c;
-
-    char *str = NULL;
-    int strLength = 0;
     bool shouldEscape = false;
 
-    // opening quote
-    CONCAT_STRING(str, '"', strLength);
-
+    // escapes are decoded by the compiler, the token just spans the
+    // source so plain literals can borrow their chars from it.
     while ((peek() != '"' || shouldEscape) && !isEOF() && !(peek() == '\n'))
     {
-        if (shouldEscape)
-        {
-            char c = peek();
-            switch (c)
-            {
-            case 'n':
-            {
-                CONCAT_STRING(str, '\n', strLength);
-                shouldEscape = false;
-                break;
-            }
-            case 't':
-            {
-                CONCAT_STRING(str, '\t', strLength);
-                shouldEscape = false;
-                break;
-            }
-            default:
-            {
-                CONCAT_STRING(str, '\\', strLength);
-                CONCAT_STRING(str, peek(), strLength);
-                shouldEscape = false;
-                break;
-            }
-            }
-        }
-        else
-        {
-            if (peek() == '\\')
-            {
-                shouldEscape = true;
-            }
-            else
-            {
-                CONCAT_STRING(str, peek(), strLength);
-            }
-        }
+        shouldEscape = !shouldEscape && peek() == '\\';
         advance();
     }
 
@@ -438,21 +407,7 @@ static Token makeString()
 
     // The closing quote.
     advance();
-    CONCAT_STRING(str, '"', strLength);
-
-    Token token;
-    token.t = TOKEN_STRING_LITERAL;
-
-    token.start = str;
-    token.length = strLength;
-    FREE_ARRAY(char, str, strLength);
-    str = NULL;
-
-    token.line = scanner.line;
-    token.sourceIndex = scanner.sourceIndex;
-
-    return token;
-#undef CONCAT_STRING
+    return makeToken(TOKEN_STRING_LITERAL);
 }
 
 Token scanToken()
@@ -477,8 +432,16 @@ Token scanToken()
         return makeToken(TOKEN_LPAREN);
     case ')':
         return makeToken(TOKEN_RPAREN);
+    case '{':
+        return makeToken(TOKEN_LBRACE);
+    case '}':
+        return makeToken(TOKEN_RBRACE);
+    case '[':
+        return makeToken(TOKEN_LBRACKET);
+    case ']':
+        return makeToken(TOKEN_RBRACKET);
     case '-':
-        return makeToken(TOKEN_MINUS);
+        return makeToken(match('>') ? TOKEN_ARROW : TOKEN_MINUS);
     case '+':
         return makeToken(TOKEN_PLUS);
     case '/':
@@ -493,6 +456,8 @@ Token scanToken()
         return makeToken(TOKEN_DOT);
     case ',':
         return makeToken(TOKEN_COMMA);
+    case ':':
+        return makeToken(TOKEN_COLON);
     case ';':
         return makeToken(TOKEN_SEMICOLON);
     case '!':
@@ -0,0 +1,108 @@
+#include "seq.h"
+#include "persistent.h"
+#include "vm.h"
+
+bool isSeqSource(Value value)
+{
+    return IS_ARRAY(value) || IS_TYPED_ARRAY(value) || IS_PVECTOR(value);
+}
+
+static bool sourceNext(ObjectSeqIter *iter, ObjectSeq *source, Value *value)
+{
+    if (source->kind == SEQ_RANGE)
+    {
+        if (source->step > 0 ? iter->cursor >= source->end : iter->cursor <= source->end)
+            return false;
+        *value = NUMBER_VAL(iter->cursor);
+        iter->cursor += source->step;
+        return true;
+    }
+
+    int cursor = (int)iter->cursor;
+    if (IS_ARRAY(source->value))
+    {
+        ObjectArray *array = AS_ARRAY(source->value);
+        if (cursor >= array->items.size)
+            return false;
+        *value = array->items.values[cursor];
+    }
+    else if (IS_TYPED_ARRAY(source->value))
+    {
+        ObjectTypedArray *array = AS_TYPED_ARRAY(source->value);
+        if (cursor >= array->length)
+            return false;
+        *value = array->kind == TYPED_FLOAT64
+                     ? NUMBER_VAL(array->as.f64[cursor])
+                     : NUMBER_VAL((double)array->as.i64[cursor]);
+    }
+    else
+    {
+        ObjectPVector *vector = AS_PVECTOR(source->value);
+        if (cursor >= vector->count)
+            return false;
+        *value = pvectorGet(vector, cursor);
+    }
+    iter->cursor++;
+    return true;
+}
+
+// the stages are fused: one value goes through all of them before the
+// next one is pulled, so no intermediate collection is ever built. a stage
+// can run a minor collection, so the iterator is read back from its slot
+// after each one and the value on its way through is kept on the stack.
+bool seqNext(Value *iterator, Value *value, bool *hasNext)
+{
+    while (!AS_SEQ_ITER(*iterator)->done)
+    {
+        ObjectSeqIter *iter = AS_SEQ_ITER(*iterator);
+        push(NULL_VAL);
+        Value *current = vm->stackTop - 1;
+        if (!sourceNext(iter, iter->stages[0], current))
+        {
+            iter->done = true;
+            pop();
+            break;
+        }
+
+        bool keep = true;
+        for (int i = 1; i < AS_SEQ_ITER(*iterator)->stageCount && keep; i++)
+        {
+            iter = AS_SEQ_ITER(*iterator);
+            ObjectSeq *stage = iter->stages[i];
+            PreparedCall call = {stage->value, 1, true};
+            switch (stage->kind)
+            {
+            case SEQ_MAP:
+                if (!callPrepared(&call, current, current))
+                    return false;
+                break;
+            case SEQ_FILTER:
+            {
+                Value test;
+                if (!callPrepared(&call, current, &test))
+                    return false;
+                keep = !isFalse(test);
+                break;
+            }
+            case SEQ_TAKE:
+                // stop pulling as soon as the limit is met, the source
+                // may well be infinite.
+                if (++iter->taken[i] >= stage->end)
+                    iter->done = true;
+                break;
+            default:
+                break;
+            }
+        }
+
+        Value next = pop();
+        if (keep)
+        {
+            *value = next;
+            *hasNext = true;
+            return true;
+        }
+    }
+    *hasNext = false;
+    return true;
+}
\ No newline at end of file
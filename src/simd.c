@@ -0,0 +1,486 @@
+#include <pthread.h>
+
+#include "simd.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
+
+// avx2 kernels are compiled for that target only and chosen at runtime,
+// the binary still runs on cpus without it.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define SIMD_AVX2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+SimdKernels simd;
+
+// integer kernels wrap on overflow like the hardware does.
+#define WRAP_ADD(a, b) ((int64_t)((uint64_t)(a) + (uint64_t)(b)))
+#define WRAP_MUL(a, b) ((int64_t)((uint64_t)(a) * (uint64_t)(b)))
+
+static double sumF64Scalar(const double *data, int length)
+{
+    double sum = 0;
+    for (int i = 0; i < length; i++)
+        sum += data[i];
+    return sum;
+}
+
+static double minF64Scalar(const double *data, int length)
+{
+    double min = data[0];
+    for (int i = 1; i < length; i++)
+        min = data[i] < min ? data[i] : min;
+    return min;
+}
+
+static double maxF64Scalar(const double *data, int length)
+{
+    double max = data[0];
+    for (int i = 1; i < length; i++)
+        max = data[i] > max ? data[i] : max;
+    return max;
+}
+
+static double dotF64Scalar(const double *a, const double *b, int length)
+{
+    double sum = 0;
+    for (int i = 0; i < length; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static void scaleF64Scalar(double *data, int length, double factor)
+{
+    for (int i = 0; i < length; i++)
+        data[i] *= factor;
+}
+
+static void addF64Scalar(double *dst, const double *src, int length)
+{
+    for (int i = 0; i < length; i++)
+        dst[i] += src[i];
+}
+
+static void prefixSumF64Scalar(double *data, int length)
+{
+    for (int i = 1; i < length; i++)
+        data[i] += data[i - 1];
+}
+
+static int64_t sumI64Scalar(const int64_t *data, int length)
+{
+    int64_t sum = 0;
+    for (int i = 0; i < length; i++)
+        sum = WRAP_ADD(sum, data[i]);
+    return sum;
+}
+
+static int64_t minI64Scalar(const int64_t *data, int length)
+{
+    int64_t min = data[0];
+    for (int i = 1; i < length; i++)
+        min = data[i] < min ? data[i] : min;
+    return min;
+}
+
+static int64_t maxI64Scalar(const int64_t *data, int length)
+{
+    int64_t max = data[0];
+    for (int i = 1; i < length; i++)
+        max = data[i] > max ? data[i] : max;
+    return max;
+}
+
+static int64_t dotI64Scalar(const int64_t *a, const int64_t *b, int length)
+{
+    int64_t sum = 0;
+    for (int i = 0; i < length; i++)
+        sum = WRAP_ADD(sum, WRAP_MUL(a[i], b[i]));
+    return sum;
+}
+
+static void scaleI64Scalar(int64_t *data, int length, int64_t factor)
+{
+    for (int i = 0; i < length; i++)
+        data[i] = WRAP_MUL(data[i], factor);
+}
+
+static void addI64Scalar(int64_t *dst, const int64_t *src, int length)
+{
+    for (int i = 0; i < length; i++)
+        dst[i] = WRAP_ADD(dst[i], src[i]);
+}
+
+static void prefixSumI64Scalar(int64_t *data, int length)
+{
+    for (int i = 1; i < length; i++)
+        data[i] = WRAP_ADD(data[i], data[i - 1]);
+}
+
+#ifdef SIMD_SSE2
+// two accumulators hide the latency of the adds.
+static double sumF64Sse2(const double *data, int length)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(data + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(data + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < length; i++)
+        sum += data[i];
+    return sum;
+}
+
+static double minF64Sse2(const double *data, int length)
+{
+    __m128d acc = _mm_set1_pd(data[0]);
+    int i = 0;
+    for (; i + 2 <= length; i += 2)
+        acc = _mm_min_pd(acc, _mm_loadu_pd(data + i));
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    for (; i < length; i++)
+        min = data[i] < min ? data[i] : min;
+    return min;
+}
+
+static double maxF64Sse2(const double *data, int length)
+{
+    __m128d acc = _mm_set1_pd(data[0]);
+    int i = 0;
+    for (; i + 2 <= length; i += 2)
+        acc = _mm_max_pd(acc, _mm_loadu_pd(data + i));
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    for (; i < length; i++)
+        max = data[i] > max ? data[i] : max;
+    return max;
+}
+
+static double dotF64Sse2(const double *a, const double *b, int length)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < length; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static void scaleF64Sse2(double *data, int length, double factor)
+{
+    __m128d k = _mm_set1_pd(factor);
+    int i = 0;
+    for (; i + 2 <= length; i += 2)
+        _mm_storeu_pd(data + i, _mm_mul_pd(_mm_loadu_pd(data + i), k));
+    for (; i < length; i++)
+        data[i] *= factor;
+}
+
+static void addF64Sse2(double *dst, const double *src, int length)
+{
+    int i = 0;
+    for (; i + 2 <= length; i += 2)
+        _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+    for (; i < length; i++)
+        dst[i] += src[i];
+}
+
+// scan inside the register, then add the running total of the blocks
+// before it.
+static void prefixSumF64Sse2(double *data, int length)
+{
+    __m128d carry = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= length; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(data + i);
+        x = _mm_add_pd(x, _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(x), 8)));
+        x = _mm_add_pd(x, carry);
+        _mm_storeu_pd(data + i, x);
+        carry = _mm_unpackhi_pd(x, x);
+    }
+    for (; i < length; i++)
+        data[i] += i > 0 ? data[i - 1] : 0;
+}
+
+static int64_t sumI64Sse2(const int64_t *data, int length)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= length; i += 2)
+        acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i *)(data + i)));
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    int64_t sum = WRAP_ADD(lanes[0], lanes[1]);
+    for (; i < length; i++)
+        sum = WRAP_ADD(sum, data[i]);
+    return sum;
+}
+
+static void addI64Sse2(int64_t *dst, const int64_t *src, int length)
+{
+    int i = 0;
+    for (; i + 2 <= length; i += 2)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi64(a, b));
+    }
+    for (; i < length; i++)
+        dst[i] = WRAP_ADD(dst[i], src[i]);
+}
+#endif
+
+#ifdef SIMD_AVX2
+TARGET_AVX2 static double sumF64Avx2(const double *data, int length)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(data + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(data + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < length; i++)
+        sum += data[i];
+    return sum;
+}
+
+TARGET_AVX2 static double minF64Avx2(const double *data, int length)
+{
+    __m256d acc = _mm256_set1_pd(data[0]);
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+        acc = _mm256_min_pd(acc, _mm256_loadu_pd(data + i));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double min = lanes[0];
+    for (int j = 1; j < 4; j++)
+        min = lanes[j] < min ? lanes[j] : min;
+    for (; i < length; i++)
+        min = data[i] < min ? data[i] : min;
+    return min;
+}
+
+TARGET_AVX2 static double maxF64Avx2(const double *data, int length)
+{
+    __m256d acc = _mm256_set1_pd(data[0]);
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+        acc = _mm256_max_pd(acc, _mm256_loadu_pd(data + i));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double max = lanes[0];
+    for (int j = 1; j < 4; j++)
+        max = lanes[j] > max ? lanes[j] : max;
+    for (; i < length; i++)
+        max = data[i] > max ? data[i] : max;
+    return max;
+}
+
+TARGET_AVX2 static double dotF64Avx2(const double *a, const double *b, int length)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < length; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+TARGET_AVX2 static void scaleF64Avx2(double *data, int length, double factor)
+{
+    __m256d k = _mm256_set1_pd(factor);
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+        _mm256_storeu_pd(data + i, _mm256_mul_pd(_mm256_loadu_pd(data + i), k));
+    for (; i < length; i++)
+        data[i] *= factor;
+}
+
+TARGET_AVX2 static void addF64Avx2(double *dst, const double *src, int length)
+{
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i)));
+    for (; i < length; i++)
+        dst[i] += src[i];
+}
+
+// shift by one lane, then by two, then add the carry from the last block.
+TARGET_AVX2 static void prefixSumF64Avx2(double *data, int length)
+{
+    __m256d zero = _mm256_setzero_pd();
+    __m256d carry = zero;
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(data + i);
+        x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, 0x90), zero, 0x1));
+        x = _mm256_add_pd(x, _mm256_permute2f128_pd(x, x, 0x08));
+        x = _mm256_add_pd(x, carry);
+        _mm256_storeu_pd(data + i, x);
+        carry = _mm256_permute4x64_pd(x, 0xff);
+    }
+    for (; i < length; i++)
+        data[i] += i > 0 ? data[i - 1] : 0;
+}
+
+TARGET_AVX2 static int64_t sumI64Avx2(const int64_t *data, int length)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+        acc = _mm256_add_epi64(acc, _mm256_loadu_si256((const __m256i *)(data + i)));
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    int64_t sum = 0;
+    for (int j = 0; j < 4; j++)
+        sum = WRAP_ADD(sum, lanes[j]);
+    for (; i < length; i++)
+        sum = WRAP_ADD(sum, data[i]);
+    return sum;
+}
+
+TARGET_AVX2 static int64_t minI64Avx2(const int64_t *data, int length)
+{
+    __m256i acc = _mm256_set1_epi64x(data[0]);
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(data + i));
+        acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    int64_t min = lanes[0];
+    for (int j = 1; j < 4; j++)
+        min = lanes[j] < min ? lanes[j] : min;
+    for (; i < length; i++)
+        min = data[i] < min ? data[i] : min;
+    return min;
+}
+
+TARGET_AVX2 static int64_t maxI64Avx2(const int64_t *data, int length)
+{
+    __m256i acc = _mm256_set1_epi64x(data[0]);
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(data + i));
+        acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    int64_t max = lanes[0];
+    for (int j = 1; j < 4; j++)
+        max = lanes[j] > max ? lanes[j] : max;
+    for (; i < length; i++)
+        max = data[i] > max ? data[i] : max;
+    return max;
+}
+
+TARGET_AVX2 static void addI64Avx2(int64_t *dst, const int64_t *src, int length)
+{
+    int i = 0;
+    for (; i + 4 <= length; i += 4)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi64(a, b));
+    }
+    for (; i < length; i++)
+        dst[i] = WRAP_ADD(dst[i], src[i]);
+}
+#endif
+
+static void pickKernels()
+{
+    simd.level = "scalar";
+    simd.sumF64 = sumF64Scalar;
+    simd.minF64 = minF64Scalar;
+    simd.maxF64 = maxF64Scalar;
+    simd.dotF64 = dotF64Scalar;
+    simd.scaleF64 = scaleF64Scalar;
+    simd.addF64 = addF64Scalar;
+    simd.prefixSumF64 = prefixSumF64Scalar;
+    simd.sumI64 = sumI64Scalar;
+    simd.minI64 = minI64Scalar;
+    simd.maxI64 = maxI64Scalar;
+    simd.dotI64 = dotI64Scalar;
+    simd.scaleI64 = scaleI64Scalar;
+    simd.addI64 = addI64Scalar;
+    simd.prefixSumI64 = prefixSumI64Scalar;
+
+#ifdef SIMD_SSE2
+    simd.level = "sse2";
+    simd.sumF64 = sumF64Sse2;
+    simd.minF64 = minF64Sse2;
+    simd.maxF64 = maxF64Sse2;
+    simd.dotF64 = dotF64Sse2;
+    simd.scaleF64 = scaleF64Sse2;
+    simd.addF64 = addF64Sse2;
+    simd.prefixSumF64 = prefixSumF64Sse2;
+    simd.sumI64 = sumI64Sse2;
+    simd.addI64 = addI64Sse2;
+#endif
+
+#ifdef SIMD_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        simd.level = "avx2";
+        simd.sumF64 = sumF64Avx2;
+        simd.minF64 = minF64Avx2;
+        simd.maxF64 = maxF64Avx2;
+        simd.dotF64 = dotF64Avx2;
+        simd.scaleF64 = scaleF64Avx2;
+        simd.addF64 = addF64Avx2;
+        simd.prefixSumF64 = prefixSumF64Avx2;
+        simd.sumI64 = sumI64Avx2;
+        simd.minI64 = minI64Avx2;
+        simd.maxI64 = maxI64Avx2;
+        simd.addI64 = addI64Avx2;
+    }
+#endif
+}
+
+// every isolate asks, the first one picks.
+void initSimd()
+{
+    static pthread_once_t picked = PTHREAD_ONCE_INIT;
+    pthread_once(&picked, pickKernels);
+}
\ No newline at end of file
@@ -0,0 +1,755 @@
+#include <string.h>
+
+#ifndef SORT_NO_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "mem.h"
+#include "sort.h"
+#include "vm.h"
+
+#define INSERTION_SORT_MAX 24
+#define NINTHER_MIN 128
+#define PARTIAL_INSERTION_LIMIT 8
+#define MERGE_RUN 32
+#define SIGN_BIT (1ULL << 63)
+
+typedef enum
+{
+    ORDER_NUMBERS,
+    ORDER_STRINGS,
+    ORDER_NONE,
+} order_t;
+
+static order_t naturalOrder(Value *values, int count)
+{
+    bool numbers = true;
+    bool strings = true;
+    for (int i = 0; i < count && (numbers || strings); i++)
+    {
+        numbers = numbers && IS_NUMBER(values[i]);
+        strings = strings && IS_STRING(values[i]);
+    }
+    return numbers ? ORDER_NUMBERS : strings ? ORDER_STRINGS : ORDER_NONE;
+}
+
+static int compareStrings(ObjectString *a, ObjectString *b)
+{
+    int length = a->length < b->length ? a->length : b->length;
+    int order = memcmp(a->chars, b->chars, length);
+    return order != 0 ? order : a->length - b->length;
+}
+
+static int log2Floor(int count)
+{
+    int log = 0;
+    while ((count >> log) > 1)
+        log++;
+    return log;
+}
+
+// doubles and signed integers map onto unsigned keys that sort the same
+// way, so a single radix sort serves numbers of every kind.
+static inline uint64_t f64Key(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits & SIGN_BIT ? ~bits : bits | SIGN_BIT;
+}
+
+static inline double keyF64(uint64_t key)
+{
+    uint64_t bits = key & SIGN_BIT ? key & ~SIGN_BIT : ~key;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void radixSort(uint64_t *keys, uint64_t *scratch, int length)
+{
+    if (length < 2)
+        return;
+
+    size_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < length; i++)
+    {
+        uint64_t key = keys[i];
+        for (int byte = 0; byte < 8; byte++)
+            counts[byte][(key >> (byte * 8)) & 0xff]++;
+    }
+
+    uint64_t *src = keys;
+    uint64_t *dst = scratch;
+    for (int byte = 0; byte < 8; byte++)
+    {
+        int shift = byte * 8;
+        size_t *count = counts[byte];
+        // every key shares this byte, the pass would only copy.
+        if (count[(src[0] >> shift) & 0xff] == (size_t)length)
+            continue;
+
+        size_t offset = 0;
+        for (int bucket = 0; bucket < 256; bucket++)
+        {
+            size_t size = count[bucket];
+            count[bucket] = offset;
+            offset += size;
+        }
+        for (int i = 0; i < length; i++)
+            dst[count[(src[i] >> shift) & 0xff]++] = src[i];
+
+        uint64_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != keys)
+        memcpy(keys, src, sizeof(uint64_t) * length);
+}
+
+static void mergeKeys(const uint64_t *a, int aLength, const uint64_t *b, int bLength, uint64_t *out)
+{
+    int i = 0, j = 0, k = 0;
+    while (i < aLength && j < bLength)
+        out[k++] = b[j] < a[i] ? b[j++] : a[i++];
+    while (i < aLength)
+        out[k++] = a[i++];
+    while (j < bLength)
+        out[k++] = b[j++];
+}
+
+#ifndef SORT_NO_THREADS
+typedef struct
+{
+    uint64_t *keys;
+    uint64_t *scratch;
+    int length;
+    const uint64_t *other;
+    int otherLength;
+} SortJob;
+
+static void *radixWorker(void *arg)
+{
+    SortJob *job = arg;
+    radixSort(job->keys, job->scratch, job->length);
+    return NULL;
+}
+
+static void *mergeWorker(void *arg)
+{
+    SortJob *job = arg;
+    mergeKeys(job->keys, job->length, job->other, job->otherLength, job->scratch);
+    return NULL;
+}
+
+static void runJobs(void *(*worker)(void *), SortJob *jobs, int count)
+{
+    pthread_t threads[SORT_THREADS_MAX];
+    bool started[SORT_THREADS_MAX];
+    for (int i = 0; i < count; i++)
+        started[i] = pthread_create(&threads[i], NULL, worker, &jobs[i]) == 0;
+    for (int i = 0; i < count; i++)
+    {
+        // no thread to spare, do that part here.
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            worker(&jobs[i]);
+    }
+}
+
+static int sortThreads(int length)
+{
+    if (length < SORT_PARALLEL_MIN)
+        return 1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = 1;
+    while (threads * 2 <= cpus && threads * 2 <= SORT_THREADS_MAX)
+        threads *= 2;
+    return threads;
+}
+
+// radix sorts a chunk per thread, then merges the chunks pairwise with a
+// thread per pair until one run is left.
+static void parallelSort(uint64_t *keys, uint64_t *scratch, int length, int threads)
+{
+    int bounds[SORT_THREADS_MAX + 1];
+    SortJob jobs[SORT_THREADS_MAX];
+    for (int i = 0; i <= threads; i++)
+        bounds[i] = (int)((int64_t)length * i / threads);
+
+    for (int i = 0; i < threads; i++)
+    {
+        jobs[i].keys = keys + bounds[i];
+        jobs[i].scratch = scratch + bounds[i];
+        jobs[i].length = bounds[i + 1] - bounds[i];
+    }
+    runJobs(radixWorker, jobs, threads);
+
+    uint64_t *src = keys;
+    uint64_t *dst = scratch;
+    for (int width = 1; width < threads; width *= 2)
+    {
+        int count = 0;
+        for (int i = 0; i < threads; i += 2 * width)
+        {
+            SortJob *job = &jobs[count++];
+            job->keys = src + bounds[i];
+            job->length = bounds[i + width] - bounds[i];
+            job->other = src + bounds[i + width];
+            job->otherLength = bounds[i + 2 * width] - bounds[i + width];
+            job->scratch = dst + bounds[i];
+        }
+        runJobs(mergeWorker, jobs, count);
+
+        uint64_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != keys)
+        memcpy(keys, src, sizeof(uint64_t) * length);
+}
+#endif
+
+static void sortKeys(uint64_t *keys, int length)
+{
+    uint64_t *scratch = ALLOCATE(uint64_t, length);
+#ifndef SORT_NO_THREADS
+    int threads = sortThreads(length);
+    if (threads > 1)
+        parallelSort(keys, scratch, length, threads);
+    else
+#endif
+        radixSort(keys, scratch, length);
+    FREE_ARRAY(uint64_t, scratch, length);
+}
+
+static void sortNumbers(Value *values, int length)
+{
+    uint64_t *keys = ALLOCATE(uint64_t, length);
+    for (int i = 0; i < length; i++)
+        keys[i] = f64Key(AS_NUMBER(values[i]));
+    sortKeys(keys, length);
+    for (int i = 0; i < length; i++)
+        values[i] = NUMBER_VAL(keyF64(keys[i]));
+    FREE_ARRAY(uint64_t, keys, length);
+}
+
+void sortTypedArray(ObjectTypedArray *array)
+{
+    int length = array->length;
+    if (length < 2)
+        return;
+
+    uint64_t *keys = ALLOCATE(uint64_t, length);
+    for (int i = 0; i < length; i++)
+    {
+        keys[i] = array->kind == TYPED_FLOAT64
+                      ? f64Key(array->as.f64[i])
+                      : (uint64_t)array->as.i64[i] ^ SIGN_BIT;
+    }
+    sortKeys(keys, length);
+    for (int i = 0; i < length; i++)
+    {
+        if (array->kind == TYPED_FLOAT64)
+            array->as.f64[i] = keyF64(keys[i]);
+        else
+            array->as.i64[i] = (int64_t)(keys[i] ^ SIGN_BIT);
+    }
+    FREE_ARRAY(uint64_t, keys, length);
+}
+
+// pattern-defeating quicksort. it only ever swaps, so every value stays in
+// the array while the comparator runs and can collect. the scans are all
+// bounds checked, a comparator that isn't a strict order can't overrun.
+typedef struct
+{
+    Value *values;
+    order_t order;
+    bool compare;
+    PreparedCall call;
+    bool failed;
+} Sorter;
+
+static bool less(Sorter *sorter, Value a, Value b)
+{
+    if (sorter->failed)
+        return false;
+    if (!sorter->compare)
+    {
+        return sorter->order == ORDER_STRINGS
+                   ? compareStrings(AS_STRING(a), AS_STRING(b)) < 0
+                   : AS_NUMBER(a) < AS_NUMBER(b);
+    }
+
+    Value args[2] = {a, b};
+    Value result;
+    if (!callPrepared(&sorter->call, args, &result))
+    {
+        sorter->failed = true;
+        return false;
+    }
+    if (!IS_NUMBER(result))
+    {
+        runtimeError("sort() comparator must return a number.");
+        sorter->failed = true;
+        return false;
+    }
+    return AS_NUMBER(result) < 0;
+}
+
+#define LESS(a, b) less(sorter, sorter->values[a], sorter->values[b])
+
+static inline void swapValues(Sorter *sorter, int a, int b)
+{
+    Value value = sorter->values[a];
+    sorter->values[a] = sorter->values[b];
+    sorter->values[b] = value;
+}
+
+static void insertionSort(Sorter *sorter, int lo, int hi)
+{
+    for (int i = lo + 1; i < hi; i++)
+    {
+        for (int j = i; j > lo && LESS(j, j - 1); j--)
+            swapValues(sorter, j, j - 1);
+    }
+}
+
+// finishes a nearly sorted range, gives up once it has moved too much.
+static bool partialInsertionSort(Sorter *sorter, int lo, int hi)
+{
+    int moves = 0;
+    for (int i = lo + 1; i < hi; i++)
+    {
+        int j = i;
+        for (; j > lo && LESS(j, j - 1); j--)
+            swapValues(sorter, j, j - 1);
+        moves += i - j;
+        if (moves > PARTIAL_INSERTION_LIMIT)
+            return false;
+    }
+    return true;
+}
+
+static void siftDown(Sorter *sorter, int lo, int root, int count)
+{
+    for (;;)
+    {
+        int child = 2 * root + 1;
+        if (child >= count)
+            return;
+        if (child + 1 < count && LESS(lo + child, lo + child + 1))
+            child++;
+        if (!LESS(lo + root, lo + child))
+            return;
+        swapValues(sorter, lo + root, lo + child);
+        root = child;
+    }
+}
+
+static void heapSort(Sorter *sorter, int lo, int hi)
+{
+    int count = hi - lo;
+    for (int i = count / 2 - 1; i >= 0; i--)
+        siftDown(sorter, lo, i, count);
+    for (int end = count - 1; end > 0; end--)
+    {
+        swapValues(sorter, lo, lo + end);
+        siftDown(sorter, lo, 0, end);
+    }
+}
+
+static void sort3(Sorter *sorter, int a, int b, int c)
+{
+    if (LESS(b, a))
+        swapValues(sorter, a, b);
+    if (LESS(c, b))
+        swapValues(sorter, b, c);
+    if (LESS(b, a))
+        swapValues(sorter, a, b);
+}
+
+// the pivot sits at lo. smaller values go left of it, the rest right.
+static int partitionRight(Sorter *sorter, int lo, int hi, bool *alreadyPartitioned)
+{
+    int i = lo + 1;
+    int j = hi - 1;
+    while (i <= j && LESS(i, lo))
+        i++;
+    while (i <= j && !LESS(j, lo))
+        j--;
+    *alreadyPartitioned = i > j;
+
+    while (i < j)
+    {
+        swapValues(sorter, i++, j--);
+        while (i <= j && LESS(i, lo))
+            i++;
+        while (i <= j && !LESS(j, lo))
+            j--;
+    }
+    swapValues(sorter, lo, i - 1);
+    return i - 1;
+}
+
+// used when the pivot equals the one before the range, everything equal
+// to it goes left and needs no more sorting.
+static int partitionLeft(Sorter *sorter, int lo, int hi)
+{
+    int i = lo + 1;
+    int j = hi - 1;
+    for (;;)
+    {
+        while (i <= j && !LESS(lo, i))
+            i++;
+        while (i <= j && LESS(lo, j))
+            j--;
+        if (i >= j)
+            break;
+        swapValues(sorter, i++, j--);
+    }
+    swapValues(sorter, lo, i - 1);
+    return i - 1;
+}
+
+static void pdqSort(Sorter *sorter, int lo, int hi, int badAllowed, bool leftmost)
+{
+    while (!sorter->failed)
+    {
+        int size = hi - lo;
+        if (size < INSERTION_SORT_MAX)
+        {
+            insertionSort(sorter, lo, hi);
+            return;
+        }
+
+        int mid = lo + size / 2;
+        if (size > NINTHER_MIN)
+        {
+            sort3(sorter, lo, mid, hi - 1);
+            sort3(sorter, lo + 1, mid - 1, hi - 2);
+            sort3(sorter, lo + 2, mid + 1, hi - 3);
+            sort3(sorter, mid - 1, mid, mid + 1);
+            swapValues(sorter, lo, mid);
+        }
+        else
+        {
+            sort3(sorter, mid, lo, hi - 1);
+        }
+
+        // everything here is >= the pivot before it, if the new pivot
+        // equals that one the run of equal values is done.
+        if (!leftmost && !LESS(lo - 1, lo))
+        {
+            lo = partitionLeft(sorter, lo, hi) + 1;
+            continue;
+        }
+
+        bool alreadyPartitioned;
+        int pivot = partitionRight(sorter, lo, hi, &alreadyPartitioned);
+        int left = pivot - lo;
+        int right = hi - pivot - 1;
+        if (left < size / 8 || right < size / 8)
+        {
+            if (--badAllowed == 0)
+            {
+                heapSort(sorter, lo, hi);
+                return;
+            }
+            // break up the pattern that keeps giving bad pivots.
+            if (left >= INSERTION_SORT_MAX)
+            {
+                swapValues(sorter, lo, lo + left / 4);
+                swapValues(sorter, pivot - 1, pivot - left / 4);
+            }
+            if (right >= INSERTION_SORT_MAX)
+            {
+                swapValues(sorter, pivot + 1, pivot + 1 + right / 4);
+                swapValues(sorter, hi - 1, hi - right / 4);
+            }
+        }
+        else if (alreadyPartitioned &&
+                 partialInsertionSort(sorter, lo, pivot) &&
+                 partialInsertionSort(sorter, pivot + 1, hi))
+        {
+            return;
+        }
+
+        pdqSort(sorter, lo, pivot, badAllowed, leftmost);
+        lo = pivot + 1;
+        leftmost = false;
+    }
+}
+
+bool sortArray(ObjectArray *array, Value comparator)
+{
+    Sorter sorter;
+    sorter.failed = false;
+    ValueArr *items = &array->items;
+
+    if (IS_NULL(comparator))
+    {
+        preWriteBarrier((Object *)array);
+        sorter.order = naturalOrder(items->values, items->size);
+        if (sorter.order == ORDER_NONE)
+        {
+            runtimeError("sort() needs a comparator unless the array holds only numbers or only strings.");
+            return false;
+        }
+        if (items->size < 2)
+            return true;
+        if (sorter.order == ORDER_NUMBERS)
+        {
+            sortNumbers(items->values, items->size);
+            return true;
+        }
+        // nothing here can collect, strings sort in place.
+        sorter.values = items->values;
+        sorter.compare = false;
+        pdqSort(&sorter, 0, items->size, log2Floor(items->size), true);
+        return true;
+    }
+
+    if (!prepareCall(&sorter.call, comparator, 2))
+        return false;
+    sorter.call.movable = true;
+    if (items->size < 2)
+        return true;
+
+    // the comparator may change the array, so sort a private copy and
+    // only write it back if the array is still the same size. it may also
+    // move both, only their values stay put.
+    int count = items->size;
+    push(OBJ_VAL(array));
+    ObjectArray *copy = newArray();
+    push(OBJ_VAL(copy));
+    copy->items.values = ALLOCATE(Value, count);
+    copy->items.maxSize = count;
+    memcpy(copy->items.values, AS_ARRAY(vm->stackTop[-2])->items.values, sizeof(Value) * count);
+    copy->items.size = count;
+
+    sorter.values = copy->items.values;
+    sorter.compare = true;
+    pdqSort(&sorter, 0, count, log2Floor(count), true);
+    if (sorter.failed)
+        return false;
+    array = AS_ARRAY(vm->stackTop[-2]);
+    copy = AS_ARRAY(vm->stackTop[-1]);
+    if (array->items.size != count)
+    {
+        runtimeError("Array was resized while sorting.");
+        return false;
+    }
+    preWriteBarrier((Object *)array);
+    memcpy(array->items.values, copy->items.values, sizeof(Value) * count);
+    // the comparator may have changed elements, remember the whole array.
+    if (!IN_NURSERY(array) && !array->obj.isRemembered)
+        rememberObject((Object *)array);
+    vm->stackTop -= 2;
+    return true;
+}
+
+static inline bool keyLess(Value *keys, order_t order, int a, int b)
+{
+    return order == ORDER_STRINGS
+               ? compareStrings(AS_STRING(keys[a]), AS_STRING(keys[b])) < 0
+               : AS_NUMBER(keys[a]) < AS_NUMBER(keys[b]);
+}
+
+// stable: insertion sorted runs, then bottom-up merges that prefer the
+// left run on ties.
+static void mergeSortIndices(Value *keys, order_t order, int *index, int *scratch, int count)
+{
+    for (int lo = 0; lo < count; lo += MERGE_RUN)
+    {
+        int hi = lo + MERGE_RUN < count ? lo + MERGE_RUN : count;
+        for (int i = lo + 1; i < hi; i++)
+        {
+            for (int j = i; j > lo && keyLess(keys, order, index[j], index[j - 1]); j--)
+            {
+                int swap = index[j];
+                index[j] = index[j - 1];
+                index[j - 1] = swap;
+            }
+        }
+    }
+
+    int *src = index;
+    int *dst = scratch;
+    for (int width = MERGE_RUN; width < count; width *= 2)
+    {
+        for (int lo = 0; lo < count; lo += 2 * width)
+        {
+            int mid = lo + width < count ? lo + width : count;
+            int hi = lo + 2 * width < count ? lo + 2 * width : count;
+            int i = lo, j = mid, k = lo;
+            while (i < mid && j < hi)
+                dst[k++] = keyLess(keys, order, src[j], src[i]) ? src[j++] : src[i++];
+            while (i < mid)
+                dst[k++] = src[i++];
+            while (j < hi)
+                dst[k++] = src[j++];
+        }
+        int *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != index)
+        memcpy(index, src, sizeof(int) * count);
+}
+
+bool sortArrayBy(ObjectArray *array, Value key)
+{
+    PreparedCall call;
+    if (!prepareCall(&call, key, 1))
+        return false;
+    call.movable = true;
+
+    // keys are computed once each and kept reachable in their own array.
+    // the key function may move both arrays, they're read back after it.
+    int count = array->items.size;
+    push(OBJ_VAL(array));
+    ObjectArray *keys = newArray();
+    push(OBJ_VAL(keys));
+    keys->items.values = ALLOCATE(Value, count);
+    keys->items.maxSize = count;
+    for (int i = 0; i < count; i++)
+    {
+        array = AS_ARRAY(vm->stackTop[-2]);
+        if (count != array->items.size)
+        {
+            runtimeError("Array was resized while sorting.");
+            return false;
+        }
+        Value item = array->items.values[i];
+        Value value;
+        if (!callPrepared(&call, &item, &value))
+            return false;
+        keys = AS_ARRAY(vm->stackTop[-1]);
+        keys->items.values[i] = value;
+        keys->items.size++;
+        writeBarrier((Object *)keys, value);
+    }
+    array = AS_ARRAY(vm->stackTop[-2]);
+
+    order_t order = naturalOrder(keys->items.values, count);
+    if (order == ORDER_NONE)
+    {
+        runtimeError("sortBy() keys must be all numbers or all strings.");
+        return false;
+    }
+    if (count != array->items.size)
+    {
+        runtimeError("Array was resized while sorting.");
+        return false;
+    }
+
+    int *index = ALLOCATE(int, count);
+    int *scratch = ALLOCATE(int, count);
+    Value *sorted = ALLOCATE(Value, count);
+    for (int i = 0; i < count; i++)
+        index[i] = i;
+    mergeSortIndices(keys->items.values, order, index, scratch, count);
+    for (int i = 0; i < count; i++)
+        sorted[i] = array->items.values[index[i]];
+    preWriteBarrier((Object *)array);
+    memcpy(array->items.values, sorted, sizeof(Value) * count);
+
+    FREE_ARRAY(Value, sorted, count);
+    FREE_ARRAY(int, scratch, count);
+    FREE_ARRAY(int, index, count);
+    vm->stackTop -= 2;
+    return true;
+}
+
+bool searchArray(ObjectArray *array, Value target, Value comparator, int *index)
+{
+    PreparedCall call;
+    bool compare = !IS_NULL(comparator);
+    if (compare && !prepareCall(&call, comparator, 2))
+        return false;
+    if (!compare && !IS_NUMBER(target) && !IS_STRING(target))
+    {
+        runtimeError("search() needs a comparator unless it looks for a number or a string.");
+        return false;
+    }
+    call.movable = true;
+
+    // the comparator may move the array and the target.
+    push(OBJ_VAL(array));
+    push(target);
+    int lo = 0;
+    int hi = array->items.size;
+    while (lo < hi)
+    {
+        array = AS_ARRAY(vm->stackTop[-2]);
+        target = vm->stackTop[-1];
+        int mid = lo + (hi - lo) / 2;
+        Value item = array->items.values[mid];
+        double order;
+        if (compare)
+        {
+            Value args[2] = {item, target};
+            Value result;
+            if (!callPrepared(&call, args, &result))
+                return false;
+            if (!IS_NUMBER(result))
+            {
+                runtimeError("search() comparator must return a number.");
+                return false;
+            }
+            order = AS_NUMBER(result);
+            array = AS_ARRAY(vm->stackTop[-2]);
+        }
+        else if (IS_NUMBER(target) && IS_NUMBER(item))
+        {
+            order = AS_NUMBER(item) < AS_NUMBER(target) ? -1 : AS_NUMBER(item) > AS_NUMBER(target);
+        }
+        else if (IS_STRING(target) && IS_STRING(item))
+        {
+            order = compareStrings(AS_STRING(item), AS_STRING(target));
+        }
+        else
+        {
+            runtimeError("search() can't compare values of different types.");
+            return false;
+        }
+
+        if (order < 0)
+            lo = mid + 1;
+        else if (order > 0)
+            hi = mid;
+        else
+        {
+            *index = mid;
+            vm->stackTop -= 2;
+            return true;
+        }
+        // the comparator may have shrunk the array.
+        if (hi > array->items.size)
+            hi = array->items.size;
+    }
+    *index = -lo - 1;
+    vm->stackTop -= 2;
+    return true;
+}
+
+int searchTypedArray(ObjectTypedArray *array, double target)
+{
+    int lo = 0;
+    int hi = array->length;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        double item = array->kind == TYPED_FLOAT64 ? array->as.f64[mid] : (double)array->as.i64[mid];
+        if (item < target)
+            lo = mid + 1;
+        else if (item > target)
+            hi = mid;
+        else
+            return mid;
+    }
+    return -lo - 1;
+}
\ No newline at end of file
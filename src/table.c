@@ -1,54 +1,126 @@
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mem.h"
 #include "object.h"
 #include "table.h"
 #include "vm.h"
 
-#define TABLE_MAX_LOAD 0.75
+// grow once full slots plus tombstones pass 7/8 of the table.
+#define TABLE_MAX_LOAD(maxSize) ((maxSize) - (maxSize) / 8)
+
+// H1 picks the group to start probing at, H2 is kept in the control byte.
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash)&0x7f))
+#define IS_FULL(ctrl) (((ctrl)&0x80) == 0)
+
+typedef uint32_t GroupMask;
+
+static inline GroupMask matchByte(const uint8_t *group, uint8_t b)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b)));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_SIZE; i++)
+    {
+        if (group[i] == b)
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+// empty and deleted are the only control bytes with the high bit set.
+static inline GroupMask matchFree(const uint8_t *group)
+{
+#ifdef __SSE2__
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_SIZE; i++)
+    {
+        if (!IS_FULL(group[i]))
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+#define FIRST_MATCH(mask) ((int)__builtin_ctz(mask))
+#define ITEM_KEY(item) DEREF(ObjectString, (item)->k)
+
+static inline Value itemValue(const TableItem *item)
+{
+    Value v;
+    v.t = item->t;
+    v.as = item->as;
+    return v;
+}
+
+static inline void setItem(TableItem *item, ObjectString *k, Value v)
+{
+    item->k = REF(k);
+    item->t = v.t;
+    item->as = v.as;
+}
 
 void initTable(Table *table)
 {
     table->size = 0;
+    table->tombstones = 0;
     table->maxSize = 0;
+    table->whiteCursor = 0;
+    table->ctrl = NULL;
     table->items = NULL;
 }
 
 void freeTable(Table *table)
 {
+    FREE_ARRAY(uint8_t, table->ctrl, table->maxSize);
     FREE_ARRAY(TableItem, table->items, table->maxSize);
     initTable(table);
 }
 
-TableItem *findTableItem(TableItem *entries, int maxSize, ObjectString *k)
+// groups are probed triangularly, which visits every group of a
+// power-of-two table once before repeating.
+static inline TableItem *findTableItem(Table *table, ObjectString *k)
 {
-    uint32_t index = k->hash % maxSize;
-    TableItem *tombstone = NULL;
+    uint32_t groupMask = ((uint32_t)table->maxSize / TABLE_GROUP_SIZE) - 1;
+    uint32_t group = H1(k->hash) & groupMask;
+    uint8_t h2 = H2(k->hash);
 
-    for (;;)
+    for (uint32_t step = 1;; step++)
     {
-        TableItem *item = &entries[index];
-        if (item->k == NULL)
-        {
-            if (IS_NULL(item->v))
-            {
-                // Empty item.
-                return tombstone != NULL ? tombstone : item;
-            }
-            else
-            {
-                // We found a tombstone.
-                if (tombstone == NULL)
-                    tombstone = item;
-            }
-        }
-        else if (item->k == k)
+        const uint8_t *ctrl = &table->ctrl[group * TABLE_GROUP_SIZE];
+        for (GroupMask m = matchByte(ctrl, h2); m != 0; m &= m - 1)
         {
-            // We found the k.
-            return item;
+            TableItem *item = &table->items[group * TABLE_GROUP_SIZE + FIRST_MATCH(m)];
+            if (item->k == REF(k))
+                return item;
         }
-        index = (index + 1) % maxSize;
+        // the key would have been placed in this group if it existed.
+        if (matchByte(ctrl, CTRL_EMPTY) != 0)
+            return NULL;
+        group = (group + step) & groupMask;
+    }
+}
+
+static int findFreeSlot(const uint8_t *ctrl, int maxSize, uint32_t hash)
+{
+    uint32_t groupMask = ((uint32_t)maxSize / TABLE_GROUP_SIZE) - 1;
+    uint32_t group = H1(hash) & groupMask;
+
+    for (uint32_t step = 1;; step++)
+    {
+        GroupMask m = matchFree(&ctrl[group * TABLE_GROUP_SIZE]);
+        if (m != 0)
+            return (int)(group * TABLE_GROUP_SIZE) + FIRST_MATCH(m);
+        group = (group + step) & groupMask;
     }
 }
 
@@ -57,80 +129,203 @@ bool tableGet(Table *table, ObjectString *k, Value *v)
     if (table->size == 0)
         return false;
 
-    TableItem *item = findTableItem(table->items, table->maxSize, k);
-    if (item->k == NULL)
+    TableItem *item = findTableItem(table, k);
+    if (item == NULL)
         return false;
 
-    *v = item->v;
+    *v = itemValue(item);
     return true;
 }
 
 static void adjustMaxSize(Table *table, int maxSize)
 {
-    TableItem *entries = ALLOCATE(TableItem, maxSize);
-    for (int i = 0; i < maxSize; i++)
-    {
-        entries[i].k = NULL;
-        entries[i].v = NULL_VAL;
-    }
+    uint8_t *ctrl = ALLOCATE(uint8_t, maxSize);
+    TableItem *items = ALLOCATE(TableItem, maxSize);
+    memset(ctrl, CTRL_EMPTY, maxSize);
 
-    table->size = 0;
     for (int i = 0; i < table->maxSize; i++)
     {
-        TableItem *item = &table->items[i];
-        if (item->k == NULL)
+        if (!IS_FULL(table->ctrl[i]))
             continue;
 
-        TableItem *dest = findTableItem(entries, maxSize, item->k);
-        dest->k = item->k;
-        dest->k = item->k;
-        table->size++;
+        TableItem *item = &table->items[i];
+        int index = findFreeSlot(ctrl, maxSize, ITEM_KEY(item)->hash);
+        ctrl[index] = table->ctrl[i];
+        items[index] = *item;
     }
 
+    FREE_ARRAY(uint8_t, table->ctrl, table->maxSize);
     FREE_ARRAY(TableItem, table->items, table->maxSize);
-    table->items = entries;
+    table->ctrl = ctrl;
+    table->items = items;
     table->maxSize = maxSize;
+    table->tombstones = 0;
+    table->whiteCursor = 0;
+}
+
+// rehash in place so every tombstone becomes empty again. it doesn't
+// allocate, so the collector can run it on the string table.
+static void dropTombstones(Table *table)
+{
+    uint8_t *ctrl = table->ctrl;
+    TableItem *items = table->items;
+
+    // from here, DELETED means "full, but not placed yet".
+    for (int i = 0; i < table->maxSize; i++)
+    {
+        ctrl[i] = IS_FULL(ctrl[i]) ? CTRL_DELETED : CTRL_EMPTY;
+    }
+
+    for (int i = 0; i < table->maxSize; i++)
+    {
+        if (ctrl[i] != CTRL_DELETED)
+            continue;
+
+        uint32_t hash = ITEM_KEY(&items[i])->hash;
+        int target = findFreeSlot(ctrl, table->maxSize, hash);
+
+        if (target / TABLE_GROUP_SIZE == i / TABLE_GROUP_SIZE)
+        {
+            // already in the first group a lookup would search.
+            ctrl[i] = H2(hash);
+            continue;
+        }
+
+        if (ctrl[target] == CTRL_EMPTY)
+        {
+            ctrl[target] = H2(hash);
+            items[target] = items[i];
+            ctrl[i] = CTRL_EMPTY;
+            setItem(&items[i], NULL, NULL_VAL);
+            continue;
+        }
+
+        // target still holds an unplaced item, swap and redo this slot.
+        TableItem swapped = items[target];
+        ctrl[target] = H2(hash);
+        items[target] = items[i];
+        items[i] = swapped;
+        i--;
+    }
+    table->tombstones = 0;
+    table->whiteCursor = 0;
 }
 
 bool tableSet(Table *table, ObjectString *k, Value v)
 {
-    if (table->size + 1 > table->maxSize * TABLE_MAX_LOAD)
+    if (table->size > 0)
     {
-        int s = GROW_ARRAY_SIZE(table->maxSize);
-        adjustMaxSize(table, s);
+        TableItem *item = findTableItem(table, k);
+        if (item != NULL)
+        {
+            setItem(item, k, v);
+            return false;
+        }
     }
 
-    TableItem *item = findTableItem(table->items, table->maxSize, k);
+    if (table->size + table->tombstones + 1 > TABLE_MAX_LOAD(table->maxSize))
+    {
+        if (table->size + 1 <= TABLE_MAX_LOAD(table->maxSize) / 2)
+            dropTombstones(table);
+        else
+            adjustMaxSize(table, table->maxSize < TABLE_GROUP_SIZE ? TABLE_GROUP_SIZE : table->maxSize * 2);
+    }
 
-    bool isNew = item->k == NULL;
-    if (isNew && IS_NULL(item->v))
-        table->size++;
+    int index = findFreeSlot(table->ctrl, table->maxSize, k->hash);
+    if (table->ctrl[index] == CTRL_DELETED)
+        table->tombstones--;
 
-    item->k = k;
-    item->v = v;
-    return isNew;
+    table->ctrl[index] = H2(k->hash);
+    setItem(&table->items[index], k, v);
+    table->size++;
+    return true;
 }
 
 void markTable(Table *table)
 {
     for (int i = 0; i < table->maxSize; i++)
     {
+        if (!IS_FULL(table->ctrl[i]))
+            continue;
         TableItem *entry = &table->items[i];
-        markObject((Object *)entry->k);
-        markValue(entry->v);
+        markObject((Object *)ITEM_KEY(entry));
+        markValue(itemValue(entry));
     }
 }
 
-void tableRemoveWhite(Table *table)
+// lets a moving collector update keys and values in place. keys keep
+// their hash, so nothing has to be rehashed.
+void tableVisit(Table *table, ObjectVisitor visit)
 {
     for (int i = 0; i < table->maxSize; i++)
     {
+        if (!IS_FULL(table->ctrl[i]))
+            continue;
         TableItem *entry = &table->items[i];
-        if (entry->k != NULL && !entry->k->object.isMarked)
+        entry->k = REF((ObjectString *)visit((Object *)ITEM_KEY(entry)));
+        if (entry->t == VALUE_OBJECT)
+            entry->as.object = visit(entry->as.object);
+    }
+}
+
+void tableReplaceKey(Table *table, ObjectString *from, ObjectString *to)
+{
+    if (table->size == 0)
+        return;
+    TableItem *item = findTableItem(table, from);
+    if (item != NULL)
+        item->k = REF(to);
+}
+
+static void removeTableItem(Table *table, int index)
+{
+    // a group that already has an empty slot ends every probe reaching
+    // it, so the slot can go straight back to empty.
+    const uint8_t *group = &table->ctrl[index - index % TABLE_GROUP_SIZE];
+    if (matchByte(group, CTRL_EMPTY) != 0)
+    {
+        table->ctrl[index] = CTRL_EMPTY;
+    }
+    else
+    {
+        table->ctrl[index] = CTRL_DELETED;
+        table->tombstones++;
+    }
+    setItem(&table->items[index], NULL, NULL_VAL);
+    table->size--;
+}
+
+// drops unmarked keys from up to slots slots, or all of them when slots
+// is 0, and says whether the whole table is done. young keys are left to
+// the minor collector. the tombstones left behind are purged once the
+// pass reaches the end, lookups would otherwise probe past them until the
+// table next grows.
+bool tableRemoveWhite(Table *table, int slots)
+{
+    int end = table->maxSize;
+    if (slots > 0 && table->whiteCursor + slots < end)
+        end = table->whiteCursor + slots;
+
+    for (int i = table->whiteCursor; i < end; i++)
+    {
+        if (!IS_FULL(table->ctrl[i]))
+            continue;
+        ObjectString *k = ITEM_KEY(&table->items[i]);
+        if (!IN_NURSERY(k) && !heapIsMarked(&k->object))
         {
-            tableDelete(table, entry->k);
+            removeTableItem(table, i);
         }
     }
+
+    if (end < table->maxSize)
+    {
+        table->whiteCursor = end;
+        return false;
+    }
+    table->whiteCursor = 0;
+    if (table->tombstones > 0)
+        dropTombstones(table);
+    return true;
 }
 
 bool tableDelete(Table *table, ObjectString *k)
@@ -139,14 +334,11 @@ bool tableDelete(Table *table, ObjectString *k)
         return false;
 
     // Find the item.
-    TableItem *item = findTableItem(table->items, table->maxSize, k);
-    if (item->k == NULL)
+    TableItem *item = findTableItem(table, k);
+    if (item == NULL)
         return false;
 
-    // Place a tombstone in the item.
-    item->k = NULL;
-    item->v = BOOL_VAL(true);
-
+    removeTableItem(table, (int)(item - table->items));
     return true;
 }
 
@@ -154,10 +346,10 @@ void tableAddAll(Table *from, Table *to)
 {
     for (int i = 0; i < from->maxSize; i++)
     {
-        TableItem *item = &from->items[i];
-        if (item->k != NULL)
+        if (IS_FULL(from->ctrl[i]))
         {
-            tableSet(to, item->k, item->v);
+            TableItem *item = &from->items[i];
+            tableSet(to, ITEM_KEY(item), itemValue(item));
         }
     }
 }
@@ -167,26 +359,27 @@ ObjectString *tableFindString(Table *table, const char *chars, int length, uint3
     if (table->size == 0)
         return NULL;
 
-    uint32_t index = hash % table->maxSize;
+    uint32_t groupMask = ((uint32_t)table->maxSize / TABLE_GROUP_SIZE) - 1;
+    uint32_t group = H1(hash) & groupMask;
+    uint8_t h2 = H2(hash);
 
-    for (;;)
+    for (uint32_t step = 1;; step++)
     {
-        TableItem *item = &table->items[index];
-
-        if (item->k == NULL)
+        const uint8_t *ctrl = &table->ctrl[group * TABLE_GROUP_SIZE];
+        for (GroupMask m = matchByte(ctrl, h2); m != 0; m &= m - 1)
         {
-            // Stop if we find an empty non-tombstone item.
-            if (IS_NULL(item->v))
-                return NULL;
-        }
-        else if (item->k->length == length &&
-                 item->k->hash == hash &&
-                 memcmp(item->k->chars, chars, length) == 0)
-        {
-            // We found it.
-            return item->k;
+            ObjectString *k = ITEM_KEY(&table->items[group * TABLE_GROUP_SIZE + FIRST_MATCH(m)]);
+            if (k->length == length &&
+                k->hash == hash &&
+                memcmp(k->chars, chars, length) == 0)
+            {
+                // We found it.
+                return k;
+            }
         }
-
-        index = (index + 1) % table->maxSize;
+        // Stop at a group with an empty slot.
+        if (matchByte(ctrl, CTRL_EMPTY) != 0)
+            return NULL;
+        group = (group + step) & groupMask;
     }
 }
\ No newline at end of file
@@ -16,9 +16,10 @@ void writeValueArr(ValueArr *arr, Value value)
 {
     if (arr->maxSize < arr->size + 1)
     {
-        int old = arr->maxSize;
-        arr->maxSize = GROW_ARRAY_SIZE(old);
-        arr->values = GROW_ARRAY(Value, arr->values, old, arr->maxSize);
+        // the size only changes once the values have somewhere to go.
+        int maxSize = GROW_ARRAY_SIZE(arr->maxSize);
+        arr->values = GROW_ARRAY(Value, arr->values, arr->maxSize, maxSize);
+        arr->maxSize = maxSize;
     }
     arr->values[arr->size] = value;
     arr->size++;
@@ -1,5 +1,6 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
@@ -11,114 +12,175 @@
 #include "vm.h"
 #include "compiler.h"
 #include "ansi-color.h"
+#include "map.h"
+#include "persistent.h"
+#include "record.h"
+#include "seq.h"
 #include "native.h"
 
-VM vm;
+__thread VM *vm;
+
+static InterpretResult run(int baseFrame);
+static bool refuel(int baseFrame);
 
 static void resetStack()
 {
-    vm.stackTop = vm.stack;
-    vm.frameCount = 0;
-    vm.openUpvalues = NULL;
+    vm->stackTop = vm->stack;
+    vm->frameCount = 0;
+    vm->openUpvalues = NULL;
+    vm->pinned = 0;
 }
 
-static void runtimeError(const char *format, ...)
+void runtimeError(const char *format, ...)
 {
+    // whatever the script printed so far comes before the error.
+    flushOutput(&vm->output);
+
     va_list args;
     va_start(args, format);
     fprintf(stderr, YEL "\nRUNTIME_ERROR: " RESET RED);
     vfprintf(stderr, format, args);
     va_end(args);
     fputs(RESET "\n\n", stderr);
+    // nothing is running yet while compiling.
+    if (vm->frameCount == 0)
+        return;
 
-    CallFrame *frame = &vm.frames[vm.frameCount - 1];
-    ObjectFunction *function = frame->closure->function;
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    ObjectFunction *function = DEREF(ObjectFunction, frame->closure->function);
 
     size_t instruction = frame->ip - function->chunk.code - 1;
     int line = getLine(&function->chunk, instruction);
     fprintf(stderr, YEL "%4d |>" RESET " %s\n", line, "Somewhere in this Line :P");
 
     fprintf(stderr, YEL "\nSTACK: \n\n" RESET RED);
-    for (int i = vm.frameCount - 1; i >= 0; i--)
+    for (int i = vm->frameCount - 1; i >= 0; i--)
     {
-        CallFrame *frame = &vm.frames[i];
-        ObjectFunction *function = frame->closure->function;
+        CallFrame *frame = &vm->frames[i];
+        ObjectFunction *function = DEREF(ObjectFunction, frame->closure->function);
         // -1 because the IP is sitting on the next instruction to be
         // executed.
         size_t instruction = frame->ip - function->chunk.code - 1;
         fprintf(stderr, YEL "%4d |>" RESET " from " YEL, i + 1);
-        if (function->name == NULL)
+        ObjectString *name = DEREF(ObjectString, function->name);
+        if (name == NULL)
         {
             fprintf(stderr, "script");
         }
         else
         {
-            fprintf(stderr, "%s", function->name->chars);
+            fprintf(stderr, "%.*s", name->length, name->chars);
         }
         fprintf(stderr, RESET " at " YEL "line %d\n" RESET, getLine(&function->chunk, instruction));
     }
-    printf("\n");
+    fputs("\n", stderr);
     resetStack();
 }
 
-void initVM()
+VM *enterVM(VM *isolate)
+{
+    VM *previous = vm;
+    vm = isolate;
+    return previous;
+}
+
+// what a new isolate allocates is made under a guard, running out of
+// memory here fails newVM() instead of taking the process down.
+static InterpretResult loadRoots(void *data)
 {
+    vm->rootShape = newShape(NULL, NULL);
+    loadNativeFunction(vm);
+    return INTERPRET_OK;
+}
+
+VM *newVM()
+{
+    VM *isolate = malloc(sizeof(VM));
+    if (isolate == NULL)
+        return NULL;
+    VM *previous = enterVM(isolate);
     resetStack();
-    vm.objects = NULL;
-    vm.bytesAllocated = 0;
-    vm.nextGC = 1024 * 1024;
-    vm.grayCount = 0;
-    vm.grayCapacity = 0;
-    vm.grayStack = NULL;
-    initTable(&vm.globals);
-    initTable(&vm.strings);
+    initHeap();
+    vm->bytesAllocated = 0;
+    vm->nextGC = vm->gcMinHeap;
+    vm->grayCount = 0;
+    vm->grayCapacity = 0;
+    vm->grayStack = NULL;
+    vm->grayOverflow = false;
+    initTable(&vm->globals);
+    initTable(&vm->strings);
+    initValueArr(&vm->handles);
+    initOutput(&vm->output);
+    vm->debugLevel = 0;
+    vm->errorJump = NULL;
+    vm->fuel = INT64_MAX;
+    vm->fuelSlice = INT64_MAX;
+    vm->fuelUsed = 0;
+    vm->fuelLimit = 0;
+    vm->timeLimit = 0;
+    vm->deadline = 0;
+    vm->suspendOnLimit = false;
+    vm->suspended = false;
+    vm->rootShape = NULL;
+    enterVM(previous);
 
-    loadNativeFunction(&vm);
+    if (protectedCall(isolate, loadRoots, NULL) != INTERPRET_OK)
+    {
+        freeVM(isolate);
+        return NULL;
+    }
+    return isolate;
 }
 
-void freeVM()
+void freeVM(VM *isolate)
 {
-    freeTable(&vm.globals);
-    freeTable(&vm.strings);
+    VM *previous = enterVM(isolate);
+    freeOutput(&vm->output);
+    freeTable(&vm->globals);
+    freeTable(&vm->strings);
+    freeValueArr(&vm->handles);
     freeObjects();
+    enterVM(previous != isolate ? previous : NULL);
+    free(isolate);
 }
 
 void push(Value value)
 {
-    *vm.stackTop = value;
-    vm.stackTop++;
+    *vm->stackTop = value;
+    vm->stackTop++;
 }
 
 Value pop()
 {
-    vm.stackTop--;
-    return *vm.stackTop;
+    vm->stackTop--;
+    return *vm->stackTop;
 }
 
 static Value peek(int distance)
 {
-    return vm.stackTop[-1 - distance];
+    return vm->stackTop[-1 - distance];
 }
 
 static bool call(ObjectClosure *closure, int argCount)
 {
-    if (argCount != closure->function->argsCount)
+    ObjectFunction *function = DEREF(ObjectFunction, closure->function);
+    if (argCount != function->argsCount)
     {
-        runtimeError("Expected %d arguments but got %d.", closure->function->argsCount, argCount);
+        runtimeError("Expected %d arguments but got %d.", function->argsCount, argCount);
         return false;
     }
 
-    if (vm.frameCount == FRAMES_MAX)
+    if (vm->frameCount == FRAMES_MAX)
     {
         runtimeError("Oops! stack OVERFLOW.");
         return false;
     }
 
-    CallFrame *frame = &vm.frames[vm.frameCount++];
+    CallFrame *frame = &vm->frames[vm->frameCount++];
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
+    frame->ip = function->chunk.code;
 
-    frame->slots = vm.stackTop - argCount - 1;
+    frame->slots = vm->stackTop - argCount - 1;
     return true;
 }
 
@@ -130,9 +192,16 @@ static bool callValue(Value callee, int argCount)
         {
         case OBJECT_NATIVE:
         {
-            NativeFn native = AS_NATIVE(callee);
-            Value result = native(argCount, vm.stackTop - argCount);
-            vm.stackTop -= argCount + 1;
+            ObjectNative *native = AS_NATIVE(callee);
+            if (native->arity != -1 && argCount != native->arity)
+            {
+                runtimeError("Expected %d arguments but got %d.", native->arity, argCount);
+                return false;
+            }
+            Value result;
+            if (!native->function(argCount, vm->stackTop - argCount, &result))
+                return false;
+            vm->stackTop -= argCount + 1;
             push(result);
             return true;
         }
@@ -148,10 +217,82 @@ static bool callValue(Value callee, int argCount)
     return false;
 }
 
+bool prepareCall(PreparedCall *call, Value callee, int argCount)
+{
+    call->callee = callee;
+    call->argCount = argCount;
+    call->movable = false;
+    if (IS_CLOSURE(callee) && DEREF(ObjectFunction, AS_CLOSURE(callee)->function)->argsCount == argCount)
+        return true;
+    if (IS_NATIVE(callee) && (AS_NATIVE(callee)->arity == -1 || AS_NATIVE(callee)->arity == argCount))
+        return true;
+
+    if (IS_CLOSURE(callee) || IS_NATIVE(callee))
+        runtimeError("Expected a function of %d arguments.", argCount);
+    else
+        runtimeError("Non-functions and non-classes can't be invoked.");
+    return false;
+}
+
+// everything callValue would check was settled by prepareCall, so this
+// only lays out the stack and the frame and runs it. the callee is kept
+// under the call as well, if a collection moves it call gets the new one.
+bool callPrepared(PreparedCall *call, Value *args, Value *result)
+{
+    // a callback uses up fuel like a call does, or a native looping over
+    // them would run past the limits. no base frame, it can't be suspended
+    // halfway.
+    if (--vm->fuel < 0 && !refuel(-1))
+        return false;
+
+    Value *root = vm->stackTop;
+    *vm->stackTop++ = call->callee;
+    Value *base = vm->stackTop;
+    *vm->stackTop++ = call->callee;
+    for (int i = 0; i < call->argCount; i++)
+    {
+        *vm->stackTop++ = args[i];
+    }
+
+    // errors reset it, so it's put back rather than counted down.
+    int pinned = vm->pinned;
+    if (!call->movable)
+        vm->pinned++;
+
+    bool ok;
+    if (IS_NATIVE(call->callee))
+    {
+        ok = AS_NATIVE(call->callee)->function(call->argCount, base + 1, result);
+    }
+    else if (vm->frameCount == FRAMES_MAX)
+    {
+        runtimeError("Oops! stack OVERFLOW.");
+        ok = false;
+    }
+    else
+    {
+        ObjectClosure *closure = AS_CLOSURE(call->callee);
+        CallFrame *frame = &vm->frames[vm->frameCount++];
+        frame->closure = closure;
+        frame->ip = DEREF(ObjectFunction, closure->function)->chunk.code;
+        frame->slots = base;
+        ok = run(vm->frameCount - 1) == INTERPRET_OK;
+        if (ok)
+            *result = pop();
+    }
+
+    vm->pinned = pinned;
+    if (!ok)
+        return false;
+    call->callee = *root;
+    vm->stackTop = root;
+    return true;
+}
+
 static ObjectUpvalue *captureUpvalue(Value *local)
 {
     ObjectUpvalue *prevUpvalue = NULL;
-    ObjectUpvalue *upvalue = vm.openUpvalues;
+    ObjectUpvalue *upvalue = vm->openUpvalues;
 
     while (upvalue != NULL && upvalue->location > local)
     {
@@ -168,7 +309,7 @@ static ObjectUpvalue *captureUpvalue(Value *local)
 
     if (prevUpvalue == NULL)
     {
-        vm.openUpvalues = createdUpvalue;
+        vm->openUpvalues = createdUpvalue;
     }
     else
     {
@@ -179,17 +320,19 @@ static ObjectUpvalue *captureUpvalue(Value *local)
 
 static void closeUpvalues(Value *last)
 {
-    while (vm.openUpvalues != NULL &&
-           vm.openUpvalues->location >= last)
+    while (vm->openUpvalues != NULL &&
+           vm->openUpvalues->location >= last)
     {
-        ObjectUpvalue *upvalue = vm.openUpvalues;
+        ObjectUpvalue *upvalue = vm->openUpvalues;
+        preWriteBarrier((Object *)upvalue);
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
-        vm.openUpvalues = upvalue->next;
+        writeBarrier((Object *)upvalue, upvalue->closed);
+        vm->openUpvalues = upvalue->next;
     }
 }
 
-static bool isFalse(Value value)
+bool isFalse(Value value)
 {
     return IS_BOOL(value) && !AS_BOOL(value);
 }
@@ -211,14 +354,358 @@ static void concatenate()
     push(OBJ_VAL(result));
 }
 
-static InterpretResult run(int debugLevel)
+static bool arrayIndex(int size, Value index, int *slot)
+{
+    if (!IS_NUMBER(index))
+    {
+        runtimeError("Array index must be a number.");
+        return false;
+    }
+    double number = AS_NUMBER(index);
+    if (!(number >= 0 && number < size) || number != (int)number)
+    {
+        runtimeError("Array index %.15g is out of bounds for size %d.", number, size);
+        return false;
+    }
+    *slot = (int)number;
+    return true;
+}
+
+static bool getIndex(Value collection, Value index, Value *result)
+{
+    if (IS_ARRAY(collection))
+    {
+        ObjectArray *array = AS_ARRAY(collection);
+        int slot;
+        if (!arrayIndex(array->items.size, index, &slot))
+            return false;
+        *result = array->items.values[slot];
+        return true;
+    }
+
+    if (IS_TYPED_ARRAY(collection))
+    {
+        ObjectTypedArray *array = AS_TYPED_ARRAY(collection);
+        int slot;
+        if (!arrayIndex(array->length, index, &slot))
+            return false;
+        if (array->kind == TYPED_FLOAT64)
+            *result = NUMBER_VAL(array->as.f64[slot]);
+        else
+            *result = NUMBER_VAL((double)array->as.i64[slot]);
+        return true;
+    }
+
+    if (IS_MAP(collection))
+    {
+        if (!isMapKey(index))
+        {
+            runtimeError("Map key must be a string, number or boolean.");
+            return false;
+        }
+        if (!mapGet(AS_MAP(collection), index, result))
+            *result = NULL_VAL;
+        return true;
+    }
+
+    if (IS_PVECTOR(collection))
+    {
+        int slot;
+        if (!arrayIndex(AS_PVECTOR(collection)->count, index, &slot))
+            return false;
+        *result = pvectorGet(AS_PVECTOR(collection), slot);
+        return true;
+    }
+
+    if (IS_PMAP(collection))
+    {
+        if (!isMapKey(index))
+        {
+            runtimeError("Map key must be a string, number or boolean.");
+            return false;
+        }
+        if (!pmapGet(AS_PMAP(collection), index, result))
+            *result = NULL_VAL;
+        return true;
+    }
+
+    runtimeError("Only arrays, typed arrays and maps can be indexed.");
+    return false;
+}
+
+// collection, index and value are still on the stack, setting may grow.
+static bool setIndex(Value collection, Value index, Value value)
+{
+    if (IS_ARRAY(collection))
+    {
+        ObjectArray *array = AS_ARRAY(collection);
+        int slot;
+        if (!arrayIndex(array->items.size, index, &slot))
+            return false;
+        preWriteBarrier((Object *)array);
+        array->items.values[slot] = value;
+        writeBarrier((Object *)array, value);
+        return true;
+    }
+
+    if (IS_TYPED_ARRAY(collection))
+    {
+        ObjectTypedArray *array = AS_TYPED_ARRAY(collection);
+        int slot;
+        if (!arrayIndex(array->length, index, &slot))
+            return false;
+        if (!IS_NUMBER(value))
+        {
+            runtimeError("Typed array elements must be numbers.");
+            return false;
+        }
+        if (array->kind == TYPED_FLOAT64)
+        {
+            array->as.f64[slot] = AS_NUMBER(value);
+            return true;
+        }
+        int64_t integer;
+        if (!numberToInt64(AS_NUMBER(value), &integer))
+        {
+            runtimeError("Int64Array elements must be integers.");
+            return false;
+        }
+        array->as.i64[slot] = integer;
+        return true;
+    }
+
+    if (IS_MAP(collection))
+    {
+        if (!isMapKey(index))
+        {
+            runtimeError("Map key must be a string, number or boolean.");
+            return false;
+        }
+        mapSet(AS_MAP(collection), index, value);
+        return true;
+    }
+
+    if (IS_PVECTOR(collection) || IS_PMAP(collection))
+    {
+        runtimeError("Persistent collections can't change in place, use assoc().");
+        return false;
+    }
+
+    runtimeError("Only arrays, typed arrays and maps can be indexed.");
+    return false;
+}
+
+// for-in keeps [ collection, cursor, variable ] in three local slots.
+static bool iterateNext(Value *slots, bool *hasNext)
+{
+    if (IS_ARRAY(slots[0]))
+    {
+        ObjectArray *array = AS_ARRAY(slots[0]);
+        int cursor = (int)AS_NUMBER(slots[1]);
+        *hasNext = cursor < array->items.size;
+        if (*hasNext)
+        {
+            slots[2] = array->items.values[cursor];
+            slots[1] = NUMBER_VAL(cursor + 1);
+        }
+        return true;
+    }
+
+    if (IS_TYPED_ARRAY(slots[0]))
+    {
+        int cursor = (int)AS_NUMBER(slots[1]);
+        *hasNext = cursor < AS_TYPED_ARRAY(slots[0])->length;
+        if (*hasNext)
+        {
+            getIndex(slots[0], slots[1], &slots[2]);
+            slots[1] = NUMBER_VAL(cursor + 1);
+        }
+        return true;
+    }
+
+    if (IS_MAP(slots[0]))
+    {
+        int cursor = (int)AS_NUMBER(slots[1]);
+        *hasNext = mapNext(AS_MAP(slots[0]), &cursor, &slots[2]);
+        slots[1] = NUMBER_VAL(cursor);
+        return true;
+    }
+
+    if (IS_PVECTOR(slots[0]))
+    {
+        int cursor = (int)AS_NUMBER(slots[1]);
+        *hasNext = cursor < AS_PVECTOR(slots[0])->count;
+        if (*hasNext)
+        {
+            slots[2] = pvectorGet(AS_PVECTOR(slots[0]), cursor);
+            slots[1] = NUMBER_VAL(cursor + 1);
+        }
+        return true;
+    }
+
+    if (IS_PMAP(slots[0]))
+    {
+        // walking a trie by index is slow, swap in a snapshot of the keys
+        // once and iterate that instead.
+        ObjectArray *keys = newArray();
+        push(OBJ_VAL(keys));
+        pmapKeys(AS_PMAP(slots[0]), keys);
+        slots[0] = OBJ_VAL(keys);
+        pop();
+        return iterateNext(slots, hasNext);
+    }
+
+    if (IS_SEQ(slots[0]))
+    {
+        // the iterator lives in the collection slot, which also keeps it
+        // reachable for as long as the loop runs.
+        slots[0] = OBJ_VAL(newSeqIter(AS_SEQ(slots[0])));
+    }
+
+    if (IS_SEQ_ITER(slots[0]))
+    {
+        return seqNext(&slots[0], &slots[2], hasNext);
+    }
+
+    runtimeError("Only arrays, typed arrays, maps and sequences can be iterated.");
+    return false;
+}
+
+// the slow half of a field read, refills a monomorphic cache.
+static bool fillGetCache(InlineCache *cache, ObjectShape *shape, ObjectString *name)
+{
+    int slot = shapeSlot(shape, name);
+    if (slot == -1)
+    {
+        runtimeError("Undefined field '%.*s'.", name->length, name->chars);
+        return false;
+    }
+    cache->shape = shape;
+    cache->transition = NULL;
+    cache->slot = slot;
+    return true;
+}
+
+// a write either hits an existing slot or, when the field is new, adds it
+// by moving the record along the cached transition.
+static void setField(ObjectRecord *record, ObjectString *name, InlineCache *cache, Value value)
+{
+    ObjectShape *shape = DEREF(ObjectShape, record->shape);
+    if (cache->shape != shape)
+    {
+        int slot = shapeSlot(shape, name);
+        ObjectShape *transition = NULL;
+        if (slot == -1)
+        {
+            transition = shapeTransition(shape, name);
+            slot = transition->slotCount - 1;
+        }
+        cache->shape = shape;
+        cache->transition = transition;
+        cache->slot = slot;
+    }
+
+    if (cache->transition != NULL)
+    {
+        recordAddField(record, cache->transition, value);
+    }
+    else
+    {
+        preWriteBarrier((Object *)record);
+        record->fields[cache->slot] = value;
+        writeBarrier((Object *)record, value);
+    }
+}
+
+// caches live in the function, which may well be older than the shapes.
+static inline void cacheBarrier(ObjectFunction *function, InlineCache *cache)
+{
+    writeBarrierObject((Object *)function, (Object *)cache->shape);
+    writeBarrierObject((Object *)function, (Object *)cache->transition);
+}
+
+// how much fuel is handed out at a time while there's a limit, the clock
+// is read once per slice.
+#define FUEL_SLICE (64 * 1024)
+
+static void grantFuel()
+{
+    int64_t slice = INT64_MAX;
+    if (vm->fuelLimit > 0 || vm->deadline > 0)
+        slice = FUEL_SLICE;
+    if (vm->fuelLimit > 0 && vm->fuelLimit - vm->fuelUsed < slice)
+        slice = vm->fuelLimit - vm->fuelUsed;
+    vm->fuelSlice = slice;
+    vm->fuel = slice;
+}
+
+static void startMeter()
+{
+    vm->fuelUsed = 0;
+    vm->deadline = vm->timeLimit > 0 ? gcClock() + vm->timeLimit : 0;
+    grantFuel();
+}
+
+// the slice ran out. false if one of the limits did too, then the script
+// was either suspended or failed.
+static bool refuel(int baseFrame)
+{
+    vm->fuelUsed += vm->fuelSlice - vm->fuel;
+    bool empty = vm->fuelLimit > 0 && vm->fuelUsed >= vm->fuelLimit;
+    bool late = vm->deadline > 0 && gcClock() >= vm->deadline;
+    if (!empty && !late)
+    {
+        grantFuel();
+        return true;
+    }
+    // a script called back from a native can't be left halfway through.
+    if (vm->suspendOnLimit && baseFrame == 0)
+    {
+        vm->suspended = true;
+        return false;
+    }
+    if (empty)
+        runtimeError("Out of fuel, the limit is %lld.", (long long)vm->fuelLimit);
+    else
+        runtimeError("Out of time, the limit is %g seconds.", vm->timeLimit);
+    return false;
+}
+
+// runs until the frame above baseFrame returns, leaving its result on
+// the stack. natives re-enter here to call back into scripts.
+static InterpretResult run(int baseFrame)
 {
-    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    int debugLevel = vm->debugLevel;
 
 #define READ_BYTE() (*frame->ip++)
 #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
+#define READ_CONSTANT() (DEREF(ObjectFunction, frame->closure->function)->chunk.constants.values[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_CACHE() (&DEREF(ObjectFunction, frame->closure->function)->chunk.caches[READ_SHORT()])
+// minor collections move objects, so they only run here where every live
+// reference is on the vm stack or in a frame, and no native below holds
+// one in C.
+#define SAFEPOINT()                                   \
+    do                                                \
+    {                                                 \
+        if (vm->youngRequested && vm->pinned == 0)    \
+            collectYoung();                           \
+    } while (false)
+
+// loops and calls use up fuel. rewind puts the ip back on the instruction
+// so a resumed script runs it again.
+#define METER(cost, rewind)                                    \
+    do                                                         \
+    {                                                          \
+        if ((vm->fuel -= (cost)) < 0 && !refuel(baseFrame))    \
+        {                                                      \
+            if (!vm->suspended)                                \
+                return INTERPRET_RUNTIME_ERROR;                \
+            frame->ip -= (rewind);                             \
+            return INTERPRET_SUSPENDED;                        \
+        }                                                      \
+    } while (false)
 
 #define BINARY_OP(t, op)                                \
     do                                                  \
@@ -234,7 +721,7 @@ static InterpretResult run(int debugLevel)
     } while (false)
 
     //#ifdef DEBUG_TRACE_EXECUTION
-    if (debugLevel > 1)
+    if (debugLevel > 1 && baseFrame == 0)
         printf("== %s ==\n", "execution trace");
     //#endif
     for (;;)
@@ -243,14 +730,14 @@ static InterpretResult run(int debugLevel)
         if (debugLevel > 1)
         {
             printf("          ");
-            for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
+            for (Value *slot = vm->stack; slot < vm->stackTop; slot++)
             {
                 printf("[ ");
                 printValue(*slot);
                 printf(" ]");
             }
             printf("\n");
-            disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+            disassembleInstruction(&DEREF(ObjectFunction, frame->closure->function)->chunk, (int)(frame->ip - DEREF(ObjectFunction, frame->closure->function)->chunk.code));
         }
         //#endif
 
@@ -291,9 +778,9 @@ static InterpretResult run(int debugLevel)
         {
             ObjectString *name = READ_STRING();
             Value value;
-            if (!tableGet(&vm.globals, name, &value))
+            if (!tableGet(&vm->globals, name, &value))
             {
-                runtimeError("Undefined variable '%s'.", name->chars);
+                runtimeError("Undefined variable '%.*s'.", name->length, name->chars);
                 return INTERPRET_RUNTIME_ERROR;
             }
             push(value);
@@ -325,7 +812,8 @@ static InterpretResult run(int debugLevel)
             //     runtimeError("Cannot assign value to variable with different type.");
             //     return INTERPRET_RUNTIME_ERROR;
             // }
-            tableSet(&vm.globals, name, value);
+            tableSet(&vm->globals, name, value);
+            writeBarrierGlobal(name, value);
             break;
         }
         case OP_SET_LOCAL:
@@ -343,24 +831,28 @@ static InterpretResult run(int debugLevel)
         case OP_SET_GLOBAL:
         {
             ObjectString *name = READ_STRING();
-            if (tableSet(&vm.globals, name, peek(0)))
+            if (tableSet(&vm->globals, name, peek(0)))
             {
-                tableDelete(&vm.globals, name);
-                runtimeError("Undefined variable '%s'.", name->chars);
+                tableDelete(&vm->globals, name);
+                runtimeError("Undefined variable '%.*s'.", name->length, name->chars);
                 return INTERPRET_RUNTIME_ERROR;
             }
+            writeBarrierGlobal(name, peek(0));
             break;
         }
         case OP_GET_UPVALUE:
         {
             uint8_t slot = READ_BYTE();
-            push(*frame->closure->upvalues[slot]->location);
+            push(*DEREF(ObjectUpvalue, frame->closure->upvalues[slot])->location);
             break;
         }
         case OP_SET_UPVALUE:
         {
             uint8_t slot = READ_BYTE();
-            *frame->closure->upvalues[slot]->location = peek(0);
+            ObjectUpvalue *upvalue = DEREF(ObjectUpvalue, frame->closure->upvalues[slot]);
+            preWriteBarrier((Object *)upvalue);
+            *upvalue->location = peek(0);
+            writeBarrier((Object *)upvalue, peek(0));
             break;
         }
         case OP_EQUAL:
@@ -447,8 +939,10 @@ static InterpretResult run(int debugLevel)
             break;
         case OP_OUTPUT:
         {
-            printValue(pop());
-            printf("\n");
+            writeOutputLine(&vm->output, pop());
+            // the execution trace goes straight to stdout, stay in order.
+            if (debugLevel > 1)
+                flushOutput(&vm->output);
             break;
         }
         case OP_JUMP_IF_FALSE:
@@ -467,17 +961,23 @@ static InterpretResult run(int debugLevel)
         case OP_LOOP:
         {
             uint16_t offset = READ_SHORT();
+            SAFEPOINT();
+            // the longer the loop the more it costs. metered before the jump
+            // so an error points at the loop, not before it.
+            METER(offset, 3);
             frame->ip -= offset;
             break;
         }
         case OP_CALL:
         {
             int argCount = READ_BYTE();
+            SAFEPOINT();
+            METER(1, 2);
             if (!callValue(peek(argCount), argCount))
             {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &vm.frames[vm.frameCount - 1];
+            frame = &vm->frames[vm->frameCount - 1];
             break;
         }
         case OP_CLOSURE:
@@ -492,7 +992,7 @@ static InterpretResult run(int debugLevel)
                 if (isLocal)
                 {
                     closure->upvalues[i] =
-                        captureUpvalue(frame->slots + index);
+                        REF(captureUpvalue(frame->slots + index));
                 }
                 else
                 {
@@ -501,9 +1001,111 @@ static InterpretResult run(int debugLevel)
             }
             break;
         }
+        case OP_MAP:
+            push(OBJ_VAL(newMap()));
+            break;
+        case OP_MAP_INSERT:
+        {
+            if (!setIndex(peek(2), peek(1), peek(0)))
+                return INTERPRET_RUNTIME_ERROR;
+            vm->stackTop -= 2;
+            break;
+        }
+        case OP_ARRAY:
+            push(OBJ_VAL(newArray()));
+            break;
+        case OP_ARRAY_PUSH:
+        {
+            // the element stays on the stack while the buffer grows.
+            preWriteBarrier(AS_OBJ(peek(1)));
+            writeValueArr(&AS_ARRAY(peek(1))->items, peek(0));
+            writeBarrier(AS_OBJ(peek(1)), peek(0));
+            pop();
+            break;
+        }
+        case OP_INDEX_GET:
+        {
+            Value result;
+            if (!getIndex(peek(1), peek(0), &result))
+                return INTERPRET_RUNTIME_ERROR;
+            vm->stackTop -= 2;
+            push(result);
+            break;
+        }
+        case OP_INDEX_SET:
+        {
+            Value value = peek(0);
+            if (!setIndex(peek(2), peek(1), value))
+                return INTERPRET_RUNTIME_ERROR;
+            vm->stackTop -= 3;
+            push(value);
+            break;
+        }
+        case OP_ITER_NEXT:
+        {
+            uint8_t slot = READ_BYTE();
+            uint16_t offset = READ_SHORT();
+            bool hasNext;
+            if (!iterateNext(&frame->slots[slot], &hasNext))
+                return INTERPRET_RUNTIME_ERROR;
+            if (!hasNext)
+                frame->ip += offset;
+            break;
+        }
+        case OP_RECORD:
+            push(OBJ_VAL(newRecord()));
+            break;
+        case OP_RECORD_FIELD:
+        {
+            ObjectString *name = READ_STRING();
+            InlineCache *cache = READ_CACHE();
+            preWriteBarrier((Object *)DEREF(ObjectFunction, frame->closure->function));
+            setField(AS_RECORD(peek(1)), name, cache, peek(0));
+            cacheBarrier(DEREF(ObjectFunction, frame->closure->function), cache);
+            pop();
+            break;
+        }
+        case OP_GET_FIELD:
+        {
+            ObjectString *name = READ_STRING();
+            InlineCache *cache = READ_CACHE();
+            if (!IS_RECORD(peek(0)))
+            {
+                runtimeError("Only records have fields.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            ObjectRecord *record = AS_RECORD(peek(0));
+            ObjectShape *shape = DEREF(ObjectShape, record->shape);
+            if (cache->shape != shape)
+            {
+                preWriteBarrier((Object *)DEREF(ObjectFunction, frame->closure->function));
+                if (!fillGetCache(cache, shape, name))
+                    return INTERPRET_RUNTIME_ERROR;
+                cacheBarrier(DEREF(ObjectFunction, frame->closure->function), cache);
+            }
+            vm->stackTop[-1] = record->fields[cache->slot];
+            break;
+        }
+        case OP_SET_FIELD:
+        {
+            ObjectString *name = READ_STRING();
+            InlineCache *cache = READ_CACHE();
+            if (!IS_RECORD(peek(1)))
+            {
+                runtimeError("Only records have fields.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            Value value = peek(0);
+            preWriteBarrier((Object *)DEREF(ObjectFunction, frame->closure->function));
+            setField(AS_RECORD(peek(1)), name, cache, value);
+            cacheBarrier(DEREF(ObjectFunction, frame->closure->function), cache);
+            vm->stackTop -= 2;
+            push(value);
+            break;
+        }
         case OP_CLOSE_UPVALUE:
         {
-            closeUpvalues(vm.stackTop - 1);
+            closeUpvalues(vm->stackTop - 1);
             pop();
             break;
         }
@@ -515,17 +1117,14 @@ static InterpretResult run(int debugLevel)
             //#endif
             Value result = pop();
             closeUpvalues(frame->slots);
-            vm.frameCount--;
-            if (vm.frameCount == 0)
-            {
-                pop();
-                return INTERPRET_OK;
-            }
+            vm->frameCount--;
 
-            vm.stackTop = frame->slots;
+            vm->stackTop = frame->slots;
             push(result);
+            if (vm->frameCount == baseFrame)
+                return INTERPRET_OK;
 
-            frame = &vm.frames[vm.frameCount - 1];
+            frame = &vm->frames[vm->frameCount - 1];
             break;
         }
         }
@@ -534,12 +1133,60 @@ static InterpretResult run(int debugLevel)
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_CACHE
+#undef SAFEPOINT
+#undef METER
 #undef BINARY_OP
 }
 
-InterpretResult interpret(const char *source, const char *filename, int debugLevel)
+// the error was reported where it happened. nothing holds on to what the
+// script left in the nursery now.
+static InterpretResult recover(jmp_buf *enclosing)
+{
+    vm->errorJump = enclosing;
+    vm->suspended = false;
+    resetCompiler();
+    resetStack();
+    collectYoung();
+    flushOutput(&vm->output);
+    return INTERPRET_RUNTIME_ERROR;
+}
+
+// runs body with the errors that jump caught. the work is all in body,
+// so no local that changes after the setjmp can be clobbered by the jump.
+static InterpretResult guarded(InterpretResult (*body)(void *), void *data)
+{
+    jmp_buf errorJump;
+    jmp_buf *enclosing = vm->errorJump;
+    vm->errorJump = &errorJump;
+    if (setjmp(errorJump) != 0)
+        return recover(enclosing);
+    InterpretResult result = body(data);
+    vm->errorJump = enclosing;
+    return result;
+}
+
+// a suspended script keeps its frames and stack until it's resumed.
+static InterpretResult finish(InterpretResult result)
+{
+    if (result == INTERPRET_OK)
+        pop();
+    flushOutput(&vm->output);
+    return result;
+}
+
+typedef struct
+{
+    const char *source;
+    ObjectSource *owner;
+    const char *filename;
+    int debugLevel;
+} ScriptJob;
+
+static InterpretResult runScript(void *data)
 {
-    ObjectFunction *function = compile(source, filename, debugLevel);
+    ScriptJob *job = data;
+    ObjectFunction *function = compile(job->source, job->owner, job->filename, job->debugLevel);
     if (function == NULL)
         return INTERPRET_COMPILE_ERROR;
 
@@ -549,5 +1196,115 @@ InterpretResult interpret(const char *source, const char *filename, int debugLev
     push(OBJ_VAL(closure));
     callValue(OBJ_VAL(closure), 0);
 
-    return run(debugLevel);
+    vm->debugLevel = job->debugLevel;
+    startMeter();
+    return finish(run(0));
+}
+
+static InterpretResult compileAndRun(const char *source, ObjectSource *owner, const char *filename, int debugLevel)
+{
+    if (vm->suspended)
+    {
+        resetStack();
+        vm->suspended = false;
+    }
+
+    ScriptJob job = {source, owner, filename, debugLevel};
+    return guarded(runScript, &job);
+}
+
+static InterpretResult resumeScript(void *data)
+{
+    vm->suspended = false;
+    startMeter();
+    return finish(run(0));
+}
+
+static InterpretResult resume()
+{
+    if (!vm->suspended)
+        return INTERPRET_OK;
+    return guarded(resumeScript, NULL);
+}
+
+InterpretResult resumeInterpret(VM *isolate)
+{
+    VM *previous = enterVM(isolate);
+    InterpretResult result = resume();
+    enterVM(previous);
+    return result;
+}
+
+void setRunLimits(VM *isolate, int64_t fuel, double seconds, bool suspend)
+{
+    isolate->fuelLimit = fuel > 0 ? fuel : 0;
+    isolate->timeLimit = seconds > 0 ? seconds : 0;
+    isolate->suspendOnLimit = suspend;
+}
+
+int newHandle(Value value)
+{
+    for (int i = 0; i < vm->handles.size; i++)
+    {
+        if (IS_NULL(vm->handles.values[i]))
+        {
+            vm->handles.values[i] = value;
+            return i;
+        }
+    }
+    // growing the array may collect.
+    push(value);
+    writeValueArr(&vm->handles, value);
+    pop();
+    return vm->handles.size - 1;
+}
+
+void freeHandle(int handle)
+{
+    vm->handles.values[handle] = NULL_VAL;
+}
+
+InterpretResult protectedCall(VM *isolate, InterpretResult (*body)(void *), void *data)
+{
+    VM *previous = enterVM(isolate);
+    InterpretResult result = guarded(body, data);
+    enterVM(previous);
+    return result;
+}
+
+InterpretResult callOnStack(int argCount)
+{
+    int frameCount = vm->frameCount;
+    if (frameCount == 0)
+        startMeter();
+    Value *base = vm->stackTop - argCount - 1;
+    if (!callValue(peek(argCount), argCount))
+    {
+        // an error with nothing running doesn't reset the stack.
+        if (vm->stackTop > base)
+            vm->stackTop = base;
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    // a native is done already.
+    InterpretResult result = INTERPRET_OK;
+    if (vm->frameCount > frameCount)
+        result = run(frameCount);
+    flushOutput(&vm->output);
+    return result;
+}
+
+InterpretResult interpret(VM *isolate, const char *source, const char *filename, int debugLevel)
+{
+    VM *previous = enterVM(isolate);
+    InterpretResult result = compileAndRun(source, NULL, filename, debugLevel);
+    enterVM(previous);
+    return result;
+}
+
+InterpretResult interpretSource(VM *isolate, ObjectSource *source, const char *filename, int debugLevel)
+{
+    VM *previous = enterVM(isolate);
+    InterpretResult result = compileAndRun(source->bytes, source, filename, debugLevel);
+    enterVM(previous);
+    return result;
 }
\ No newline at end of file
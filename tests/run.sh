@@ -0,0 +1,21 @@
+#!/bin/sh
+# runs every tests/*.meon and compares what it prints with the .out next
+# to it. a first line like "// flags: --gc-max-heap=8M" is passed along,
+# a line like "// status: 70" says how a test that fails should exit.
+meon=${1:-build/meon}
+failed=0
+for test in "$(dirname "$0")"/*.meon; do
+    name=$(basename "$test" .meon)
+    flags=$(sed -n '1s|^// flags: ||p' "$test")
+    expected=$(sed -n 's|^// status: ||p' "$test")
+    "$meon" $flags -r "$test" > /tmp/meon-$name.txt 2> /dev/null
+    status=$?
+    if [ "$status" -eq "${expected:-0}" ] && diff -u "${test%.meon}.out" /tmp/meon-$name.txt; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        failed=1
+    fi
+    rm -f /tmp/meon-$name.txt
+done
+exit $failed